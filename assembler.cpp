@@ -0,0 +1,1479 @@
+#include "assembler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+
+namespace
+{
+    constexpr int kMaxLinkPasses = 64;
+
+    typedef std::unordered_map<std::string, int64_t> SymbolTable;
+
+    const char *const kRegisters8[] = {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"};
+    const char *const kRegisters16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+    const char *const kSegmentRegisters[] = {"es", "cs", "ss", "ds"};
+
+    struct SimpleOpcode
+    {
+        const char *name;
+        uint8_t opcode;
+    };
+
+    const SimpleOpcode kSimpleOpcodes[] = {
+        {"nop", 0x90}, {"hlt", 0xF4}, {"cli", 0xFA}, {"sti", 0xFB}, {"cld", 0xFC}, {"std", 0xFD},
+        {"clc", 0xF8}, {"stc", 0xF9}, {"cmc", 0xF5}, {"ret", 0xC3}, {"retf", 0xCB}, {"iret", 0xCF},
+        {"pushf", 0x9C}, {"popf", 0x9D}, {"pusha", 0x60}, {"popa", 0x61}, {"lodsb", 0xAC}, {"lodsw", 0xAD},
+        {"stosb", 0xAA}, {"stosw", 0xAB}, {"movsb", 0xA4}, {"movsw", 0xA5}, {"cbw", 0x98}, {"cwd", 0x99},
+        {"lahf", 0x9F}, {"sahf", 0x9E}, {"int3", 0xCC}, {"into", 0xCE},
+    };
+
+    // ALU ops share an opcode layout: base + {0,1} for r/m,reg and /ext for
+    // the immediate group.
+    const SimpleOpcode kAluOpcodes[] = {
+        {"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7},
+    };
+
+    const SimpleOpcode kUnaryOpcodes[] = {
+        {"not", 2}, {"neg", 3}, {"mul", 4}, {"imul", 5}, {"div", 6}, {"idiv", 7},
+    };
+
+    const SimpleOpcode kShiftOpcodes[] = {
+        {"rol", 0}, {"ror", 1}, {"rcl", 2}, {"rcr", 3}, {"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7},
+    };
+
+    const SimpleOpcode kConditionCodes[] = {
+        {"jo", 0x0}, {"jno", 0x1}, {"jb", 0x2}, {"jc", 0x2}, {"jnae", 0x2}, {"jnb", 0x3},
+        {"jae", 0x3}, {"jnc", 0x3}, {"je", 0x4}, {"jz", 0x4}, {"jne", 0x5}, {"jnz", 0x5},
+        {"jbe", 0x6}, {"jna", 0x6}, {"ja", 0x7}, {"jnbe", 0x7}, {"js", 0x8}, {"jns", 0x9},
+        {"jp", 0xA}, {"jpe", 0xA}, {"jnp", 0xB}, {"jpo", 0xB}, {"jl", 0xC}, {"jnge", 0xC},
+        {"jge", 0xD}, {"jnl", 0xD}, {"jle", 0xE}, {"jng", 0xE}, {"jg", 0xF}, {"jnle", 0xF},
+    };
+
+    const SimpleOpcode kShortOnlyJumps[] = {
+        {"loop", 0xE2}, {"loope", 0xE1}, {"loopz", 0xE1}, {"loopne", 0xE0}, {"loopnz", 0xE0}, {"jcxz", 0xE3},
+    };
+
+    const SimpleOpcode *FindOpcode(const SimpleOpcode *table, size_t count, const std::string &name)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (name == table[i].name)
+                return &table[i];
+        }
+        return nullptr;
+    }
+
+    template <size_t N>
+    const SimpleOpcode *FindOpcode(const SimpleOpcode (&table)[N], const std::string &name)
+    {
+        return FindOpcode(table, N, name);
+    }
+
+    template <size_t N>
+    int FindRegister(const char *const (&table)[N], const std::string &name)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (name == table[i])
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    std::string Lowercase(std::string_view text)
+    {
+        std::string result(text);
+        for (char &c : result)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return result;
+    }
+
+    std::string_view Trim(std::string_view text)
+    {
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+            text.remove_prefix(1);
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    bool IsIdentifierStart(char c)
+    {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '?' || c == '@';
+    }
+
+    bool IsIdentifierChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '?' || c == '@' || c == '$' || c == '#' || c == '~';
+    }
+
+    std::string_view StripComment(std::string_view line)
+    {
+        char quote = 0;
+        for (size_t i = 0; i < line.size(); ++i)
+        {
+            char c = line[i];
+            if (quote != 0)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '\'' || c == '"' || c == '`')
+            {
+                quote = c;
+            }
+            else if (c == ';')
+            {
+                return line.substr(0, i);
+            }
+        }
+        return line;
+    }
+
+    // Splits on commas that are not inside quotes, brackets or parentheses.
+    std::vector<std::string_view> SplitOperands(std::string_view text)
+    {
+        std::vector<std::string_view> operands;
+        text = Trim(text);
+        if (text.empty())
+            return operands;
+
+        char quote = 0;
+        int depth = 0;
+        size_t start = 0;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            char c = text[i];
+            if (quote != 0)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '\'' || c == '"' || c == '`')
+                quote = c;
+            else if (c == '(' || c == '[')
+                ++depth;
+            else if (c == ')' || c == ']')
+                --depth;
+            else if (c == ',' && depth == 0)
+            {
+                operands.push_back(Trim(text.substr(start, i - start)));
+                start = i + 1;
+            }
+        }
+        operands.push_back(Trim(text.substr(start)));
+        return operands;
+    }
+
+    bool ParseNumber(std::string_view text, int64_t &value)
+    {
+        std::string digits;
+        for (char c : text)
+        {
+            if (c != '_')
+                digits += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+
+        int base = 10;
+        if (digits.size() > 1 && digits.back() == 'h')
+        {
+            base = 16;
+            digits.pop_back();
+        }
+        else if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'h'))
+        {
+            base = 16;
+            digits.erase(0, 2);
+        }
+        else if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'y'))
+        {
+            base = 2;
+            digits.erase(0, 2);
+        }
+        else if (digits.size() > 1 && (digits.back() == 'b' || digits.back() == 'y'))
+        {
+            base = 2;
+            digits.pop_back();
+        }
+        else if (digits.size() > 1 && (digits.back() == 'q' || digits.back() == 'o'))
+        {
+            base = 8;
+            digits.pop_back();
+        }
+        else if (digits.size() > 1 && digits.back() == 'd')
+        {
+            digits.pop_back();
+        }
+
+        if (digits.empty())
+            return false;
+
+        value = 0;
+        for (char c : digits)
+        {
+            int digit = std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : 99;
+            if (digit >= base)
+                return false;
+            value = value * base + digit;
+        }
+        return true;
+    }
+
+    // Recursive descent over one expression, producing postfix tokens. Stops
+    // at the first character that cannot continue the expression so callers
+    // like 'times' can parse what follows.
+    class ExprParser
+    {
+    public:
+        ExprParser(std::string_view text, const std::string &scope) : text(text), scope(scope) {}
+
+        bool Parse(AsmExpr &expr, std::string &message)
+        {
+            out = &expr;
+            if (!ParseOr())
+            {
+                message = this->message.empty() ? "expression syntax error" : this->message;
+                return false;
+            }
+            return true;
+        }
+
+        size_t Position()
+        {
+            SkipSpace();
+            return pos;
+        }
+
+    private:
+        std::string_view text;
+        const std::string &scope;
+        size_t pos = 0;
+        AsmExpr *out = nullptr;
+        std::string message;
+
+        void SkipSpace()
+        {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                ++pos;
+        }
+
+        bool Accept(const char *op)
+        {
+            SkipSpace();
+            size_t length = std::char_traits<char>::length(op);
+            if (text.substr(pos, length) != op)
+                return false;
+            // Keep '<<' from matching '<' and friends.
+            if (length == 1 && pos + 1 < text.size() && (op[0] == '<' || op[0] == '>') && text[pos + 1] == op[0])
+                return false;
+            pos += length;
+            return true;
+        }
+
+        void Emit(AsmExprOp op, int64_t value = 0, std::string symbol = std::string())
+        {
+            out->tokens.push_back(AsmExprToken{op, value, std::move(symbol)});
+        }
+
+        bool ParseOr()
+        {
+            if (!ParseXor())
+                return false;
+            while (Accept("|"))
+            {
+                if (!ParseXor())
+                    return false;
+                Emit(AsmExprOr);
+            }
+            return true;
+        }
+
+        bool ParseXor()
+        {
+            if (!ParseAnd())
+                return false;
+            while (Accept("^"))
+            {
+                if (!ParseAnd())
+                    return false;
+                Emit(AsmExprXor);
+            }
+            return true;
+        }
+
+        bool ParseAnd()
+        {
+            if (!ParseShift())
+                return false;
+            while (Accept("&"))
+            {
+                if (!ParseShift())
+                    return false;
+                Emit(AsmExprAnd);
+            }
+            return true;
+        }
+
+        bool ParseShift()
+        {
+            if (!ParseSum())
+                return false;
+            for (;;)
+            {
+                AsmExprOp op;
+                if (Accept("<<"))
+                    op = AsmExprShl;
+                else if (Accept(">>"))
+                    op = AsmExprShr;
+                else
+                    return true;
+                if (!ParseSum())
+                    return false;
+                Emit(op);
+            }
+        }
+
+        bool ParseSum()
+        {
+            if (!ParseProduct())
+                return false;
+            for (;;)
+            {
+                AsmExprOp op;
+                if (Accept("+"))
+                    op = AsmExprAdd;
+                else if (Accept("-"))
+                    op = AsmExprSub;
+                else
+                    return true;
+                if (!ParseProduct())
+                    return false;
+                Emit(op);
+            }
+        }
+
+        bool ParseProduct()
+        {
+            if (!ParseUnary())
+                return false;
+            for (;;)
+            {
+                AsmExprOp op;
+                if (Accept("*"))
+                    op = AsmExprMul;
+                else if (Accept("/"))
+                    op = AsmExprDiv;
+                else if (Accept("%"))
+                    op = AsmExprMod;
+                else
+                    return true;
+                if (!ParseUnary())
+                    return false;
+                Emit(op);
+            }
+        }
+
+        bool ParseUnary()
+        {
+            if (Accept("-"))
+            {
+                if (!ParseUnary())
+                    return false;
+                Emit(AsmExprNeg);
+                return true;
+            }
+            if (Accept("~"))
+            {
+                if (!ParseUnary())
+                    return false;
+                Emit(AsmExprNot);
+                return true;
+            }
+            if (Accept("+"))
+                return ParseUnary();
+            return ParsePrimary();
+        }
+
+        bool ParsePrimary()
+        {
+            SkipSpace();
+            if (pos >= text.size())
+                return false;
+
+            char c = text[pos];
+            if (c == '(')
+            {
+                ++pos;
+                if (!ParseOr() || !Accept(")"))
+                    return false;
+                return true;
+            }
+
+            if (c == '\'' || c == '"' || c == '`')
+            {
+                size_t end = text.find(c, pos + 1);
+                if (end == std::string_view::npos)
+                {
+                    message = "unterminated string";
+                    return false;
+                }
+                std::string_view chars = text.substr(pos + 1, end - pos - 1);
+                if (chars.size() > 8)
+                {
+                    message = "character constant too long";
+                    return false;
+                }
+                int64_t value = 0;
+                for (size_t i = 0; i < chars.size(); ++i)
+                    value |= static_cast<int64_t>(static_cast<uint8_t>(chars[i])) << (8 * i);
+                Emit(AsmExprNumber, value);
+                pos = end + 1;
+                return true;
+            }
+
+            if (c == '$' && (pos + 1 >= text.size() || !IsIdentifierChar(text[pos + 1]) || text[pos + 1] == '$'))
+            {
+                if (pos + 1 < text.size() && text[pos + 1] == '$')
+                {
+                    pos += 2;
+                    Emit(AsmExprSectionStart);
+                }
+                else
+                {
+                    ++pos;
+                    Emit(AsmExprHere);
+                }
+                return true;
+            }
+
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '$')
+            {
+                size_t start = pos;
+                if (c == '$')
+                    ++pos;
+                while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+                    ++pos;
+                std::string_view token = text.substr(start, pos - start);
+                std::string number = c == '$' ? "0x" + std::string(token.substr(1)) : std::string(token);
+                int64_t value;
+                if (!ParseNumber(number, value))
+                {
+                    message = "invalid number '" + std::string(token) + "'";
+                    return false;
+                }
+                Emit(AsmExprNumber, value);
+                return true;
+            }
+
+            if (IsIdentifierStart(c))
+            {
+                size_t start = pos;
+                while (pos < text.size() && IsIdentifierChar(text[pos]))
+                    ++pos;
+                std::string name(text.substr(start, pos - start));
+                if (name[0] == '.')
+                    name = scope + name;
+                Emit(AsmExprSymbol, 0, name);
+                return true;
+            }
+
+            return false;
+        }
+    };
+
+    bool ApplyOperator(AsmExprOp op, std::vector<int64_t> &stack, std::string &message)
+    {
+        if (op == AsmExprNeg || op == AsmExprNot)
+        {
+            if (stack.empty())
+                return false;
+            stack.back() = op == AsmExprNeg ? -stack.back() : ~stack.back();
+            return true;
+        }
+
+        if (stack.size() < 2)
+            return false;
+        int64_t right = stack.back();
+        stack.pop_back();
+        int64_t &left = stack.back();
+
+        switch (op)
+        {
+        case AsmExprAdd:
+            left += right;
+            break;
+        case AsmExprSub:
+            left -= right;
+            break;
+        case AsmExprMul:
+            left *= right;
+            break;
+        case AsmExprDiv:
+        case AsmExprMod:
+            if (right == 0)
+            {
+                message = "division by zero";
+                return false;
+            }
+            left = op == AsmExprDiv ? static_cast<int64_t>(static_cast<uint64_t>(left) / static_cast<uint64_t>(right))
+                                    : static_cast<int64_t>(static_cast<uint64_t>(left) % static_cast<uint64_t>(right));
+            break;
+        case AsmExprAnd:
+            left &= right;
+            break;
+        case AsmExprOr:
+            left |= right;
+            break;
+        case AsmExprXor:
+            left ^= right;
+            break;
+        case AsmExprShl:
+            left = static_cast<int64_t>(static_cast<uint64_t>(left) << (right & 63));
+            break;
+        case AsmExprShr:
+            left = static_cast<int64_t>(static_cast<uint64_t>(left) >> (right & 63));
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    // Looks symbols up in primary, then in fallback (the previous link pass)
+    // when given. Reports the first missing symbol through missing.
+    bool EvaluateExpr(const AsmExpr &expr, const SymbolTable *primary, const SymbolTable *fallback, int64_t here,
+                      int64_t sectionStart, int64_t &value, std::string &message)
+    {
+        std::vector<int64_t> stack;
+        stack.reserve(expr.tokens.size());
+
+        for (const AsmExprToken &token : expr.tokens)
+        {
+            switch (token.op)
+            {
+            case AsmExprNumber:
+                stack.push_back(token.value);
+                break;
+            case AsmExprHere:
+                stack.push_back(here);
+                break;
+            case AsmExprSectionStart:
+                stack.push_back(sectionStart);
+                break;
+            case AsmExprSymbol:
+            {
+                auto it = primary != nullptr ? primary->find(token.symbol) : SymbolTable::const_iterator();
+                if (primary != nullptr && it != primary->end())
+                {
+                    stack.push_back(it->second);
+                    break;
+                }
+                if (fallback != nullptr && (it = fallback->find(token.symbol)) != fallback->end())
+                {
+                    stack.push_back(it->second);
+                    break;
+                }
+                message = "symbol '" + token.symbol + "' undefined";
+                return false;
+            }
+            default:
+                if (!ApplyOperator(token.op, stack, message))
+                {
+                    if (message.empty())
+                        message = "expression syntax error";
+                    return false;
+                }
+                break;
+            }
+        }
+
+        if (stack.size() != 1)
+        {
+            message = "expression syntax error";
+            return false;
+        }
+        value = stack.back();
+        return true;
+    }
+
+    bool IsConstant(const AsmExpr &expr)
+    {
+        return std::none_of(expr.tokens.begin(), expr.tokens.end(), [](const AsmExprToken &token)
+                            { return token.op == AsmExprSymbol || token.op == AsmExprHere || token.op == AsmExprSectionStart; });
+    }
+
+    enum OperandKind
+    {
+        OperandRegister8,
+        OperandRegister16,
+        OperandSegment,
+        OperandImmediate,
+        OperandFar
+    };
+
+    struct Operand
+    {
+        OperandKind kind = OperandImmediate;
+        int reg = -1;
+        AsmExpr expr;
+        AsmExpr segment;
+        bool constant = false;
+        int64_t value = 0;
+        AsmJumpForm form = AsmJumpAuto;
+    };
+
+    class FragmentBuilder
+    {
+    public:
+        FragmentBuilder(AsmFragment &fragment, std::string &scope, AsmError &error) : fragment(fragment), scope(scope), error(error) {}
+
+        bool AssembleLine(std::string_view line, int lineNumber)
+        {
+            this->lineNumber = lineNumber;
+            line = Trim(StripComment(line));
+            if (line.empty())
+                return true;
+
+            if (line.front() == '[' && line.back() == ']')
+                line = Trim(line.substr(1, line.size() - 2));
+
+            // Label definition: an identifier followed by ':'.
+            size_t end = 0;
+            while (end < line.size() && IsIdentifierChar(line[end]))
+                ++end;
+            if (end > 0 && IsIdentifierStart(line[0]) && Trim(line.substr(end)).substr(0, 1) == ":")
+            {
+                std::string name(line.substr(0, end));
+                if (name[0] == '.')
+                    name = scope + name;
+                else
+                    scope = name;
+
+                AsmItem item = NewItem(AsmItemLabel);
+                item.label = name;
+                fragment.items.push_back(std::move(item));
+
+                line = Trim(Trim(line.substr(end)).substr(1));
+                if (line.empty())
+                    return true;
+            }
+
+            size_t mnemonicEnd = 0;
+            while (mnemonicEnd < line.size() && !std::isspace(static_cast<unsigned char>(line[mnemonicEnd])))
+                ++mnemonicEnd;
+            std::string mnemonic = Lowercase(line.substr(0, mnemonicEnd));
+            std::string_view operands = Trim(line.substr(mnemonicEnd));
+
+            if (mnemonic == "times")
+                return AssembleTimes(operands);
+
+            return AssembleStatement(mnemonic, operands, true);
+        }
+
+    private:
+        AsmFragment &fragment;
+        std::string &scope;
+        AsmError &error;
+        int lineNumber = 0;
+
+        std::vector<uint8_t> bytes;
+        std::vector<AsmFixup> fixups;
+
+        AsmItem NewItem(AsmItemKind kind)
+        {
+            AsmItem item;
+            item.kind = kind;
+            item.line = lineNumber;
+            return item;
+        }
+
+        bool Fail(const std::string &message)
+        {
+            error.line = lineNumber;
+            error.message = message;
+            return false;
+        }
+
+        bool ParseExpr(std::string_view text, AsmExpr &expr)
+        {
+            ExprParser parser(text, scope);
+            std::string message;
+            if (!parser.Parse(expr, message))
+                return Fail(message);
+            if (parser.Position() != text.size())
+                return Fail("unexpected '" + std::string(text.substr(parser.Position())) + "' in expression");
+            return true;
+        }
+
+        bool ParseOperand(std::string_view text, Operand &operand)
+        {
+            text = Trim(text);
+            std::string lower = Lowercase(text);
+
+            for (const char *keyword : {"short ", "near ", "byte ", "word "})
+            {
+                if (lower.compare(0, std::char_traits<char>::length(keyword), keyword) == 0)
+                {
+                    if (keyword[0] == 's')
+                        operand.form = AsmJumpShort;
+                    else if (keyword[0] == 'n')
+                        operand.form = AsmJumpNear;
+                    text = Trim(text.substr(std::char_traits<char>::length(keyword)));
+                    lower = Lowercase(text);
+                    break;
+                }
+            }
+
+            if (!text.empty() && text.front() == '[')
+                return Fail("memory operands are not supported");
+
+            if ((operand.reg = FindRegister(kRegisters8, lower)) >= 0)
+            {
+                operand.kind = OperandRegister8;
+                return true;
+            }
+            if ((operand.reg = FindRegister(kRegisters16, lower)) >= 0)
+            {
+                operand.kind = OperandRegister16;
+                return true;
+            }
+            if ((operand.reg = FindRegister(kSegmentRegisters, lower)) >= 0)
+            {
+                operand.kind = OperandSegment;
+                return true;
+            }
+
+            size_t colon = text.find(':');
+            if (colon != std::string_view::npos && text.find_first_of("'\"`") == std::string_view::npos)
+            {
+                operand.kind = OperandFar;
+                return ParseExpr(Trim(text.substr(0, colon)), operand.segment) &&
+                       ParseExpr(Trim(text.substr(colon + 1)), operand.expr);
+            }
+
+            operand.kind = OperandImmediate;
+            if (!ParseExpr(text, operand.expr))
+                return false;
+            operand.constant = IsConstant(operand.expr);
+            if (operand.constant)
+            {
+                std::string message;
+                if (!EvaluateExpr(operand.expr, nullptr, nullptr, 0, 0, operand.value, message))
+                    return Fail(message);
+            }
+            return true;
+        }
+
+        void PutByte(uint8_t value)
+        {
+            bytes.push_back(value);
+        }
+
+        void PutImmediate(const Operand &operand, uint8_t size)
+        {
+            if (operand.constant)
+            {
+                for (uint8_t i = 0; i < size; ++i)
+                    bytes.push_back(static_cast<uint8_t>(operand.value >> (8 * i)));
+                return;
+            }
+
+            fixups.push_back(AsmFixup{static_cast<uint32_t>(bytes.size()), size, operand.expr});
+            bytes.insert(bytes.end(), size, 0);
+        }
+
+        void FlushBytes(AsmItemKind kind, AsmExpr count = AsmExpr())
+        {
+            AsmItem item = NewItem(kind);
+            item.byteOffset = static_cast<uint32_t>(fragment.bytes.size());
+            item.byteCount = static_cast<uint32_t>(bytes.size());
+            item.fixups = std::move(fixups);
+            item.expr = std::move(count);
+            fragment.bytes.insert(fragment.bytes.end(), bytes.begin(), bytes.end());
+            fragment.items.push_back(std::move(item));
+            bytes.clear();
+            fixups.clear();
+        }
+
+        bool AssembleTimes(std::string_view operands)
+        {
+            AsmExpr count;
+            ExprParser parser(operands, scope);
+            std::string message;
+            if (!parser.Parse(count, message))
+                return Fail(message);
+
+            std::string_view rest = Trim(operands.substr(parser.Position()));
+            size_t mnemonicEnd = 0;
+            while (mnemonicEnd < rest.size() && !std::isspace(static_cast<unsigned char>(rest[mnemonicEnd])))
+                ++mnemonicEnd;
+            if (mnemonicEnd == 0)
+                return Fail("times needs a statement to repeat");
+
+            if (!AssembleStatement(Lowercase(rest.substr(0, mnemonicEnd)), Trim(rest.substr(mnemonicEnd)), false))
+                return false;
+            FlushBytes(AsmItemTimes, std::move(count));
+            return true;
+        }
+
+        bool AssembleData(std::string_view operands, uint8_t size)
+        {
+            for (std::string_view text : SplitOperands(operands))
+            {
+                if (text.size() >= 2 && (text.front() == '\'' || text.front() == '"' || text.front() == '`') && text.back() == text.front())
+                {
+                    std::string_view chars = text.substr(1, text.size() - 2);
+                    bytes.insert(bytes.end(), chars.begin(), chars.end());
+                    while (chars.size() % size != 0)
+                    {
+                        bytes.push_back(0);
+                        chars = std::string_view(chars.data(), chars.size() + 1);
+                    }
+                    continue;
+                }
+
+                Operand operand;
+                operand.kind = OperandImmediate;
+                if (!ParseExpr(text, operand.expr))
+                    return false;
+                operand.constant = IsConstant(operand.expr);
+                std::string message;
+                if (operand.constant && !EvaluateExpr(operand.expr, nullptr, nullptr, 0, 0, operand.value, message))
+                    return Fail(message);
+                PutImmediate(operand, size);
+            }
+            return true;
+        }
+
+        bool AssembleJump(std::string_view operands, int shortOpcode, const uint8_t *nearOpcode, uint8_t nearLength)
+        {
+            std::vector<std::string_view> list = SplitOperands(operands);
+            if (list.size() != 1)
+                return Fail("jump takes one operand");
+
+            Operand target;
+            if (!ParseOperand(list[0], target))
+                return false;
+
+            if (target.kind == OperandFar)
+            {
+                if (shortOpcode != 0xEB)
+                    return Fail("far form is only supported for jmp");
+                Operand segment;
+                segment.expr = target.segment;
+                segment.constant = IsConstant(segment.expr);
+                std::string message;
+                if (segment.constant && !EvaluateExpr(segment.expr, nullptr, nullptr, 0, 0, segment.value, message))
+                    return Fail(message);
+                target.constant = IsConstant(target.expr);
+                if (target.constant && !EvaluateExpr(target.expr, nullptr, nullptr, 0, 0, target.value, message))
+                    return Fail(message);
+
+                PutByte(0xEA);
+                PutImmediate(target, 2);
+                PutImmediate(segment, 2);
+                FlushBytes(AsmItemBytes);
+                return true;
+            }
+
+            if (target.kind != OperandImmediate)
+                return Fail("register jump targets are not supported");
+            if (target.form == AsmJumpShort && shortOpcode < 0)
+                return Fail("no short form for this instruction");
+            if (target.form == AsmJumpNear && nearLength == 0)
+                return Fail("no near form for this instruction");
+
+            AsmItem item = NewItem(AsmItemJump);
+            item.expr = std::move(target.expr);
+            item.shortOpcode = shortOpcode;
+            std::copy(nearOpcode, nearOpcode + nearLength, item.nearOpcode);
+            item.nearLength = nearLength;
+            item.form = shortOpcode < 0 ? AsmJumpNear : nearLength == 0 ? AsmJumpShort : target.form;
+            fragment.items.push_back(std::move(item));
+            return true;
+        }
+
+        bool AssembleStatement(const std::string &mnemonic, std::string_view operandText, bool allowItems)
+        {
+            if (mnemonic == "org" || mnemonic == "bits")
+            {
+                if (!allowItems)
+                    return Fail(mnemonic + " cannot be repeated");
+
+                AsmExpr expr;
+                if (!ParseExpr(operandText, expr))
+                    return false;
+                if (!IsConstant(expr))
+                    return Fail(mnemonic + " needs a constant");
+
+                if (mnemonic == "bits")
+                {
+                    int64_t bits;
+                    std::string message;
+                    EvaluateExpr(expr, nullptr, nullptr, 0, 0, bits, message);
+                    return bits == 16 ? true : Fail("only bits 16 is supported");
+                }
+
+                AsmItem item = NewItem(AsmItemOrg);
+                item.expr = std::move(expr);
+                fragment.items.push_back(std::move(item));
+                return true;
+            }
+
+            if (mnemonic == "db" || mnemonic == "dw" || mnemonic == "dd")
+            {
+                if (!AssembleData(operandText, mnemonic == "db" ? 1 : mnemonic == "dw" ? 2 : 4))
+                    return false;
+                if (allowItems)
+                    FlushBytes(AsmItemBytes);
+                return true;
+            }
+
+            const SimpleOpcode *opcode = nullptr;
+            if (mnemonic == "jmp" || mnemonic == "call" || (opcode = FindOpcode(kConditionCodes, mnemonic)) != nullptr ||
+                (opcode = FindOpcode(kShortOnlyJumps, mnemonic)) != nullptr)
+            {
+                if (!allowItems)
+                    return Fail("jumps cannot be repeated with times");
+
+                if (mnemonic == "jmp")
+                {
+                    const uint8_t nearOpcode[] = {0xE9};
+                    return AssembleJump(operandText, 0xEB, nearOpcode, 1);
+                }
+                if (mnemonic == "call")
+                {
+                    const uint8_t nearOpcode[] = {0xE8};
+                    return AssembleJump(operandText, -1, nearOpcode, 1);
+                }
+                if (FindOpcode(kShortOnlyJumps, mnemonic) != nullptr)
+                    return AssembleJump(operandText, opcode->opcode, nullptr, 0);
+
+                const uint8_t nearOpcode[] = {0x0F, static_cast<uint8_t>(0x80 + opcode->opcode)};
+                return AssembleJump(operandText, 0x70 + opcode->opcode, nearOpcode, 2);
+            }
+
+            if (!AssembleInstruction(mnemonic, operandText))
+                return false;
+            if (allowItems)
+                FlushBytes(AsmItemBytes);
+            return true;
+        }
+
+        static uint8_t ModRm(int reg, int rm)
+        {
+            return static_cast<uint8_t>(0xC0 | (reg << 3) | rm);
+        }
+
+        static bool FitsSignedByte(const Operand &operand)
+        {
+            return operand.constant && operand.value >= -128 && operand.value <= 127;
+        }
+
+        bool IsRegister(const Operand &operand)
+        {
+            return operand.kind == OperandRegister8 || operand.kind == OperandRegister16;
+        }
+
+        bool AssembleInstruction(const std::string &mnemonic, std::string_view operandText)
+        {
+            std::vector<std::string_view> list = SplitOperands(operandText);
+            std::vector<Operand> operands(list.size());
+            for (size_t i = 0; i < list.size(); ++i)
+            {
+                if (!ParseOperand(list[i], operands[i]))
+                    return false;
+            }
+
+            const SimpleOpcode *opcode;
+            if ((opcode = FindOpcode(kSimpleOpcodes, mnemonic)) != nullptr)
+            {
+                if (!operands.empty())
+                    return Fail(mnemonic + " takes no operands");
+                PutByte(opcode->opcode);
+                return true;
+            }
+
+            if (mnemonic == "int")
+            {
+                if (operands.size() != 1 || operands[0].kind != OperandImmediate)
+                    return Fail("int needs an immediate");
+                PutByte(0xCD);
+                PutImmediate(operands[0], 1);
+                return true;
+            }
+
+            if (mnemonic == "mov")
+            {
+                if (operands.size() != 2)
+                    return Fail("mov takes two operands");
+                const Operand &dst = operands[0];
+                const Operand &src = operands[1];
+
+                if (IsRegister(dst) && src.kind == OperandImmediate)
+                {
+                    bool wide = dst.kind == OperandRegister16;
+                    PutByte(static_cast<uint8_t>((wide ? 0xB8 : 0xB0) + dst.reg));
+                    PutImmediate(src, wide ? 2 : 1);
+                    return true;
+                }
+                if (IsRegister(dst) && dst.kind == src.kind)
+                {
+                    PutByte(dst.kind == OperandRegister16 ? 0x89 : 0x88);
+                    PutByte(ModRm(src.reg, dst.reg));
+                    return true;
+                }
+                if (dst.kind == OperandSegment && src.kind == OperandRegister16)
+                {
+                    if (dst.reg == 1)
+                        return Fail("cannot move into cs");
+                    PutByte(0x8E);
+                    PutByte(ModRm(dst.reg, src.reg));
+                    return true;
+                }
+                if (dst.kind == OperandRegister16 && src.kind == OperandSegment)
+                {
+                    PutByte(0x8C);
+                    PutByte(ModRm(src.reg, dst.reg));
+                    return true;
+                }
+                return Fail("unsupported operands for mov");
+            }
+
+            if ((opcode = FindOpcode(kAluOpcodes, mnemonic)) != nullptr || mnemonic == "test")
+            {
+                if (operands.size() != 2 || !IsRegister(operands[0]))
+                    return Fail("unsupported operands for " + mnemonic);
+                const Operand &dst = operands[0];
+                const Operand &src = operands[1];
+                bool wide = dst.kind == OperandRegister16;
+
+                if (src.kind == dst.kind)
+                {
+                    PutByte(static_cast<uint8_t>((opcode != nullptr ? opcode->opcode * 8 : 0x84) + (wide ? 1 : 0)));
+                    PutByte(ModRm(src.reg, dst.reg));
+                    return true;
+                }
+                if (src.kind != OperandImmediate)
+                    return Fail("operand size mismatch");
+
+                if (opcode == nullptr)
+                {
+                    if (dst.reg == 0)
+                        PutByte(wide ? 0xA9 : 0xA8);
+                    else
+                    {
+                        PutByte(wide ? 0xF7 : 0xF6);
+                        PutByte(ModRm(0, dst.reg));
+                    }
+                    PutImmediate(src, wide ? 2 : 1);
+                    return true;
+                }
+
+                if (!wide)
+                {
+                    if (dst.reg == 0)
+                        PutByte(static_cast<uint8_t>(opcode->opcode * 8 + 4));
+                    else
+                    {
+                        PutByte(0x80);
+                        PutByte(ModRm(opcode->opcode, dst.reg));
+                    }
+                    PutImmediate(src, 1);
+                }
+                else if (FitsSignedByte(src))
+                {
+                    PutByte(0x83);
+                    PutByte(ModRm(opcode->opcode, dst.reg));
+                    PutImmediate(src, 1);
+                }
+                else
+                {
+                    if (dst.reg == 0)
+                        PutByte(static_cast<uint8_t>(opcode->opcode * 8 + 5));
+                    else
+                    {
+                        PutByte(0x81);
+                        PutByte(ModRm(opcode->opcode, dst.reg));
+                    }
+                    PutImmediate(src, 2);
+                }
+                return true;
+            }
+
+            if (mnemonic == "inc" || mnemonic == "dec")
+            {
+                if (operands.size() != 1 || !IsRegister(operands[0]))
+                    return Fail(mnemonic + " needs a register");
+                int ext = mnemonic == "inc" ? 0 : 1;
+                if (operands[0].kind == OperandRegister16)
+                    PutByte(static_cast<uint8_t>(0x40 + ext * 8 + operands[0].reg));
+                else
+                {
+                    PutByte(0xFE);
+                    PutByte(ModRm(ext, operands[0].reg));
+                }
+                return true;
+            }
+
+            if ((opcode = FindOpcode(kUnaryOpcodes, mnemonic)) != nullptr)
+            {
+                if (operands.size() != 1 || !IsRegister(operands[0]))
+                    return Fail(mnemonic + " needs a register");
+                PutByte(operands[0].kind == OperandRegister16 ? 0xF7 : 0xF6);
+                PutByte(ModRm(opcode->opcode, operands[0].reg));
+                return true;
+            }
+
+            if ((opcode = FindOpcode(kShiftOpcodes, mnemonic)) != nullptr)
+            {
+                if (operands.size() != 2 || !IsRegister(operands[0]))
+                    return Fail("unsupported operands for " + mnemonic);
+                bool wide = operands[0].kind == OperandRegister16;
+                const Operand &count = operands[1];
+
+                if (count.kind == OperandRegister8 && count.reg == 1)
+                {
+                    PutByte(wide ? 0xD3 : 0xD2);
+                    PutByte(ModRm(opcode->opcode, operands[0].reg));
+                }
+                else if (count.kind == OperandImmediate && count.constant && count.value == 1)
+                {
+                    PutByte(wide ? 0xD1 : 0xD0);
+                    PutByte(ModRm(opcode->opcode, operands[0].reg));
+                }
+                else if (count.kind == OperandImmediate)
+                {
+                    PutByte(wide ? 0xC1 : 0xC0);
+                    PutByte(ModRm(opcode->opcode, operands[0].reg));
+                    PutImmediate(count, 1);
+                }
+                else
+                {
+                    return Fail("shift count must be cl or an immediate");
+                }
+                return true;
+            }
+
+            if (mnemonic == "push" || mnemonic == "pop")
+            {
+                bool push = mnemonic == "push";
+                if (operands.size() != 1)
+                    return Fail(mnemonic + " takes one operand");
+                const Operand &operand = operands[0];
+
+                if (operand.kind == OperandRegister16)
+                    PutByte(static_cast<uint8_t>((push ? 0x50 : 0x58) + operand.reg));
+                else if (operand.kind == OperandSegment)
+                {
+                    if (!push && operand.reg == 1)
+                        return Fail("cannot pop cs");
+                    PutByte(static_cast<uint8_t>(operand.reg * 8 + (push ? 0x06 : 0x07)));
+                }
+                else if (push && operand.kind == OperandImmediate)
+                {
+                    bool small = FitsSignedByte(operand);
+                    PutByte(small ? 0x6A : 0x68);
+                    PutImmediate(operand, small ? 1 : 2);
+                }
+                else
+                    return Fail("unsupported operand for " + mnemonic);
+                return true;
+            }
+
+            if (mnemonic == "in" || mnemonic == "out")
+            {
+                if (operands.size() != 2)
+                    return Fail(mnemonic + " takes two operands");
+                bool in = mnemonic == "in";
+                const Operand &data = in ? operands[0] : operands[1];
+                const Operand &port = in ? operands[1] : operands[0];
+                if (!IsRegister(data) || data.reg != 0)
+                    return Fail(mnemonic + " needs al or ax");
+                bool wide = data.kind == OperandRegister16;
+
+                if (port.kind == OperandRegister16 && port.reg == 2)
+                    PutByte(static_cast<uint8_t>((in ? 0xEC : 0xEE) + (wide ? 1 : 0)));
+                else if (port.kind == OperandImmediate)
+                {
+                    PutByte(static_cast<uint8_t>((in ? 0xE4 : 0xE6) + (wide ? 1 : 0)));
+                    PutImmediate(port, 1);
+                }
+                else
+                    return Fail("port must be dx or an immediate");
+                return true;
+            }
+
+            return Fail("unknown instruction '" + mnemonic + "'");
+        }
+    };
+
+    struct LinkState
+    {
+        const std::vector<const AsmFragment *> &fragments;
+        AsmError &error;
+        int64_t origin = 0;
+        SymbolTable symbols;
+        SymbolTable previous;
+        std::vector<std::vector<int64_t>> addresses;
+        std::vector<std::vector<int64_t>> counts;
+        std::vector<std::vector<char>> nearJumps;
+
+        LinkState(const std::vector<const AsmFragment *> &fragments, AsmError &error) : fragments(fragments), error(error) {}
+
+        bool Fail(size_t fragment, const AsmItem &item, const std::string &message)
+        {
+            error.fragment = static_cast<int>(fragment);
+            error.line = item.line;
+            error.message = message;
+            return false;
+        }
+    };
+
+    int64_t JumpSize(const AsmItem &item, bool near)
+    {
+        return near ? item.nearLength + 2 : 2;
+    }
+
+    // Assigns addresses with the current jump sizes and rebuilds the symbol
+    // table. Times counts that depend on labels not yet placed use the
+    // previous pass.
+    bool LayoutPass(LinkState &state)
+    {
+        state.symbols.clear();
+        int64_t address = state.origin;
+
+        for (size_t f = 0; f < state.fragments.size(); ++f)
+        {
+            const AsmFragment &fragment = *state.fragments[f];
+            for (size_t i = 0; i < fragment.items.size(); ++i)
+            {
+                const AsmItem &item = fragment.items[i];
+                state.addresses[f][i] = address;
+
+                switch (item.kind)
+                {
+                case AsmItemLabel:
+                    if (!state.symbols.emplace(item.label, address).second)
+                        return state.Fail(f, item, "label '" + item.label + "' redefined");
+                    break;
+                case AsmItemBytes:
+                    address += item.byteCount;
+                    break;
+                case AsmItemJump:
+                    address += JumpSize(item, state.nearJumps[f][i]);
+                    break;
+                case AsmItemTimes:
+                {
+                    int64_t count = 0;
+                    std::string message;
+                    if (!EvaluateExpr(item.expr, &state.symbols, &state.previous, address, state.origin, count, message))
+                        count = 0;
+                    state.counts[f][i] = count;
+                    address += std::max<int64_t>(count, 0) * item.byteCount;
+                    break;
+                }
+                case AsmItemOrg:
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool PatchFixups(LinkState &state, size_t f, const AsmItem &item, int64_t address, uint8_t *out)
+    {
+        for (const AsmFixup &fixup : item.fixups)
+        {
+            int64_t value;
+            std::string message;
+            if (!EvaluateExpr(fixup.expr, &state.symbols, nullptr, address, state.origin, value, message))
+                return state.Fail(f, item, message);
+            for (uint8_t b = 0; b < fixup.size; ++b)
+                out[fixup.offset + b] = static_cast<uint8_t>(value >> (8 * b));
+        }
+        return true;
+    }
+}
+
+bool AssembleFragment(std::string_view source, std::string &scope, AsmFragment &fragment, AsmError &error)
+{
+    fragment = AsmFragment();
+    error = AsmError();
+
+    FragmentBuilder builder(fragment, scope, error);
+    int lineNumber = 1;
+    while (!source.empty())
+    {
+        size_t end = source.find('\n');
+        std::string_view line = source.substr(0, end);
+        if (!builder.AssembleLine(line, lineNumber))
+            return false;
+        if (end == std::string_view::npos)
+            break;
+        source.remove_prefix(end + 1);
+        ++lineNumber;
+    }
+    return true;
+}
+
+size_t FragmentMinimumSize(const AsmFragment &fragment)
+{
+    size_t size = 0;
+    for (const AsmItem &item : fragment.items)
+    {
+        if (item.kind == AsmItemBytes)
+            size += item.byteCount;
+        else if (item.kind == AsmItemJump)
+            size += JumpSize(item, item.form == AsmJumpNear);
+    }
+    return size;
+}
+
+bool LinkFragments(const std::vector<const AsmFragment *> &fragments, std::vector<uint8_t> &image, AsmError &error)
+{
+    error = AsmError();
+    LinkState state(fragments, error);
+
+    bool originSet = false;
+    for (size_t f = 0; f < fragments.size(); ++f)
+    {
+        const AsmFragment &fragment = *fragments[f];
+        state.addresses.emplace_back(fragment.items.size());
+        state.counts.emplace_back(fragment.items.size());
+        state.nearJumps.emplace_back(fragment.items.size());
+
+        for (size_t i = 0; i < fragment.items.size(); ++i)
+        {
+            const AsmItem &item = fragment.items[i];
+            if (item.kind == AsmItemJump)
+                state.nearJumps[f][i] = item.form == AsmJumpNear;
+            if (item.kind != AsmItemOrg)
+                continue;
+
+            int64_t origin;
+            std::string message;
+            if (!EvaluateExpr(item.expr, nullptr, nullptr, 0, 0, origin, message))
+                return state.Fail(f, item, message);
+            if (originSet && origin != state.origin)
+                return state.Fail(f, item, "program origin redefined");
+            state.origin = origin;
+            originSet = true;
+        }
+    }
+
+    // Jumps start short and only ever grow, so this converges.
+    for (int pass = 0;; ++pass)
+    {
+        if (pass == kMaxLinkPasses)
+            return state.Fail(0, AsmItem(), "layout did not converge");
+        if (!LayoutPass(state))
+            return false;
+
+        bool changed = false;
+        for (size_t f = 0; f < fragments.size(); ++f)
+        {
+            const AsmFragment &fragment = *fragments[f];
+            for (size_t i = 0; i < fragment.items.size(); ++i)
+            {
+                const AsmItem &item = fragment.items[i];
+                if (item.kind != AsmItemJump || item.form != AsmJumpAuto || state.nearJumps[f][i])
+                    continue;
+
+                int64_t target;
+                std::string message;
+                if (!EvaluateExpr(item.expr, &state.symbols, nullptr, state.addresses[f][i], state.origin, target, message))
+                    return state.Fail(f, item, message);
+                int64_t displacement = target - (state.addresses[f][i] + 2);
+                if (displacement < -128 || displacement > 127)
+                {
+                    state.nearJumps[f][i] = true;
+                    changed = true;
+                }
+            }
+        }
+
+        if (!changed && state.symbols == state.previous)
+            break;
+        state.previous = state.symbols;
+    }
+
+    image.clear();
+    for (size_t f = 0; f < fragments.size(); ++f)
+    {
+        const AsmFragment &fragment = *fragments[f];
+        for (size_t i = 0; i < fragment.items.size(); ++i)
+        {
+            const AsmItem &item = fragment.items[i];
+            int64_t address = state.addresses[f][i];
+            const uint8_t *body = fragment.bytes.data() + item.byteOffset;
+
+            switch (item.kind)
+            {
+            case AsmItemBytes:
+            {
+                size_t start = image.size();
+                image.insert(image.end(), body, body + item.byteCount);
+                if (!PatchFixups(state, f, item, address, image.data() + start))
+                    return false;
+                break;
+            }
+            case AsmItemTimes:
+            {
+                int64_t count = state.counts[f][i];
+                if (count < 0)
+                    return state.Fail(f, item, "TIMES value " + std::to_string(count) + " is negative");
+                for (int64_t n = 0; n < count; ++n)
+                {
+                    size_t start = image.size();
+                    image.insert(image.end(), body, body + item.byteCount);
+                    if (!PatchFixups(state, f, item, address + n * item.byteCount, image.data() + start))
+                        return false;
+                }
+                break;
+            }
+            case AsmItemJump:
+            {
+                int64_t target;
+                std::string message;
+                if (!EvaluateExpr(item.expr, &state.symbols, nullptr, address, state.origin, target, message))
+                    return state.Fail(f, item, message);
+
+                bool near = state.nearJumps[f][i];
+                int64_t displacement = target - (address + JumpSize(item, near));
+                if (near)
+                {
+                    image.insert(image.end(), item.nearOpcode, item.nearOpcode + item.nearLength);
+                    image.push_back(static_cast<uint8_t>(displacement));
+                    image.push_back(static_cast<uint8_t>(displacement >> 8));
+                }
+                else
+                {
+                    if (displacement < -128 || displacement > 127)
+                        return state.Fail(f, item, "short jump is out of range");
+                    image.push_back(static_cast<uint8_t>(item.shortOpcode));
+                    image.push_back(static_cast<uint8_t>(displacement));
+                }
+                break;
+            }
+            case AsmItemLabel:
+            case AsmItemOrg:
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Assemble(std::string_view source, std::vector<uint8_t> &image, AsmError &error)
+{
+    AsmFragment fragment;
+    std::string scope;
+    if (!AssembleFragment(source, scope, fragment, error))
+        return false;
+
+    std::vector<const AsmFragment *> fragments = {&fragment};
+    return LinkFragments(fragments, image, error);
+}
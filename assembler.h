@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In-process assembler for the 16-bit real-mode subset TKit generates:
+// org, bits 16, times, db/dw/dd, labels, register/immediate forms of mov,
+// the ALU ops, push/pop, inc/dec, int, and short/near jumps and calls.
+// Output matches nasm -f bin for that subset, so NASM is only needed as a
+// cross-check.
+//
+// Source is assembled into fragments which are position independent; the
+// link step lays fragments out, sizes jumps and resolves labels and '$'.
+
+struct AsmError
+{
+    int fragment = 0;
+    int line = 0;
+    std::string message;
+};
+
+enum AsmExprOp : uint8_t
+{
+    AsmExprNumber,
+    AsmExprSymbol,
+    AsmExprHere,
+    AsmExprSectionStart,
+    AsmExprAdd,
+    AsmExprSub,
+    AsmExprMul,
+    AsmExprDiv,
+    AsmExprMod,
+    AsmExprAnd,
+    AsmExprOr,
+    AsmExprXor,
+    AsmExprShl,
+    AsmExprShr,
+    AsmExprNeg,
+    AsmExprNot
+};
+
+struct AsmExprToken
+{
+    AsmExprOp op;
+    int64_t value;
+    std::string symbol;
+};
+
+// Expression in postfix order, evaluated at link time once addresses are
+// known.
+struct AsmExpr
+{
+    std::vector<AsmExprToken> tokens;
+};
+
+// Little-endian value patched into the item's bytes at link time.
+struct AsmFixup
+{
+    uint32_t offset;
+    uint8_t size;
+    AsmExpr expr;
+};
+
+enum AsmItemKind : uint8_t
+{
+    AsmItemBytes,
+    AsmItemLabel,
+    AsmItemOrg,
+    AsmItemJump,
+    AsmItemTimes
+};
+
+enum AsmJumpForm : uint8_t
+{
+    AsmJumpAuto,
+    AsmJumpShort,
+    AsmJumpNear
+};
+
+struct AsmItem
+{
+    AsmItemKind kind = AsmItemBytes;
+    int line = 0;
+
+    // Bytes and Times: the encoded statement in AsmFragment::bytes, with
+    // fixups relative to its start.
+    uint32_t byteOffset = 0;
+    uint32_t byteCount = 0;
+    std::vector<AsmFixup> fixups;
+
+    // Label: the fully scoped name.
+    std::string label;
+
+    // Org: the origin. Jump: the target address. Times: the repeat count.
+    AsmExpr expr;
+
+    // Jump encodings. A jump without a short form has shortOpcode < 0, one
+    // without a near form has nearLength == 0.
+    int shortOpcode = -1;
+    uint8_t nearOpcode[2] = {};
+    uint8_t nearLength = 0;
+    AsmJumpForm form = AsmJumpAuto;
+};
+
+struct AsmFragment
+{
+    std::vector<uint8_t> bytes;
+    std::vector<AsmItem> items;
+};
+
+// Assembles source into fragment. scope is the last non-local label seen,
+// used to qualify '.local' labels; it is read and updated so consecutive
+// fragments share label scope like lines of one file would.
+bool AssembleFragment(std::string_view source, std::string &scope, AsmFragment &fragment, AsmError &error);
+
+// The fewest bytes the fragment can link to: jumps that may be short taken
+// as short and TIMES repeating nothing.
+size_t FragmentMinimumSize(const AsmFragment &fragment);
+
+// Lays out fragments in order and writes the final image.
+bool LinkFragments(const std::vector<const AsmFragment *> &fragments, std::vector<uint8_t> &image, AsmError &error);
+
+bool Assemble(std::string_view source, std::vector<uint8_t> &image, AsmError &error);
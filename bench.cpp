@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "graph.h"
+
+// Synthetic-graph benchmarks for the graph module, run by `make bench`:
+//
+//   tkit_bench [-n 1000,100000] [-s chain,fanout,cycle,dangling] [-b validate,...]
+//
+// Each benchmark/shape/size case runs in its own child process so peak RSS
+// is per case, and prints one JSON object per line:
+//
+//   {"bench":"validate","shape":"chain","nodes":1000,"ops":...,"ns_per_op":...,"peak_rss_kb":...}
+//
+// Cases repeat until kMinBenchSeconds of measured time has passed. ops is
+// nodes for validate/emit/assemble/write_asm, nodes plus links for build,
+// and single mutations for insert_delete and link_churn; churn_revalidate
+// counts one link churn plus the revalidation after it.
+
+namespace
+{
+    constexpr double kMinBenchSeconds = 0.2;
+    constexpr unsigned kBenchSeed = 12345;
+
+    enum GraphShape : uint8_t
+    {
+        ShapeChain,
+        ShapeFanOut,
+        ShapeCycle,
+        ShapeDangling,
+        ShapeCount
+    };
+
+    const char *const kShapeNames[ShapeCount] = {"chain", "fanout", "cycle", "dangling"};
+
+    // Measured time and operation count of one run of a benchmark.
+    struct BenchRun
+    {
+        double ns = 0.0;
+        uint64_t ops = 0;
+    };
+
+    typedef BenchRun (*BenchFunction)(GraphShape shape, int nodeCount);
+
+    double ElapsedNs(JobClock::time_point start)
+    {
+        return std::chrono::duration<double, std::nano>(JobClock::now() - start).count();
+    }
+
+    int AddInstruction(const char *text)
+    {
+        int id = CreateNode(NodeInstruction);
+        SetNodeText(id, text);
+        return id;
+    }
+
+    void Link(int from, int to)
+    {
+        AddLink(OutputPin(from), InputPin(to));
+    }
+
+    // Builds nodeCount nodes in the given shape:
+    //   chain     kernel_start -> instructions -> kernel_end
+    //   fanout    kernel_start -> one hub linked to every other instruction
+    //   cycle     a chain whose last instruction links back to the first
+    //   dangling  a short chain and nine unlinked nodes for every linked one
+    void BuildGraph(GraphShape shape, int nodeCount)
+    {
+        ClearGraph();
+        int start = CreateNode(NodeKernelStart);
+        int count = std::max(nodeCount - 2, 1);
+
+        switch (shape)
+        {
+        case ShapeChain:
+        case ShapeCycle:
+        {
+            int first = AddInstruction("inc ax");
+            int previous = first;
+            Link(start, first);
+            for (int i = 1; i < count; ++i)
+            {
+                int id = AddInstruction("inc ax");
+                Link(previous, id);
+                previous = id;
+            }
+            if (shape == ShapeCycle)
+                Link(previous, first);
+            else
+                Link(previous, CreateNode(NodeKernelEnd));
+            break;
+        }
+        case ShapeFanOut:
+        {
+            int hub = AddInstruction("nop");
+            Link(start, hub);
+            for (int i = 1; i < count; ++i)
+                Link(hub, AddInstruction("inc ax"));
+            Link(hub, CreateNode(NodeKernelEnd));
+            break;
+        }
+        case ShapeDangling:
+        {
+            int linked = std::max(count / 10, 1);
+            int previous = start;
+            for (int i = 0; i < linked; ++i)
+            {
+                int id = AddInstruction("inc ax");
+                Link(previous, id);
+                previous = id;
+            }
+            Link(previous, CreateNode(NodeKernelEnd));
+            for (int i = linked; i < count; ++i)
+                AddInstruction("inc ax");
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    BenchRun BenchBuild(GraphShape shape, int nodeCount)
+    {
+        JobClock::time_point start = JobClock::now();
+        BuildGraph(shape, nodeCount);
+        return BenchRun{ElapsedNs(start), nodes.size() + links.size()};
+    }
+
+    BenchRun BenchValidate(GraphShape, int)
+    {
+        InvalidateKernel();
+
+        JobClock::time_point start = JobClock::now();
+        CompileKernel();
+        return BenchRun{ElapsedNs(start), nodes.size()};
+    }
+
+    BenchRun BenchEmit(GraphShape, int)
+    {
+        InvalidateKernel();
+        CompileKernel();
+
+        JobClock::time_point start = JobClock::now();
+        StepAssemblerEmit(JobClock::time_point::max());
+        return BenchRun{ElapsedNs(start), kernelValidation.program.order.size()};
+    }
+
+    // Cold per-node assembly plus link. Kernels that reach kernel_end stop
+    // once their code passes the boot sector, so ops counts the nodes
+    // actually encoded.
+    BenchRun BenchAssemble(GraphShape, int)
+    {
+        const KernelProgram &program = CompileKernel();
+        kernelBuild = KernelBuild();
+        kernelBuild.nodeCode.resize(nodeIds.generations.size());
+
+        int errorNode;
+        AsmError error;
+        JobClock::time_point start = JobClock::now();
+        bool built = AssembleKernelImage(program, errorNode, error);
+        double ns = ElapsedNs(start);
+        return BenchRun{ns, built ? program.order.size() : kernelBuild.stepPosition + 1};
+    }
+
+    BenchRun BenchWriteAsm(GraphShape, int)
+    {
+        CompileKernel();
+        StepAssemblerEmit(JobClock::time_point::max());
+
+        std::string path = "/tmp/tkit_bench_" + std::to_string(getpid()) + ".asm";
+        JobClock::time_point start = JobClock::now();
+        WriteFileBytes(path, assemblerEmit.text.data(), assemblerEmit.text.size());
+        BenchRun run = {ElapsedNs(start), kernelValidation.program.order.size()};
+        unlink(path.c_str());
+        return run;
+    }
+
+    // Inserts nodeCount nodes into the shape and deletes them again in
+    // random order.
+    BenchRun BenchInsertDelete(GraphShape, int nodeCount)
+    {
+        std::mt19937 rng(kBenchSeed);
+        std::vector<int> created(nodeCount);
+
+        JobClock::time_point start = JobClock::now();
+        for (int &id : created)
+            id = CreateNode(NodeInstruction);
+        std::shuffle(created.begin(), created.end(), rng);
+        for (int id : created)
+            DeleteNode(id);
+        return BenchRun{ElapsedNs(start), 2 * created.size()};
+    }
+
+    // Removes a random link and adds it back, nodeCount times.
+    BenchRun BenchLinkChurn(GraphShape, int nodeCount)
+    {
+        std::mt19937 rng(kBenchSeed);
+        uint64_t ops = 0;
+
+        JobClock::time_point start = JobClock::now();
+        for (int i = 0; i < nodeCount && !links.empty(); ++i)
+        {
+            size_t slot = rng() % links.size();
+            PinId startPin = links.starts[slot];
+            PinId endPin = links.ends[slot];
+            RemoveLink(links.ids[slot]);
+            AddLink(startPin, endPin);
+            ops += 2;
+        }
+        return BenchRun{ElapsedNs(start), ops};
+    }
+
+    // Link churn followed by the revalidation the editor would do next.
+    BenchRun BenchChurnRevalidate(GraphShape, int nodeCount)
+    {
+        CompileKernel();
+        std::mt19937 rng(kBenchSeed);
+        int rounds = std::min(nodeCount, 1000);
+
+        JobClock::time_point start = JobClock::now();
+        for (int i = 0; i < rounds && !links.empty(); ++i)
+        {
+            size_t slot = rng() % links.size();
+            PinId startPin = links.starts[slot];
+            PinId endPin = links.ends[slot];
+            RemoveLink(links.ids[slot]);
+            AddLink(startPin, endPin);
+            CompileKernel();
+        }
+        return BenchRun{ElapsedNs(start), static_cast<uint64_t>(rounds)};
+    }
+
+    // Re-adding a link puts it last in its pin's list with a new serial,
+    // which changes the validator's visit order, so the link churn
+    // benchmarks get a freshly built graph for every repeat.
+    struct Benchmark
+    {
+        const char *name;
+        BenchFunction run;
+        bool changesGraph;
+    };
+
+    const Benchmark kBenchmarks[] = {
+        {"build", BenchBuild, false},
+        {"validate", BenchValidate, false},
+        {"emit", BenchEmit, false},
+        {"assemble", BenchAssemble, false},
+        {"write_asm", BenchWriteAsm, false},
+        {"insert_delete", BenchInsertDelete, false},
+        {"link_churn", BenchLinkChurn, true},
+        {"churn_revalidate", BenchChurnRevalidate, true},
+    };
+
+    // The graph is built once and the benchmark repeated on it, rebuilt
+    // outside the measured time for benchmarks that change it.
+    void RunCase(const Benchmark &benchmark, GraphShape shape, int nodeCount)
+    {
+        BuildGraph(shape, nodeCount);
+
+        BenchRun total;
+        for (bool first = true; total.ns < kMinBenchSeconds * 1e9; first = false)
+        {
+            if (benchmark.changesGraph && !first)
+                BuildGraph(shape, nodeCount);
+            BenchRun run = benchmark.run(shape, nodeCount);
+            total.ns += run.ns;
+            total.ops += run.ops;
+            if (run.ops == 0)
+                break;
+        }
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("{\"bench\":\"%s\",\"shape\":\"%s\",\"nodes\":%d,\"ops\":%llu,\"ns_per_op\":%.1f,\"peak_rss_kb\":%ld}\n",
+               benchmark.name, kShapeNames[shape], nodeCount, static_cast<unsigned long long>(total.ops),
+               total.ops > 0 ? total.ns / total.ops : 0.0, usage.ru_maxrss);
+        fflush(stdout);
+    }
+
+    std::vector<std::string> SplitList(const char *text)
+    {
+        std::vector<std::string> items;
+        std::string item;
+        for (const char *c = text;; ++c)
+        {
+            if (*c == ',' || *c == '\0')
+            {
+                if (!item.empty())
+                    items.push_back(item);
+                item.clear();
+                if (*c == '\0')
+                    break;
+            }
+            else
+            {
+                item += *c;
+            }
+        }
+        return items;
+    }
+
+    bool Selected(const std::vector<std::string> &filter, const char *name)
+    {
+        return filter.empty() || std::find(filter.begin(), filter.end(), name) != filter.end();
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr, "usage: tkit_bench [-n nodes,...] [-s shape,...] [-b bench,...]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes = {1000, 100000};
+    std::vector<std::string> shapes;
+    std::vector<std::string> benches;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            PrintUsage();
+            return 2;
+        }
+
+        std::vector<std::string> values = SplitList(argv[i + 1]);
+        if (strcmp(argv[i], "-n") == 0)
+        {
+            sizes.clear();
+            for (const std::string &value : values)
+                sizes.push_back(std::max(atoi(value.c_str()), 3));
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            shapes = values;
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            benches = values;
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+        ++i;
+    }
+
+    int failed = 0;
+    for (const Benchmark &benchmark : kBenchmarks)
+    {
+        if (!Selected(benches, benchmark.name))
+            continue;
+
+        for (int shape = 0; shape < ShapeCount; ++shape)
+        {
+            if (!Selected(shapes, kShapeNames[shape]))
+                continue;
+
+            for (int nodeCount : sizes)
+            {
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    RunCase(benchmark, static_cast<GraphShape>(shape), nodeCount);
+                    _exit(0);
+                }
+
+                int status = 0;
+                if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    fprintf(stderr, "%s/%s/%d failed\n", benchmark.name, kShapeNames[shape], nodeCount);
+                    ++failed;
+                }
+            }
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,908 @@
+#include "emulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+namespace
+{
+    constexpr uint32_t kMemorySize = 1 << 20;
+    constexpr uint16_t kLoadAddress = 0x7C00;
+
+    enum Register16 : uint8_t
+    {
+        RegAX,
+        RegCX,
+        RegDX,
+        RegBX,
+        RegSP,
+        RegBP,
+        RegSI,
+        RegDI
+    };
+
+    enum SegmentRegister : uint8_t
+    {
+        SegES,
+        SegCS,
+        SegSS,
+        SegDS
+    };
+
+    enum Flag : uint16_t
+    {
+        FlagCF = 1 << 0,
+        FlagPF = 1 << 2,
+        FlagAF = 1 << 4,
+        FlagZF = 1 << 6,
+        FlagSF = 1 << 7,
+        FlagIF = 1 << 9,
+        FlagDF = 1 << 10,
+        FlagOF = 1 << 11
+    };
+
+    constexpr uint16_t kFlagsAlwaysSet = 1 << 1;
+
+    class Cpu
+    {
+    public:
+        Cpu(const std::vector<uint8_t> &image, EmulatorResult &result) : memory(kMemorySize), result(result)
+        {
+            size_t size = std::min<size_t>(image.size(), kMemorySize - kLoadAddress);
+            std::copy(image.begin(), image.begin() + size, memory.begin() + kLoadAddress);
+
+            regs[RegSP] = kLoadAddress;
+            regs[RegDX] = 0x0000;
+            ip = kLoadAddress;
+
+            screen.assign(kTeletypeRows, std::string(kTeletypeColumns, ' '));
+        }
+
+        void Run(uint64_t maxSteps)
+        {
+            result.stop = EmulatorStepLimit;
+            result.message = "step limit reached";
+
+            for (result.steps = 0; result.steps < maxSteps && running; ++result.steps)
+            {
+                start = ip;
+                Step();
+            }
+
+            result.screen.clear();
+            for (std::string &row : screen)
+            {
+                row.erase(row.find_last_not_of(' ') + 1);
+                result.screen.push_back(row);
+            }
+            while (!result.screen.empty() && result.screen.back().empty())
+                result.screen.pop_back();
+        }
+
+    private:
+        std::vector<uint8_t> memory;
+        EmulatorResult &result;
+        uint16_t regs[8] = {};
+        uint16_t sregs[4] = {};
+        uint16_t ip = 0;
+        uint16_t start = 0;
+        uint16_t flags = kFlagsAlwaysSet;
+        bool running = true;
+
+        std::vector<std::string> screen;
+        int cursorRow = 0;
+        int cursorColumn = 0;
+
+        void Stop(EmulatorStop stop, const std::string &message)
+        {
+            char where[32];
+            snprintf(where, sizeof(where), " at %04X:%04X", sregs[SegCS], start);
+            result.stop = stop;
+            result.message = message + where;
+            running = false;
+        }
+
+        uint32_t Linear(uint16_t segment, uint16_t offset)
+        {
+            return ((static_cast<uint32_t>(segment) << 4) + offset) & (kMemorySize - 1);
+        }
+
+        uint8_t Read8(uint16_t segment, uint16_t offset)
+        {
+            return memory[Linear(segment, offset)];
+        }
+
+        uint16_t Read16(uint16_t segment, uint16_t offset)
+        {
+            return Read8(segment, offset) | (Read8(segment, offset + 1) << 8);
+        }
+
+        void Write8(uint16_t segment, uint16_t offset, uint8_t value)
+        {
+            memory[Linear(segment, offset)] = value;
+        }
+
+        void Write16(uint16_t segment, uint16_t offset, uint16_t value)
+        {
+            Write8(segment, offset, static_cast<uint8_t>(value));
+            Write8(segment, offset + 1, static_cast<uint8_t>(value >> 8));
+        }
+
+        uint8_t Fetch8()
+        {
+            return Read8(sregs[SegCS], ip++);
+        }
+
+        uint16_t Fetch16()
+        {
+            uint16_t value = Read16(sregs[SegCS], ip);
+            ip += 2;
+            return value;
+        }
+
+        void Push(uint16_t value)
+        {
+            regs[RegSP] -= 2;
+            Write16(sregs[SegSS], regs[RegSP], value);
+        }
+
+        uint16_t Pop()
+        {
+            uint16_t value = Read16(sregs[SegSS], regs[RegSP]);
+            regs[RegSP] += 2;
+            return value;
+        }
+
+        // 8-bit registers 0-3 are the low halves of AX-BX, 4-7 the high ones.
+        uint16_t GetRegister(int reg, bool wide)
+        {
+            if (wide)
+                return regs[reg];
+            return reg < 4 ? regs[reg] & 0xFF : regs[reg - 4] >> 8;
+        }
+
+        void SetRegister(int reg, bool wide, uint32_t value)
+        {
+            if (wide)
+                regs[reg] = static_cast<uint16_t>(value);
+            else if (reg < 4)
+                regs[reg] = static_cast<uint16_t>((regs[reg] & 0xFF00) | (value & 0xFF));
+            else
+                regs[reg - 4] = static_cast<uint16_t>((regs[reg - 4] & 0x00FF) | ((value & 0xFF) << 8));
+        }
+
+        bool GetFlag(uint16_t flag)
+        {
+            return (flags & flag) != 0;
+        }
+
+        void SetFlag(uint16_t flag, bool set)
+        {
+            flags = set ? flags | flag : flags & ~flag;
+        }
+
+        void SetResultFlags(uint32_t value, bool wide)
+        {
+            uint32_t mask = wide ? 0xFFFF : 0xFF;
+            uint8_t low = static_cast<uint8_t>(value);
+            low ^= low >> 4;
+            low ^= low >> 2;
+            low ^= low >> 1;
+
+            SetFlag(FlagZF, (value & mask) == 0);
+            SetFlag(FlagSF, (value & (wide ? 0x8000 : 0x80)) != 0);
+            SetFlag(FlagPF, (low & 1) == 0);
+        }
+
+        // The eight ALU operations in opcode order: add, or, adc, sbb, and,
+        // sub, xor, cmp. Returns the result; cmp callers discard it.
+        uint32_t Alu(int op, uint32_t a, uint32_t b, bool wide)
+        {
+            uint32_t mask = wide ? 0xFFFF : 0xFF;
+            uint32_t sign = wide ? 0x8000 : 0x80;
+            uint32_t carry = (op == 2 || op == 3) && GetFlag(FlagCF) ? 1 : 0;
+            uint32_t value;
+
+            switch (op)
+            {
+            case 0:
+            case 2:
+                value = a + b + carry;
+                SetFlag(FlagCF, value > mask);
+                SetFlag(FlagOF, ((a ^ value) & (b ^ value) & sign) != 0);
+                break;
+            case 3:
+            case 5:
+            case 7:
+                value = a - b - carry;
+                SetFlag(FlagCF, a < b + carry);
+                SetFlag(FlagOF, ((a ^ b) & (a ^ value) & sign) != 0);
+                break;
+            default:
+                value = op == 1 ? a | b : op == 4 ? a & b : a ^ b;
+                SetFlag(FlagCF, false);
+                SetFlag(FlagOF, false);
+                break;
+            }
+
+            SetResultFlags(value, wide);
+            return value & mask;
+        }
+
+        uint32_t Shift(int op, uint32_t value, unsigned count, bool wide)
+        {
+            uint32_t mask = wide ? 0xFFFF : 0xFF;
+            uint32_t sign = wide ? 0x8000 : 0x80;
+            unsigned bits = wide ? 16 : 8;
+            count &= 31;
+            if (count == 0)
+                return value;
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                bool carry = GetFlag(FlagCF);
+                switch (op)
+                {
+                case 0:
+                    carry = (value & sign) != 0;
+                    value = ((value << 1) | (carry ? 1 : 0)) & mask;
+                    break;
+                case 1:
+                    carry = (value & 1) != 0;
+                    value = (value >> 1) | (carry ? sign : 0);
+                    break;
+                case 2:
+                {
+                    bool out = (value & sign) != 0;
+                    value = ((value << 1) | (carry ? 1 : 0)) & mask;
+                    carry = out;
+                    break;
+                }
+                case 3:
+                {
+                    bool out = (value & 1) != 0;
+                    value = (value >> 1) | (carry ? sign : 0);
+                    carry = out;
+                    break;
+                }
+                case 4:
+                case 6:
+                    carry = (value & sign) != 0;
+                    value = (value << 1) & mask;
+                    break;
+                case 5:
+                    carry = (value & 1) != 0;
+                    value >>= 1;
+                    break;
+                case 7:
+                    carry = (value & 1) != 0;
+                    value = (value >> 1) | (value & sign);
+                    break;
+                }
+                SetFlag(FlagCF, carry);
+            }
+
+            if (op >= 4)
+                SetResultFlags(value, wide);
+            SetFlag(FlagOF, ((value >> (bits - 1)) & 1) != (GetFlag(FlagCF) ? 1u : 0u));
+            return value;
+        }
+
+        bool Condition(int cc)
+        {
+            bool value;
+            switch (cc >> 1)
+            {
+            case 0:
+                value = GetFlag(FlagOF);
+                break;
+            case 1:
+                value = GetFlag(FlagCF);
+                break;
+            case 2:
+                value = GetFlag(FlagZF);
+                break;
+            case 3:
+                value = GetFlag(FlagCF) || GetFlag(FlagZF);
+                break;
+            case 4:
+                value = GetFlag(FlagSF);
+                break;
+            case 5:
+                value = GetFlag(FlagPF);
+                break;
+            case 6:
+                value = GetFlag(FlagSF) != GetFlag(FlagOF);
+                break;
+            default:
+                value = GetFlag(FlagZF) || GetFlag(FlagSF) != GetFlag(FlagOF);
+                break;
+            }
+            return (cc & 1) ? !value : value;
+        }
+
+        // Returns the rm field of a register-form ModRM byte and its reg
+        // field through reg; memory forms stop the run.
+        bool ModRm(int &reg, int &rm)
+        {
+            uint8_t modrm = Fetch8();
+            reg = (modrm >> 3) & 7;
+            rm = modrm & 7;
+            if ((modrm & 0xC0) != 0xC0)
+            {
+                Unsupported(memory[Linear(sregs[SegCS], start)]);
+                return false;
+            }
+            return true;
+        }
+
+        void Unsupported(uint8_t opcode)
+        {
+            char text[48];
+            if (opcode == 0x00 && Read8(sregs[SegCS], start + 1) == 0x00)
+                snprintf(text, sizeof(text), "ran into zero padding");
+            else
+                snprintf(text, sizeof(text), "opcode %02X is not emulated", opcode);
+            Stop(EmulatorUnsupported, text);
+        }
+
+        void Jump(uint16_t target)
+        {
+            if (target == start)
+            {
+                Stop(EmulatorIdle, "idle in a jump to itself");
+                return;
+            }
+            ip = target;
+        }
+
+        void Teletype(uint8_t c)
+        {
+            switch (c)
+            {
+            case '\r':
+                cursorColumn = 0;
+                return;
+            case '\n':
+                ++cursorRow;
+                break;
+            case '\b':
+                if (cursorColumn > 0)
+                    --cursorColumn;
+                return;
+            case 0x07:
+                return;
+            default:
+                screen[cursorRow][cursorColumn] = static_cast<char>(c >= 0x20 && c < 0x7F ? c : '?');
+                if (++cursorColumn == kTeletypeColumns)
+                {
+                    cursorColumn = 0;
+                    ++cursorRow;
+                }
+                break;
+            }
+
+            if (cursorRow == kTeletypeRows)
+            {
+                screen.erase(screen.begin());
+                screen.push_back(std::string(kTeletypeColumns, ' '));
+                --cursorRow;
+            }
+        }
+
+        // BIOS services are handled natively; anything else goes through a
+        // vector the program installed itself, or stops the run.
+        void Interrupt(uint8_t vector)
+        {
+            if (vector == 0x10)
+            {
+                uint8_t function = regs[RegAX] >> 8;
+                if (function == 0x0E)
+                    Teletype(static_cast<uint8_t>(regs[RegAX]));
+                else if (function == 0x00)
+                {
+                    screen.assign(kTeletypeRows, std::string(kTeletypeColumns, ' '));
+                    cursorRow = 0;
+                    cursorColumn = 0;
+                }
+                return;
+            }
+
+            uint16_t offset = Read16(0, vector * 4);
+            uint16_t segment = Read16(0, vector * 4 + 2);
+            if (offset == 0 && segment == 0)
+            {
+                char text[48];
+                snprintf(text, sizeof(text), vector == 0x16 ? "waiting for a key press" : "int 0x%02X is not emulated", vector);
+                Stop(EmulatorUnsupported, text);
+                return;
+            }
+
+            Push(flags);
+            Push(sregs[SegCS]);
+            Push(ip);
+            SetFlag(FlagIF, false);
+            sregs[SegCS] = segment;
+            ip = offset;
+        }
+
+        void StringOp(uint8_t opcode)
+        {
+            bool wide = opcode & 1;
+            uint16_t delta = GetFlag(FlagDF) ? -(wide ? 2 : 1) : (wide ? 2 : 1);
+
+            switch (opcode & 0xFE)
+            {
+            case 0xA4:
+                if (wide)
+                    Write16(sregs[SegES], regs[RegDI], Read16(sregs[SegDS], regs[RegSI]));
+                else
+                    Write8(sregs[SegES], regs[RegDI], Read8(sregs[SegDS], regs[RegSI]));
+                regs[RegSI] += delta;
+                regs[RegDI] += delta;
+                break;
+            case 0xAA:
+                if (wide)
+                    Write16(sregs[SegES], regs[RegDI], regs[RegAX]);
+                else
+                    Write8(sregs[SegES], regs[RegDI], static_cast<uint8_t>(regs[RegAX]));
+                regs[RegDI] += delta;
+                break;
+            case 0xAC:
+                SetRegister(RegAX, wide, wide ? Read16(sregs[SegDS], regs[RegSI]) : Read8(sregs[SegDS], regs[RegSI]));
+                regs[RegSI] += delta;
+                break;
+            }
+        }
+
+        void Group3(bool wide)
+        {
+            int op;
+            int rm;
+            if (!ModRm(op, rm))
+                return;
+
+            uint32_t value = GetRegister(rm, wide);
+            uint32_t mask = wide ? 0xFFFF : 0xFF;
+            switch (op)
+            {
+            case 0:
+            case 1:
+                Alu(4, value, wide ? Fetch16() : Fetch8(), wide);
+                break;
+            case 2:
+                SetRegister(rm, wide, ~value);
+                break;
+            case 3:
+                SetRegister(rm, wide, Alu(5, 0, value, wide));
+                SetFlag(FlagCF, value != 0);
+                break;
+            case 4:
+            case 5:
+            {
+                bool isSigned = op == 5;
+                int32_t a = wide ? (isSigned ? int16_t(regs[RegAX]) : regs[RegAX]) : (isSigned ? int8_t(regs[RegAX]) : uint8_t(regs[RegAX]));
+                int32_t b = isSigned ? (wide ? int16_t(value) : int8_t(value)) : int32_t(value);
+                uint32_t product = static_cast<uint32_t>(a * b);
+                bool overflow;
+                if (wide)
+                {
+                    regs[RegAX] = static_cast<uint16_t>(product);
+                    regs[RegDX] = static_cast<uint16_t>(product >> 16);
+                    overflow = isSigned ? int32_t(product) != int16_t(product) : (product >> 16) != 0;
+                }
+                else
+                {
+                    regs[RegAX] = static_cast<uint16_t>(product);
+                    overflow = isSigned ? int16_t(product) != int8_t(product) : ((product >> 8) & 0xFF) != 0;
+                }
+                SetFlag(FlagCF, overflow);
+                SetFlag(FlagOF, overflow);
+                break;
+            }
+            default:
+            {
+                bool isSigned = op == 7;
+                if (value == 0)
+                {
+                    Stop(EmulatorUnsupported, "divide error");
+                    return;
+                }
+
+                int64_t dividend = wide ? (int64_t(regs[RegDX]) << 16 | regs[RegAX]) : regs[RegAX];
+                int64_t divisor = value;
+                if (isSigned)
+                {
+                    dividend = wide ? int32_t(uint32_t(dividend)) : int16_t(uint16_t(dividend));
+                    divisor = wide ? int16_t(value) : int8_t(value);
+                }
+                int64_t quotient = dividend / divisor;
+                int64_t remainder = dividend % divisor;
+                bool overflow = isSigned ? (quotient > int64_t(mask >> 1) || quotient < -int64_t(mask >> 1) - 1) : quotient > int64_t(mask);
+                if (overflow)
+                {
+                    Stop(EmulatorUnsupported, "divide error");
+                    return;
+                }
+                if (wide)
+                {
+                    regs[RegAX] = static_cast<uint16_t>(quotient);
+                    regs[RegDX] = static_cast<uint16_t>(remainder);
+                }
+                else
+                {
+                    regs[RegAX] = static_cast<uint16_t>((quotient & 0xFF) | ((remainder & 0xFF) << 8));
+                }
+                break;
+            }
+            }
+        }
+
+        void Step()
+        {
+            uint8_t opcode = Fetch8();
+            int reg;
+            int rm;
+
+            // ALU r/m,reg / reg,r/m / accumulator,imm forms: 00-3D.
+            if (opcode < 0x40 && (opcode & 7) < 6)
+            {
+                int op = opcode >> 3;
+                bool wide = opcode & 1;
+                if ((opcode & 7) >= 4)
+                {
+                    uint32_t result = Alu(op, GetRegister(RegAX, wide), wide ? Fetch16() : Fetch8(), wide);
+                    if (op != 7)
+                        SetRegister(RegAX, wide, result);
+                    return;
+                }
+                if (!ModRm(reg, rm))
+                    return;
+                int dst = (opcode & 2) ? reg : rm;
+                int src = (opcode & 2) ? rm : reg;
+                uint32_t result = Alu(op, GetRegister(dst, wide), GetRegister(src, wide), wide);
+                if (op != 7)
+                    SetRegister(dst, wide, result);
+                return;
+            }
+
+            if (opcode >= 0x40 && opcode <= 0x4F)
+            {
+                bool carry = GetFlag(FlagCF);
+                uint16_t value = regs[opcode & 7];
+                regs[opcode & 7] = static_cast<uint16_t>(Alu(opcode < 0x48 ? 0 : 5, value, 1, true));
+                SetFlag(FlagCF, carry);
+                return;
+            }
+            if (opcode >= 0x50 && opcode <= 0x57)
+            {
+                Push(opcode == 0x50 + RegSP ? regs[RegSP] : regs[opcode & 7]);
+                return;
+            }
+            if (opcode >= 0x58 && opcode <= 0x5F)
+            {
+                regs[opcode & 7] = Pop();
+                return;
+            }
+            if (opcode >= 0x70 && opcode <= 0x7F)
+            {
+                int8_t displacement = static_cast<int8_t>(Fetch8());
+                if (Condition(opcode & 0xF))
+                    Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            if (opcode >= 0xB0 && opcode <= 0xBF)
+            {
+                bool wide = opcode >= 0xB8;
+                SetRegister(opcode & 7, wide, wide ? Fetch16() : Fetch8());
+                return;
+            }
+
+            switch (opcode)
+            {
+            case 0x06:
+            case 0x0E:
+            case 0x16:
+            case 0x1E:
+                Push(sregs[opcode >> 3]);
+                return;
+            case 0x07:
+            case 0x17:
+            case 0x1F:
+                sregs[opcode >> 3] = Pop();
+                return;
+            case 0x0F:
+            {
+                uint8_t second = Fetch8();
+                if (second < 0x80 || second > 0x8F)
+                {
+                    Unsupported(opcode);
+                    return;
+                }
+                int16_t displacement = static_cast<int16_t>(Fetch16());
+                if (Condition(second & 0xF))
+                    Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            case 0x60:
+            {
+                uint16_t sp = regs[RegSP];
+                for (int r = RegAX; r <= RegDI; ++r)
+                    Push(r == RegSP ? sp : regs[r]);
+                return;
+            }
+            case 0x61:
+                for (int r = RegDI; r >= RegAX; --r)
+                {
+                    uint16_t value = Pop();
+                    if (r != RegSP)
+                        regs[r] = value;
+                }
+                return;
+            case 0x68:
+                Push(Fetch16());
+                return;
+            case 0x6A:
+                Push(static_cast<uint16_t>(static_cast<int8_t>(Fetch8())));
+                return;
+            case 0x80:
+            case 0x81:
+            case 0x83:
+            {
+                bool wide = opcode != 0x80;
+                if (!ModRm(reg, rm))
+                    return;
+                uint32_t immediate = opcode == 0x81 ? Fetch16() : opcode == 0x83 ? static_cast<uint16_t>(static_cast<int8_t>(Fetch8())) : Fetch8();
+                uint32_t result = Alu(reg, GetRegister(rm, wide), immediate, wide);
+                if (reg != 7)
+                    SetRegister(rm, wide, result);
+                return;
+            }
+            case 0x84:
+            case 0x85:
+                if (ModRm(reg, rm))
+                    Alu(4, GetRegister(rm, opcode & 1), GetRegister(reg, opcode & 1), opcode & 1);
+                return;
+            case 0x88:
+            case 0x89:
+            case 0x8A:
+            case 0x8B:
+            {
+                bool wide = opcode & 1;
+                if (!ModRm(reg, rm))
+                    return;
+                if (opcode & 2)
+                    SetRegister(reg, wide, GetRegister(rm, wide));
+                else
+                    SetRegister(rm, wide, GetRegister(reg, wide));
+                return;
+            }
+            case 0x8C:
+                if (ModRm(reg, rm))
+                    regs[rm] = sregs[reg & 3];
+                return;
+            case 0x8E:
+                if (ModRm(reg, rm))
+                    sregs[reg & 3] = regs[rm];
+                return;
+            case 0x90:
+                return;
+            case 0x98:
+                regs[RegAX] = static_cast<uint16_t>(static_cast<int8_t>(regs[RegAX]));
+                return;
+            case 0x99:
+                regs[RegDX] = (regs[RegAX] & 0x8000) ? 0xFFFF : 0;
+                return;
+            case 0x9C:
+                Push(flags);
+                return;
+            case 0x9D:
+                flags = Pop() | kFlagsAlwaysSet;
+                return;
+            case 0x9E:
+                flags = static_cast<uint16_t>((flags & 0xFF00) | ((regs[RegAX] >> 8) & 0xD5) | kFlagsAlwaysSet);
+                return;
+            case 0x9F:
+                SetRegister(4, false, flags & 0xFF);
+                return;
+            case 0xA4:
+            case 0xA5:
+            case 0xAA:
+            case 0xAB:
+            case 0xAC:
+            case 0xAD:
+                StringOp(opcode);
+                return;
+            case 0xA8:
+            case 0xA9:
+                Alu(4, GetRegister(RegAX, opcode & 1), (opcode & 1) ? Fetch16() : Fetch8(), opcode & 1);
+                return;
+            case 0xC0:
+            case 0xC1:
+            case 0xD0:
+            case 0xD1:
+            case 0xD2:
+            case 0xD3:
+            {
+                bool wide = opcode & 1;
+                if (!ModRm(reg, rm))
+                    return;
+                unsigned count = opcode <= 0xC1 ? Fetch8() : opcode <= 0xD1 ? 1 : regs[RegCX] & 0xFF;
+                SetRegister(rm, wide, Shift(reg, GetRegister(rm, wide), count, wide));
+                return;
+            }
+            case 0xC3:
+                ip = Pop();
+                return;
+            case 0xCB:
+                ip = Pop();
+                sregs[SegCS] = Pop();
+                return;
+            case 0xCC:
+                Interrupt(3);
+                return;
+            case 0xCD:
+                Interrupt(Fetch8());
+                return;
+            case 0xCE:
+                if (GetFlag(FlagOF))
+                    Interrupt(4);
+                return;
+            case 0xCF:
+                ip = Pop();
+                sregs[SegCS] = Pop();
+                flags = Pop() | kFlagsAlwaysSet;
+                return;
+            case 0xE0:
+            case 0xE1:
+            case 0xE2:
+            {
+                int8_t displacement = static_cast<int8_t>(Fetch8());
+                --regs[RegCX];
+                bool taken = regs[RegCX] != 0 && (opcode == 0xE2 || GetFlag(FlagZF) == (opcode == 0xE1));
+                if (taken)
+                    Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            case 0xE3:
+            {
+                int8_t displacement = static_cast<int8_t>(Fetch8());
+                if (regs[RegCX] == 0)
+                    Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            case 0xE4:
+            case 0xE5:
+                Fetch8();
+                SetRegister(RegAX, opcode & 1, 0xFFFF);
+                return;
+            case 0xE6:
+            case 0xE7:
+                Fetch8();
+                return;
+            case 0xE8:
+            {
+                int16_t displacement = static_cast<int16_t>(Fetch16());
+                Push(ip);
+                ip = static_cast<uint16_t>(ip + displacement);
+                return;
+            }
+            case 0xE9:
+            {
+                int16_t displacement = static_cast<int16_t>(Fetch16());
+                Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            case 0xEA:
+            {
+                uint16_t offset = Fetch16();
+                sregs[SegCS] = Fetch16();
+                ip = offset;
+                return;
+            }
+            case 0xEB:
+            {
+                int8_t displacement = static_cast<int8_t>(Fetch8());
+                Jump(static_cast<uint16_t>(ip + displacement));
+                return;
+            }
+            case 0xEC:
+            case 0xED:
+                SetRegister(RegAX, opcode & 1, 0xFFFF);
+                return;
+            case 0xEE:
+            case 0xEF:
+                return;
+            case 0xF4:
+                Stop(EmulatorHalted, "halted");
+                return;
+            case 0xF5:
+                SetFlag(FlagCF, !GetFlag(FlagCF));
+                return;
+            case 0xF6:
+            case 0xF7:
+                Group3(opcode & 1);
+                return;
+            case 0xF8:
+            case 0xF9:
+                SetFlag(FlagCF, opcode & 1);
+                return;
+            case 0xFA:
+            case 0xFB:
+                SetFlag(FlagIF, opcode & 1);
+                return;
+            case 0xFC:
+            case 0xFD:
+                SetFlag(FlagDF, opcode & 1);
+                return;
+            case 0xFE:
+                if (ModRm(reg, rm))
+                {
+                    if (reg > 1)
+                    {
+                        Unsupported(opcode);
+                        return;
+                    }
+                    bool carry = GetFlag(FlagCF);
+                    SetRegister(rm, false, Alu(reg == 0 ? 0 : 5, GetRegister(rm, false), 1, false));
+                    SetFlag(FlagCF, carry);
+                }
+                return;
+            default:
+                Unsupported(opcode);
+                return;
+            }
+        }
+    };
+}
+
+void RunRealMode(const std::vector<uint8_t> &image, uint64_t maxSteps, EmulatorResult &result)
+{
+    Cpu cpu(image, result);
+    cpu.Run(maxSteps);
+}
+
+namespace
+{
+    void RunSession(EmulatorSession &session, std::vector<uint8_t> image, uint64_t maxSteps)
+    {
+        EmulatorResult result;
+        RunRealMode(image, maxSteps, result);
+
+        std::lock_guard<std::mutex> lock(session.mutex);
+        session.finished = true;
+        session.result = std::move(result);
+        session.busy = false;
+    }
+}
+
+bool EmulatorSubmit(EmulatorSession &session, std::vector<uint8_t> image, uint64_t maxSteps)
+{
+    if (session.busy)
+        return false;
+    if (session.worker.joinable())
+        session.worker.join();
+
+    session.busy = true;
+    session.worker = std::thread(RunSession, std::ref(session), std::move(image), maxSteps);
+    return true;
+}
+
+bool EmulatorTakeResult(EmulatorSession &session, EmulatorResult &result)
+{
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (!session.finished)
+        return false;
+    session.finished = false;
+    result = std::move(session.result);
+    return true;
+}
+
+void EmulatorShutdown(EmulatorSession &session)
+{
+    if (session.worker.joinable())
+        session.worker.join();
+
+    std::lock_guard<std::mutex> lock(session.mutex);
+    session.finished = false;
+}
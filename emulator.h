@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Small 16-bit real-mode interpreter for previewing kernels without a VM.
+// It covers the instructions the in-process assembler encodes (register and
+// immediate operands only, no memory operands) and the BIOS teletype
+// service, int 0x10 with AH=0x0E. The image is loaded at 0000:7C00 like a
+// boot sector and runs until it halts, idles in a jump to itself, needs
+// something that is not emulated, or uses up its step budget.
+
+constexpr int kTeletypeColumns = 80;
+constexpr int kTeletypeRows = 25;
+
+enum EmulatorStop : uint8_t
+{
+    EmulatorHalted,
+    EmulatorIdle,
+    EmulatorStepLimit,
+    EmulatorUnsupported
+};
+
+struct EmulatorResult
+{
+    EmulatorStop stop = EmulatorHalted;
+    std::string message;
+    uint64_t steps = 0;
+
+    // Teletype screen, one string per row, trailing blanks trimmed.
+    std::vector<std::string> screen;
+};
+
+void RunRealMode(const std::vector<uint8_t> &image, uint64_t maxSteps, EmulatorResult &result);
+
+// Runs images on a worker thread so the editor never waits for a run.
+struct EmulatorSession
+{
+    std::thread worker;
+    std::atomic<bool> busy{false};
+
+    std::mutex mutex;
+    bool finished = false;
+    EmulatorResult result;
+};
+
+// Starts a run of the image. Returns false while the previous run is still
+// going.
+bool EmulatorSubmit(EmulatorSession &session, std::vector<uint8_t> image, uint64_t maxSteps);
+
+// Returns true once for every finished run, with its result.
+bool EmulatorTakeResult(EmulatorSession &session, EmulatorResult &result);
+
+// Waits for the run in flight and drops its result.
+void EmulatorShutdown(EmulatorSession &session);
@@ -0,0 +1,170 @@
+#include "frame_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+const char *const kProfileStageNames[StageCount] = {
+    "Events",
+    "NewFrame",
+    "Update",
+    "Nodes",
+    "EndNodeEditor",
+    "Render",
+    "RenderDrawData",
+    "SwapBuffers",
+    "GPU",
+};
+
+namespace
+{
+    int Slot(uint64_t frame)
+    {
+        return static_cast<int>(frame % kProfileHistory);
+    }
+
+    double MicrosecondsBetween(ProfileClock::time_point from, ProfileClock::time_point to)
+    {
+        return std::chrono::duration<double, std::micro>(to - from).count();
+    }
+
+    // Oldest recorded frame still in the history.
+    uint64_t FirstFrame(const FrameProfiler &profiler)
+    {
+        return profiler.frame - ProfileFrameCount(profiler);
+    }
+
+    bool WriteText(const std::string &path, const std::string &text, std::string &error)
+    {
+        std::ofstream outFile(path, std::ios::binary);
+        outFile.write(text.data(), text.size());
+        outFile.close();
+        if (outFile.fail())
+        {
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    }
+}
+
+void BeginProfileFrame(FrameProfiler &profiler)
+{
+    profiler.recording = profiler.enabled;
+    if (!profiler.recording)
+        return;
+
+    int slot = Slot(profiler.frame);
+    profiler.frameBegin = ProfileClock::now();
+    profiler.frameStart[slot] = MicrosecondsBetween(profiler.epoch, profiler.frameBegin);
+    for (int stage = 0; stage < StageCount; ++stage)
+    {
+        profiler.stageStart[stage][slot] = 0.0f;
+        profiler.stageMs[stage][slot] = 0.0f;
+    }
+}
+
+void EndProfileFrame(FrameProfiler &profiler)
+{
+    if (profiler.recording)
+        ++profiler.frame;
+    profiler.recording = false;
+}
+
+void BeginProfileStage(FrameProfiler &profiler, ProfileStage stage)
+{
+    if (!profiler.recording)
+        return;
+
+    profiler.stageBegin = ProfileClock::now();
+    int slot = Slot(profiler.frame);
+    if (profiler.stageMs[stage][slot] == 0.0f)
+        profiler.stageStart[stage][slot] = static_cast<float>(MicrosecondsBetween(profiler.frameBegin, profiler.stageBegin));
+}
+
+void EndProfileStage(FrameProfiler &profiler, ProfileStage stage)
+{
+    if (!profiler.recording)
+        return;
+
+    double us = MicrosecondsBetween(profiler.stageBegin, ProfileClock::now());
+    profiler.stageMs[stage][Slot(profiler.frame)] += static_cast<float>(us / 1000.0);
+}
+
+void SetProfileGpuTime(FrameProfiler &profiler, uint64_t frame, float startUs, float ms)
+{
+    if (frame >= profiler.frame || profiler.frame - frame > kProfileHistory)
+        return;
+
+    profiler.stageStart[StageGpu][Slot(frame)] = startUs;
+    profiler.stageMs[StageGpu][Slot(frame)] = ms;
+}
+
+int ProfileFrameCount(const FrameProfiler &profiler)
+{
+    return static_cast<int>(std::min<uint64_t>(profiler.frame, kProfileHistory));
+}
+
+void ProfileStageStats(const FrameProfiler &profiler, ProfileStage stage, float &average, float &maximum)
+{
+    int count = ProfileFrameCount(profiler);
+    float total = 0.0f;
+    maximum = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+        total += profiler.stageMs[stage][i];
+        maximum = std::max(maximum, profiler.stageMs[stage][i]);
+    }
+    average = count > 0 ? total / count : 0.0f;
+}
+
+bool ExportProfileCsv(const FrameProfiler &profiler, const std::string &path, std::string &error)
+{
+    std::string text = "frame,start_ms";
+    for (const char *name : kProfileStageNames)
+        text += std::string(",") + name + "_ms";
+    text += "\n";
+
+    char field[64];
+    for (uint64_t frame = FirstFrame(profiler); frame < profiler.frame; ++frame)
+    {
+        int slot = Slot(frame);
+        snprintf(field, sizeof(field), "%llu,%.3f", static_cast<unsigned long long>(frame), profiler.frameStart[slot] / 1000.0);
+        text += field;
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            snprintf(field, sizeof(field), ",%.4f", profiler.stageMs[stage][slot]);
+            text += field;
+        }
+        text += "\n";
+    }
+    return WriteText(path, text, error);
+}
+
+bool ExportChromeTrace(const FrameProfiler &profiler, const std::string &path, std::string &error)
+{
+    std::string text = "{\"traceEvents\":[\n";
+    text += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    text += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+    char event[192];
+    for (uint64_t frame = FirstFrame(profiler); frame < profiler.frame; ++frame)
+    {
+        int slot = Slot(frame);
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            float ms = profiler.stageMs[stage][slot];
+            if (ms <= 0.0f)
+                continue;
+
+            snprintf(event, sizeof(event),
+                     ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"frame\":%llu}}",
+                     kProfileStageNames[stage], stage == StageGpu ? 2 : 1,
+                     profiler.frameStart[slot] + profiler.stageStart[stage][slot], ms * 1000.0,
+                     static_cast<unsigned long long>(frame));
+            text += event;
+        }
+    }
+    text += "\n]}\n";
+    return WriteText(path, text, error);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Per-stage timings of the main loop over the last kProfileHistory frames.
+// Each stage keeps a ring of millisecond values, laid out so the overlay can
+// plot a stage straight from its array. GPU time is reported by the editor
+// a few frames late, once its timer query is ready, and lands in the frame
+// that issued it.
+
+enum ProfileStage : uint8_t
+{
+    StageEvents,
+    StageNewFrame,
+    StageUpdate,
+    StageNodes,
+    StageEndNodeEditor,
+    StageRender,
+    StageRenderDrawData,
+    StageSwapBuffers,
+    StageGpu,
+    StageCount
+};
+
+extern const char *const kProfileStageNames[StageCount];
+
+constexpr int kProfileHistory = 240;
+
+typedef std::chrono::steady_clock ProfileClock;
+
+struct FrameProfiler
+{
+    bool enabled = false;
+    bool recording = false;
+    uint64_t frame = 0;
+    ProfileClock::time_point epoch = ProfileClock::now();
+    ProfileClock::time_point frameBegin;
+    ProfileClock::time_point stageBegin;
+
+    // Indexed by frame % kProfileHistory. Stage starts are microseconds
+    // from the start of their frame, frame starts from epoch.
+    double frameStart[kProfileHistory] = {};
+    float stageStart[StageCount][kProfileHistory] = {};
+    float stageMs[StageCount][kProfileHistory] = {};
+};
+
+// A frame is recorded only if the profiler was enabled when it began.
+void BeginProfileFrame(FrameProfiler &profiler);
+void EndProfileFrame(FrameProfiler &profiler);
+
+// Time between the two calls is added to the stage, so a stage may be
+// split over several spans in one frame.
+void BeginProfileStage(FrameProfiler &profiler, ProfileStage stage);
+void EndProfileStage(FrameProfiler &profiler, ProfileStage stage);
+
+// Stores a GPU time for an earlier frame; dropped once it left the history.
+void SetProfileGpuTime(FrameProfiler &profiler, uint64_t frame, float startUs, float ms);
+
+// Number of recorded frames still in the history.
+int ProfileFrameCount(const FrameProfiler &profiler);
+void ProfileStageStats(const FrameProfiler &profiler, ProfileStage stage, float &average, float &maximum);
+
+// One row per frame, one column per stage, oldest frame first.
+bool ExportProfileCsv(const FrameProfiler &profiler, const std::string &path, std::string &error);
+
+// chrome://tracing / Perfetto JSON: CPU stages on one track, GPU on another.
+bool ExportChromeTrace(const FrameProfiler &profiler, const std::string &path, std::string &error);
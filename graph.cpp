@@ -0,0 +1,1737 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+NodeStore nodes;
+TextArena textArena;
+LinkStore links;
+LinkIdAllocator linkIds;
+NodeIdAllocator nodeIds;
+GraphIndex graphIndex;
+NodeGrid nodeGrid;
+KernelValidation kernelValidation;
+AssemblerEmit assemblerEmit;
+KernelBuild kernelBuild;
+
+static void RewindAssemblerEmit(size_t position)
+{
+    kernelBuild.stepping = false;
+    if (position < kernelBuild.contentHashes.size())
+        kernelBuild.contentHashes.resize(position);
+    if (position < assemblerEmit.offsets.size())
+    {
+        assemblerEmit.text.resize(assemblerEmit.offsets[position]);
+        assemblerEmit.offsets.resize(position);
+    }
+}
+
+void InvalidateKernel()
+{
+    kernelValidation.dirty = true;
+    kernelValidation.dirtyFrom = 0;
+    RewindAssemblerEmit(0);
+}
+
+// The node's position in the validated order, or -1 if it is not there.
+static int KernelPosition(int nodeId)
+{
+    const KernelValidation &state = kernelValidation;
+    if (nodeId >= static_cast<int>(state.positions.size()))
+        return -1;
+    int position = state.positions[nodeId];
+    return position >= 0 && position < static_cast<int>(state.program.order.size()) &&
+                   state.program.order[position] == nodeId
+               ? position
+               : -1;
+}
+
+static void InvalidateNodeText(int nodeId)
+{
+    int position = KernelPosition(nodeId);
+    if (position >= 0)
+        RewindAssemblerEmit(position);
+}
+
+static void InvalidateKernelFrom(int nodeId)
+{
+    int position = KernelPosition(nodeId);
+    if (position < 0)
+        return;
+
+    if (!kernelValidation.dirty || static_cast<size_t>(position) < kernelValidation.dirtyFrom)
+        kernelValidation.dirtyFrom = position;
+    kernelValidation.dirty = true;
+    RewindAssemblerEmit(position + 1);
+}
+
+int NodeSlot(int id)
+{
+    if (id < 0 || id >= static_cast<int>(nodeIds.slots.size()))
+        return -1;
+    return nodeIds.slots[id];
+}
+
+NodeKind KindOf(int id)
+{
+    return nodes.kinds[nodeIds.slots[id]];
+}
+
+std::string_view NodeText(int id)
+{
+    const TextRef &ref = nodes.texts[nodeIds.slots[id]];
+    return std::string_view(textArena.bytes.data() + ref.offset, ref.length);
+}
+
+static void CompactTextArena()
+{
+    std::vector<char> bytes;
+    bytes.reserve(textArena.bytes.size() - textArena.garbage);
+
+    for (TextRef &ref : nodes.texts)
+    {
+        uint32_t offset = static_cast<uint32_t>(bytes.size());
+        bytes.insert(bytes.end(), textArena.bytes.begin() + ref.offset, textArena.bytes.begin() + ref.offset + ref.length);
+        ref.offset = offset;
+    }
+
+    textArena.bytes.swap(bytes);
+    textArena.garbage = 0;
+}
+
+void SetNodeText(int id, std::string_view text)
+{
+    TextRef &ref = nodes.texts[nodeIds.slots[id]];
+
+    if (text.size() <= ref.length)
+    {
+        std::copy(text.begin(), text.end(), textArena.bytes.begin() + ref.offset);
+        textArena.garbage += ref.length - text.size();
+    }
+    else
+    {
+        // The source may itself live in the arena, so locate it before the
+        // buffer grows.
+        const char *arenaBegin = textArena.bytes.data();
+        bool fromArena = text.data() >= arenaBegin && text.data() < arenaBegin + textArena.bytes.size();
+        size_t source = fromArena ? text.data() - arenaBegin : 0;
+
+        textArena.garbage += ref.length;
+        ref.offset = static_cast<uint32_t>(textArena.bytes.size());
+        textArena.bytes.resize(textArena.bytes.size() + text.size());
+        const char *data = fromArena ? textArena.bytes.data() + source : text.data();
+        std::copy(data, data + text.size(), textArena.bytes.begin() + ref.offset);
+    }
+    ref.length = static_cast<uint32_t>(text.size());
+
+    if (textArena.garbage > kTextArenaMinCompact && textArena.garbage * 2 > textArena.bytes.size())
+        CompactTextArena();
+
+    InvalidateNodeText(id);
+}
+
+static int GridCoordinate(float value)
+{
+    return static_cast<int>(std::floor(value / kNodeGridCellSize));
+}
+
+static uint64_t GridCellKey(int cellX, int cellY)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cellX)) << 32) | static_cast<uint32_t>(cellY);
+}
+
+static uint64_t GridCellOf(NodePosition position)
+{
+    return GridCellKey(GridCoordinate(position.x), GridCoordinate(position.y));
+}
+
+static void GridInsert(int id, NodePosition position)
+{
+    if (id >= static_cast<int>(nodeGrid.cellOf.size()))
+    {
+        nodeGrid.cellOf.resize(nodeIds.slots.size());
+        nodeGrid.next.resize(nodeIds.slots.size());
+        nodeGrid.previous.resize(nodeIds.slots.size());
+    }
+
+    uint64_t key = GridCellOf(position);
+    auto inserted = nodeGrid.cells.try_emplace(key, id);
+    int first = inserted.second ? -1 : inserted.first->second;
+    inserted.first->second = id;
+    nodeGrid.cellOf[id] = key;
+    nodeGrid.next[id] = first;
+    nodeGrid.previous[id] = -1;
+    if (first >= 0)
+        nodeGrid.previous[first] = id;
+}
+
+static void GridRemove(int id)
+{
+    int next = nodeGrid.next[id];
+    int previous = nodeGrid.previous[id];
+    if (next >= 0)
+        nodeGrid.previous[next] = previous;
+    if (previous >= 0)
+    {
+        nodeGrid.next[previous] = next;
+        return;
+    }
+
+    auto cellIt = nodeGrid.cells.find(nodeGrid.cellOf[id]);
+    if (next >= 0)
+        cellIt->second = next;
+    else
+        nodeGrid.cells.erase(cellIt);
+}
+
+// Files every node at once for a loader. The lists live in arrays sized
+// once; only the first node of each occupied cell costs a map entry.
+static void BuildNodeGrid()
+{
+    nodeGrid = NodeGrid();
+    nodeGrid.cellOf.resize(nodeIds.slots.size());
+    nodeGrid.next.resize(nodeIds.slots.size());
+    nodeGrid.previous.resize(nodeIds.slots.size());
+    for (size_t slot = 0; slot < nodes.size(); ++slot)
+        GridInsert(nodes.ids[slot], nodes.positions[slot]);
+}
+
+void SetNodePosition(int id, NodePosition position)
+{
+    nodes.positions[nodeIds.slots[id]] = position;
+    if (GridCellOf(position) == nodeGrid.cellOf[id])
+        return;
+
+    GridRemove(id);
+    GridInsert(id, position);
+}
+
+void QueryNodeGrid(NodePosition min, NodePosition max, std::vector<int> &ids)
+{
+    int minX = GridCoordinate(min.x);
+    int minY = GridCoordinate(min.y);
+    int maxX = GridCoordinate(max.x);
+    int maxY = GridCoordinate(max.y);
+    for (int cellX = minX; cellX <= maxX; ++cellX)
+    {
+        for (int cellY = minY; cellY <= maxY; ++cellY)
+        {
+            auto cellIt = nodeGrid.cells.find(GridCellKey(cellX, cellY));
+            if (cellIt == nodeGrid.cells.end())
+                continue;
+
+            for (int id = cellIt->second; id >= 0; id = nodeGrid.next[id])
+            {
+                const NodePosition &position = nodes.positions[nodeIds.slots[id]];
+                if (position.x >= min.x && position.x <= max.x && position.y >= min.y && position.y <= max.y)
+                    ids.push_back(id);
+            }
+        }
+    }
+}
+
+static void InitPrintChar(int id)
+{
+    SetNodeText(id, "A");
+}
+
+static void EmitPrintChar(int id, std::string &text)
+{
+    std::string_view letter = NodeText(id);
+    text += "mov ah, 0x0e\n";
+    text += "mov al, '";
+    text += letter.empty() ? '\0' : letter[0];
+    text += "'\n";
+    text += "int 0x10\n";
+}
+
+static void EmitInstruction(int id, std::string &text)
+{
+    text += NodeText(id);
+    text += "\n";
+}
+
+static void EmitKernelEnd(int, std::string &text)
+{
+    text += "times 510-($-$$) db 0\n";
+    text += "dw 0AA55h\n";
+}
+
+const NodeKindInfo kNodeKinds[NodeKindCount] = {
+    {"kernel_start", "Add kernel_start", nullptr, "Start", false, nullptr, nullptr},
+    {"kernel_end", "Add kernel_end", "End", nullptr, true, nullptr, EmitKernelEnd},
+    {"print_char", "Add print_char", "Input", "Output", false, InitPrintChar, EmitPrintChar},
+    {"instruction", "Add instruction", "Input", "Output", false, nullptr, EmitInstruction},
+};
+
+const NodeKindInfo &KindInfo(NodeKind kind)
+{
+    return kNodeKinds[kind];
+}
+
+static int AllocateNodeId()
+{
+    if (!nodeIds.freeIds.empty())
+    {
+        int id = nodeIds.freeIds.back();
+        nodeIds.freeIds.pop_back();
+        return id;
+    }
+
+    nodeIds.generations.push_back(0);
+    nodeIds.slots.push_back(-1);
+    return static_cast<int>(nodeIds.slots.size() - 1);
+}
+
+static void ReleaseNodeId(int id)
+{
+    nodeIds.slots[id] = -1;
+    ++nodeIds.generations[id];
+    nodeIds.freeIds.push_back(id);
+}
+
+bool NodeExists(NodeHandle handle)
+{
+    return NodeSlot(handle.id) >= 0 && nodeIds.generations[handle.id] == handle.generation;
+}
+
+PinId InputPin(int id) { return MakePinId(id, nodeIds.generations[id], 0, PinInput); }
+PinId OutputPin(int id) { return MakePinId(id, nodeIds.generations[id], 0, PinOutput); }
+
+PinId PinFromAttr(int attr)
+{
+    int nodeId = attr >> kPinNodeShift;
+    uint32_t generation = nodeId < static_cast<int>(nodeIds.generations.size()) ? nodeIds.generations[nodeId] : 0;
+    return (static_cast<PinId>(generation) << 32) | static_cast<PinId>(attr);
+}
+
+// Returns the id of the live node owning the pin, or -1 if it was deleted.
+int FindPinNode(PinId pin)
+{
+    NodeHandle handle = {PinNodeId(pin), static_cast<uint32_t>(pin >> 32)};
+    return NodeExists(handle) ? handle.id : -1;
+}
+
+int CreateNode(NodeKind kind)
+{
+    int id = AllocateNodeId();
+    if (id >= kMaxNodeIds)
+    {
+        std::cerr << "Node id space exhausted\n";
+        std::abort();
+    }
+
+    if (kind == NodeKernelStart)
+        InvalidateKernel();
+
+    nodeIds.slots[id] = static_cast<int>(nodes.size());
+    nodes.ids.push_back(id);
+    nodes.kinds.push_back(kind);
+    nodes.texts.push_back(TextRef{static_cast<uint32_t>(textArena.bytes.size()), 0});
+    nodes.positions.push_back(NodePosition{0.0f, 0.0f});
+    GridInsert(id, NodePosition{0.0f, 0.0f});
+
+    if (KindInfo(kind).init != nullptr)
+        KindInfo(kind).init(id);
+    return id;
+}
+
+static LinkId AllocateLinkId()
+{
+    if (!linkIds.freeIds.empty())
+    {
+        LinkId id = linkIds.freeIds.back();
+        linkIds.freeIds.pop_back();
+        return id;
+    }
+
+    linkIds.slots.push_back(-1);
+    return static_cast<LinkId>(linkIds.slots.size() - 1);
+}
+
+int LinkSlot(LinkId id)
+{
+    if (id < 0 || id >= static_cast<int>(linkIds.slots.size()))
+        return -1;
+    return linkIds.slots[id];
+}
+
+static void ListAppend(PinLinkList &list, std::vector<LinkListEntry> &entries, LinkId link)
+{
+    entries[link] = LinkListEntry{list.last, -1};
+    if (list.last >= 0)
+        entries[list.last].next = link;
+    else
+        list.first = link;
+    list.last = link;
+    ++list.size;
+}
+
+static void ListRemove(PinLinkList &list, std::vector<LinkListEntry> &entries, LinkId link)
+{
+    const LinkListEntry &entry = entries[link];
+    if (entry.previous >= 0)
+        entries[entry.previous].next = entry.next;
+    else
+        list.first = entry.next;
+    if (entry.next >= 0)
+        entries[entry.next].previous = entry.previous;
+    else
+        list.last = entry.previous;
+    --list.size;
+}
+
+// Sizes the index for every node and link id handed out so far.
+static void GrowGraphIndex()
+{
+    if (graphIndex.outgoing.size() < nodeIds.slots.size())
+    {
+        graphIndex.outgoing.resize(nodeIds.slots.size());
+        graphIndex.incoming.resize(nodeIds.slots.size());
+    }
+    if (graphIndex.outgoingEntries.size() < linkIds.slots.size())
+    {
+        graphIndex.outgoingEntries.resize(linkIds.slots.size());
+        graphIndex.incomingEntries.resize(linkIds.slots.size());
+    }
+}
+
+static void IndexLink(LinkId id, PinId startPin, PinId endPin)
+{
+    GrowGraphIndex();
+    ListAppend(graphIndex.outgoing[PinNodeId(startPin)], graphIndex.outgoingEntries, id);
+    ListAppend(graphIndex.incoming[PinNodeId(endPin)], graphIndex.incomingEntries, id);
+    InvalidateKernelFrom(PinNodeId(startPin));
+}
+
+// Indexes every link at once for a loader, in link slot order. The lists
+// live in four arrays sized once, so nothing is allocated per pin.
+static void BuildGraphIndex()
+{
+    graphIndex = GraphIndex();
+    GrowGraphIndex();
+    for (size_t i = 0; i < links.size(); ++i)
+    {
+        ListAppend(graphIndex.outgoing[PinNodeId(links.starts[i])], graphIndex.outgoingEntries, links.ids[i]);
+        ListAppend(graphIndex.incoming[PinNodeId(links.ends[i])], graphIndex.incomingEntries, links.ids[i]);
+    }
+}
+
+// Takes the link out of both pins' lists without touching the link table.
+static void UnlistLink(LinkId id, PinId startPin, PinId endPin)
+{
+    ListRemove(graphIndex.outgoing[PinNodeId(startPin)], graphIndex.outgoingEntries, id);
+    ListRemove(graphIndex.incoming[PinNodeId(endPin)], graphIndex.incomingEntries, id);
+}
+
+static void UnindexLink(LinkId id, PinId startPin, PinId endPin)
+{
+    UnlistLink(id, startPin, endPin);
+    InvalidateKernelFrom(PinNodeId(startPin));
+}
+
+static const PinLinkList *PinList(PinId pin)
+{
+    int id = FindPinNode(pin);
+    if (id < 0 || id >= static_cast<int>(graphIndex.outgoing.size()))
+        return nullptr;
+    return PinDirectionOf(pin) == PinOutput ? &graphIndex.outgoing[id] : &graphIndex.incoming[id];
+}
+
+static const std::vector<LinkListEntry> &PinEntries(PinId pin)
+{
+    return PinDirectionOf(pin) == PinOutput ? graphIndex.outgoingEntries : graphIndex.incomingEntries;
+}
+
+LinkId FirstPinLink(PinId pin)
+{
+    const PinLinkList *list = PinList(pin);
+    return list != nullptr ? list->first : -1;
+}
+
+LinkId LastPinLink(PinId pin)
+{
+    const PinLinkList *list = PinList(pin);
+    return list != nullptr ? list->last : -1;
+}
+
+LinkId NextPinLink(PinId pin, LinkId link)
+{
+    return PinEntries(pin)[link].next;
+}
+
+LinkId PreviousPinLink(PinId pin, LinkId link)
+{
+    return PinEntries(pin)[link].previous;
+}
+
+uint32_t PinLinkCount(PinId pin)
+{
+    const PinLinkList *list = PinList(pin);
+    return list != nullptr ? list->size : 0;
+}
+
+PinId LinkedPin(PinId pin, LinkId link)
+{
+    int slot = linkIds.slots[link];
+    return PinDirectionOf(pin) == PinOutput ? links.ends[slot] : links.starts[slot];
+}
+
+LinkId FindLink(PinId startPin, PinId endPin)
+{
+    for (LinkId link = FirstPinLink(startPin); link >= 0; link = NextPinLink(startPin, link))
+    {
+        if (LinkedPin(startPin, link) == endPin)
+            return link;
+    }
+    return -1;
+}
+
+bool CanLink(PinId startPin, PinId endPin)
+{
+    int startNode = FindPinNode(startPin);
+    int endNode = FindPinNode(endPin);
+    return startNode >= 0 && endNode >= 0 && startNode != endNode && PinDirectionOf(startPin) == PinOutput &&
+           PinDirectionOf(endPin) == PinInput && KindInfo(KindOf(startNode)).outputLabel != nullptr &&
+           KindInfo(KindOf(endNode)).inputLabel != nullptr;
+}
+
+// Loaders check for duplicate links once the index is built rather than
+// with FindLink per link, which is quadratic in the degree of a hub. Lists
+// of one link, the common case in a chain, are skipped.
+static bool HasDuplicateLinks()
+{
+    std::vector<PinId> targets;
+    for (int id : nodes.ids)
+    {
+        PinId pin = OutputPin(id);
+        if (PinLinkCount(pin) < 2)
+            continue;
+
+        targets.clear();
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+            targets.push_back(LinkedPin(pin, link));
+        std::sort(targets.begin(), targets.end());
+        if (std::adjacent_find(targets.begin(), targets.end()) != targets.end())
+            return true;
+    }
+    return false;
+}
+
+// A loader fills nodes.kinds, texts and positions, and textArena, in file
+// order; this numbers the nodes by slot and files them in the grid.
+static void AdoptLoadedNodes()
+{
+    size_t count = nodes.kinds.size();
+    nodes.ids.resize(count);
+    nodeIds.generations.assign(count, 0);
+    nodeIds.slots.resize(count);
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+        nodes.ids[slot] = static_cast<int>(slot);
+        nodeIds.slots[slot] = static_cast<int>(slot);
+    }
+    BuildNodeGrid();
+}
+
+// Then it fills links.starts and ends, and this numbers the links by slot,
+// in file order, and indexes them. Returns false if a link is there twice.
+static bool AdoptLoadedLinks()
+{
+    size_t count = links.starts.size();
+    links.ids.resize(count);
+    links.serials.resize(count);
+    links.nextSerial = count;
+    linkIds.slots.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        links.ids[i] = static_cast<LinkId>(i);
+        links.serials[i] = i;
+        linkIds.slots[i] = static_cast<int>(i);
+    }
+    BuildGraphIndex();
+    InvalidateKernel();
+    return !HasDuplicateLinks();
+}
+
+// Whether a node of kind from can link to one of kind to, for loaders
+// checking links between nodes that are not live yet.
+static bool KindsCanLink(NodeKind from, NodeKind to)
+{
+    return KindInfo(from).outputLabel != nullptr && KindInfo(to).inputLabel != nullptr;
+}
+
+LinkId AddLink(PinId startPin, PinId endPin)
+{
+    LinkId id = AllocateLinkId();
+    linkIds.slots[id] = static_cast<int>(links.size());
+    links.ids.push_back(id);
+    links.starts.push_back(startPin);
+    links.ends.push_back(endPin);
+    links.serials.push_back(links.nextSerial++);
+    IndexLink(id, startPin, endPin);
+    return id;
+}
+
+void RemoveLink(LinkId id)
+{
+    int slot = linkIds.slots[id];
+    UnindexLink(id, links.starts[slot], links.ends[slot]);
+
+    if (slot != static_cast<int>(links.size()) - 1)
+    {
+        links.ids[slot] = links.ids.back();
+        links.starts[slot] = links.starts.back();
+        links.ends[slot] = links.ends.back();
+        links.serials[slot] = links.serials.back();
+        linkIds.slots[links.ids[slot]] = slot;
+    }
+    links.ids.pop_back();
+    links.starts.pop_back();
+    links.ends.pop_back();
+    links.serials.pop_back();
+
+    linkIds.slots[id] = -1;
+    linkIds.freeIds.push_back(id);
+}
+
+void DeleteNode(int id)
+{
+    int slot = nodeIds.slots[id];
+    if (nodes.kinds[slot] == NodeKernelStart)
+        InvalidateKernel();
+
+    for (PinId pin : {InputPin(id), OutputPin(id)})
+    {
+        for (LinkId link = LastPinLink(pin); link >= 0; link = LastPinLink(pin))
+            RemoveLink(link);
+    }
+
+    textArena.garbage += nodes.texts[slot].length;
+
+    if (slot != static_cast<int>(nodes.size()) - 1)
+    {
+        nodes.ids[slot] = nodes.ids.back();
+        nodes.kinds[slot] = nodes.kinds.back();
+        nodes.texts[slot] = nodes.texts.back();
+        nodes.positions[slot] = nodes.positions.back();
+        nodeIds.slots[nodes.ids[slot]] = slot;
+    }
+    nodes.ids.pop_back();
+    nodes.kinds.pop_back();
+    nodes.texts.pop_back();
+    nodes.positions.pop_back();
+    if (id < static_cast<int>(kernelBuild.nodeCode.size()))
+        kernelBuild.nodeCode[id] = NodeCode();
+    GridRemove(id);
+    ReleaseNodeId(id);
+}
+
+void DeleteNodes(const std::vector<int> &ids)
+{
+    std::vector<bool> doomed(nodeIds.slots.size(), false);
+    for (int id : ids)
+    {
+        if (NodeSlot(id) < 0)
+            continue;
+        doomed[id] = true;
+        if (KindOf(id) == NodeKernelStart)
+            InvalidateKernel();
+    }
+
+    // Links touching a doomed node are compacted out of the link table and
+    // unlisted from their pins as they go.
+    size_t keptLinks = 0;
+    for (size_t slot = 0; slot < links.size(); ++slot)
+    {
+        LinkId id = links.ids[slot];
+        PinId startPin = links.starts[slot];
+        PinId endPin = links.ends[slot];
+        bool startDoomed = doomed[PinNodeId(startPin)];
+        bool endDoomed = doomed[PinNodeId(endPin)];
+        if (startDoomed || endDoomed)
+        {
+            UnindexLink(id, startPin, endPin);
+            linkIds.slots[id] = -1;
+            linkIds.freeIds.push_back(id);
+            continue;
+        }
+
+        links.ids[keptLinks] = id;
+        links.starts[keptLinks] = startPin;
+        links.ends[keptLinks] = endPin;
+        links.serials[keptLinks] = links.serials[slot];
+        linkIds.slots[id] = static_cast<int>(keptLinks);
+        ++keptLinks;
+    }
+    links.ids.resize(keptLinks);
+    links.starts.resize(keptLinks);
+    links.ends.resize(keptLinks);
+    links.serials.resize(keptLinks);
+
+
+    size_t keptNodes = 0;
+    for (size_t slot = 0; slot < nodes.size(); ++slot)
+    {
+        int id = nodes.ids[slot];
+        if (doomed[id])
+        {
+            textArena.garbage += nodes.texts[slot].length;
+            if (id < static_cast<int>(kernelBuild.nodeCode.size()))
+                kernelBuild.nodeCode[id] = NodeCode();
+            GridRemove(id);
+            ReleaseNodeId(id);
+            continue;
+        }
+
+        nodes.ids[keptNodes] = id;
+        nodes.kinds[keptNodes] = nodes.kinds[slot];
+        nodes.texts[keptNodes] = nodes.texts[slot];
+        nodes.positions[keptNodes] = nodes.positions[slot];
+        nodeIds.slots[id] = static_cast<int>(keptNodes);
+        ++keptNodes;
+    }
+    nodes.ids.resize(keptNodes);
+    nodes.kinds.resize(keptNodes);
+    nodes.texts.resize(keptNodes);
+    nodes.positions.resize(keptNodes);
+
+    if (textArena.garbage > kTextArenaMinCompact && textArena.garbage * 2 > textArena.bytes.size())
+        CompactTextArena();
+}
+
+void CopyNodes(const std::vector<int> &ids, GraphClip &clip)
+{
+    clip = GraphClip();
+    std::vector<int> copied;
+    std::vector<int> clipIndex(nodeIds.slots.size(), -1);
+    for (int id : ids)
+    {
+        int slot = NodeSlot(id);
+        if (slot < 0 || clipIndex[id] >= 0)
+            continue;
+
+        std::string_view text = NodeText(id);
+        clipIndex[id] = static_cast<int>(clip.size());
+        copied.push_back(id);
+        clip.kinds.push_back(nodes.kinds[slot]);
+        clip.texts.push_back(TextRef{static_cast<uint32_t>(clip.text.size()), static_cast<uint32_t>(text.size())});
+        clip.positions.push_back(nodes.positions[slot]);
+        clip.text.append(text.data(), text.size());
+    }
+
+    for (int id : copied)
+    {
+        PinId pin = OutputPin(id);
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+        {
+            int targetId = FindPinNode(LinkedPin(pin, link));
+            if (targetId >= 0 && clipIndex[targetId] >= 0)
+                clip.links.emplace_back(clipIndex[id], clipIndex[targetId]);
+        }
+    }
+}
+
+std::vector<int> PasteNodes(const GraphClip &clip, NodePosition offset)
+{
+    std::vector<int> ids(clip.size());
+    for (size_t i = 0; i < clip.size(); ++i)
+    {
+        ids[i] = CreateNode(clip.kinds[i]);
+        SetNodeText(ids[i], std::string_view(clip.text).substr(clip.texts[i].offset, clip.texts[i].length));
+        SetNodePosition(ids[i], NodePosition{clip.positions[i].x + offset.x, clip.positions[i].y + offset.y});
+    }
+
+    for (const std::pair<uint32_t, uint32_t> &link : clip.links)
+        AddLink(OutputPin(ids[link.first]), InputPin(ids[link.second]));
+    return ids;
+}
+
+void ClearGraph()
+{
+    nodes = NodeStore();
+    textArena = TextArena();
+    links = LinkStore();
+    linkIds = LinkIdAllocator();
+    nodeIds = NodeIdAllocator();
+    graphIndex = GraphIndex();
+    nodeGrid = NodeGrid();
+    kernelValidation = KernelValidation();
+    assemblerEmit = AssemblerEmit();
+    kernelBuild = KernelBuild();
+}
+
+static void PushKernelNode(int id)
+{
+    KernelValidation &state = kernelValidation;
+    state.stack.push_back(KernelStackEntry{id, state.top});
+    state.top = static_cast<int>(state.stack.size()) - 1;
+}
+
+// Called once a node has been added to the order: either the walk ends
+// there or its successors are pushed, one per step of the walk.
+static void EnterKernelNode(int id)
+{
+    KernelValidation &state = kernelValidation;
+    KernelProgram &program = state.program;
+    state.expanding = -1;
+
+    if (KindInfo(KindOf(id)).endsKernel)
+    {
+        program.reachesEnd = true;
+        state.top = -1;
+        return;
+    }
+
+    state.expandLink = LastPinLink(OutputPin(id));
+    if (state.expandLink < 0)
+    {
+        if (program.brokenNode < 0)
+            program.brokenNode = id;
+        return;
+    }
+    state.expanding = id;
+}
+
+// Pushes the next successor of the node being expanded. Successors are
+// pushed last link first, so they are visited in link creation order.
+static void ExpandKernelNode()
+{
+    KernelValidation &state = kernelValidation;
+    PinId pin = OutputPin(state.expanding);
+    LinkId link = state.expandLink;
+    state.expandLink = PreviousPinLink(pin, link);
+    if (state.expandLink < 0)
+        state.expanding = -1;
+
+    int target = FindPinNode(LinkedPin(pin, link));
+    if (target >= 0 && KernelPosition(target) < 0)
+        PushKernelNode(target);
+}
+
+// Puts the walk back where it was right after adding the node at dirtyFrom
+// to the order, before any of its successors were pushed.
+static void ResumeKernelWalk()
+{
+    KernelValidation &state = kernelValidation;
+    KernelProgram &program = state.program;
+    size_t position = state.dirtyFrom;
+
+    program.order.resize(position + 1);
+    program.reachesEnd = false;
+    int brokenAt = program.brokenNode >= 0 ? KernelPosition(program.brokenNode) : -1;
+    if (brokenAt < 0 || static_cast<size_t>(brokenAt) >= position)
+        program.brokenNode = -1;
+
+    state.top = state.stackTops[position];
+    state.stack.resize(state.stackSizes[position]);
+    state.stackTops.resize(position + 1);
+    state.stackSizes.resize(position + 1);
+    EnterKernelNode(program.order.back());
+}
+
+// The walk starts at the kernel_start with the lowest id. Slot order is
+// shuffled by every swap-remove, but the lowest id only changes when a
+// kernel_start is created or deleted, and both invalidate the kernel.
+static int FindKernelStart()
+{
+    int startId = -1;
+    for (size_t slot = 0; slot < nodes.size(); ++slot)
+    {
+        if (nodes.kinds[slot] == NodeKernelStart && (startId < 0 || nodes.ids[slot] < startId))
+            startId = nodes.ids[slot];
+    }
+    return startId;
+}
+
+// Advances the validation walk until it completes or the deadline passes.
+// Returns true once the cached program is up to date.
+bool StepKernelValidation(JobClock::time_point deadline)
+{
+    KernelValidation &state = kernelValidation;
+    KernelProgram &program = state.program;
+
+    state.positions.resize(nodeIds.slots.size(), -1);
+
+    if (state.dirty)
+    {
+        if (state.dirtyFrom == 0 || !program.hasStart)
+        {
+            // Cleared rather than replaced, so a walk over a large graph
+            // does not regrow its arrays from scratch.
+            program.hasStart = false;
+            program.reachesEnd = false;
+            program.brokenNode = -1;
+            program.order.clear();
+            state.stack.clear();
+            state.stackTops.clear();
+            state.stackSizes.clear();
+            state.top = -1;
+            state.expanding = -1;
+
+            int startId = FindKernelStart();
+            if (startId >= 0)
+            {
+                program.hasStart = true;
+                PushKernelNode(startId);
+            }
+        }
+        else
+        {
+            ResumeKernelWalk();
+        }
+
+        state.dirty = false;
+        state.walking = true;
+    }
+
+    if (!state.walking)
+        return true;
+
+    // Depth-first preorder with an explicit stack, as the recursive walk
+    // did. Every pop and every push is one step.
+    unsigned steps = 0;
+    while (state.expanding >= 0 || state.top >= 0)
+    {
+        if (++steps % kJobClockCheckInterval == 0 && JobClock::now() >= deadline)
+            return false;
+
+        if (state.expanding >= 0)
+        {
+            ExpandKernelNode();
+            continue;
+        }
+
+        int id = state.stack[state.top].id;
+        state.top = state.stack[state.top].below;
+        if (NodeSlot(id) < 0 || KernelPosition(id) >= 0)
+            continue;
+
+        state.positions[id] = static_cast<int>(program.order.size());
+        program.order.push_back(id);
+        state.stackTops.push_back(state.top);
+        state.stackSizes.push_back(static_cast<uint32_t>(state.stack.size()));
+        EnterKernelNode(id);
+    }
+
+    state.walking = false;
+    return true;
+}
+
+const KernelProgram &CompileKernel()
+{
+    StepKernelValidation(JobClock::time_point::max());
+    return kernelValidation.program;
+}
+
+bool KernelPathIsValid(const KernelProgram &program)
+{
+    if (!program.hasStart)
+    {
+        std::cout << "kernel_start not found!\n";
+        return false;
+    }
+
+    return program.reachesEnd;
+}
+
+// Appends the code of the validated order to assemblerEmit.text, picking up
+// after the last position still intact. Returns true once the text is
+// complete.
+bool StepAssemblerEmit(JobClock::time_point deadline)
+{
+    const KernelProgram &program = kernelValidation.program;
+    std::string &text = assemblerEmit.text;
+
+    if (assemblerEmit.offsets.empty())
+        text = kAssemblerHeader;
+
+    unsigned steps = 0;
+    for (size_t position = assemblerEmit.offsets.size(); position < program.order.size(); ++position)
+    {
+        if (++steps % kJobClockCheckInterval == 0 && JobClock::now() >= deadline)
+            return false;
+
+        assemblerEmit.offsets.push_back(text.size());
+        int id = program.order[position];
+        const NodeKindInfo &info = KindInfo(KindOf(id));
+
+        if (info.emit != nullptr)
+            info.emit(id, text);
+    }
+
+    return true;
+}
+
+// FNV-1a.
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t HashNode(uint64_t hash, int id)
+{
+    NodeKind kind = KindOf(id);
+    std::string_view text = NodeText(id);
+    uint32_t length = static_cast<uint32_t>(text.size());
+    hash = HashBytes(hash, &kind, sizeof(kind));
+    hash = HashBytes(hash, &length, sizeof(length));
+    return HashBytes(hash, text.data(), text.size());
+}
+
+// Hash of the validated order's kinds and texts, which is all the output
+// depends on. Prefix hashes are kept until an edit rewinds emission past
+// them, so only the order from the edit on is hashed again.
+bool StepKernelContentHash(JobClock::time_point deadline)
+{
+    const std::vector<int> &order = kernelValidation.program.order;
+    std::vector<uint64_t> &hashes = kernelBuild.contentHashes;
+    if (hashes.size() > order.size())
+        hashes.resize(order.size());
+
+    uint64_t hash = hashes.empty() ? kHashSeed : hashes.back();
+    size_t steps = 0;
+    for (size_t position = hashes.size(); position < order.size(); ++position)
+    {
+        if (++steps % kJobClockCheckInterval == 0 && JobClock::now() >= deadline)
+            return false;
+        hash = HashNode(hash, order[position]);
+        hashes.push_back(hash);
+    }
+    return true;
+}
+
+uint64_t KernelContentHash()
+{
+    StepKernelContentHash(JobClock::time_point::max());
+    return kernelBuild.contentHashes.empty() ? kHashSeed : kernelBuild.contentHashes.back();
+}
+
+bool KernelSourceSaved()
+{
+    return kernelBuild.saved && kernelBuild.savedHash == KernelContentHash();
+}
+
+bool WriteFileBytes(const std::string &path, const void *data, size_t size)
+{
+    std::ofstream outFile(path, std::ios::binary);
+    outFile.write(static_cast<const char *>(data), size);
+    outFile.close();
+    return !outFile.fail();
+}
+
+void WriteAssembler()
+{
+    WriteFileBytes("kernel.asm", assemblerEmit.text.data(), assemblerEmit.text.size());
+    kernelBuild.savedHash = KernelContentHash();
+    kernelBuild.saved = true;
+    std::cout << "Code saved!\n";
+}
+
+void SaveNodesToAssembler()
+{
+    const KernelProgram &program = CompileKernel();
+
+    if (!KernelPathIsValid(program))
+    {
+        std::cout << "Code is not valid!\n";
+        return;
+    }
+
+    StepAssemblerEmit(JobClock::time_point::max());
+    WriteAssembler();
+}
+
+void WriteKernelImage(const std::vector<uint8_t> &image)
+{
+    WriteFileBytes("kernel.bin", image.data(), image.size());
+}
+
+std::string DescribeAssemblerError(int nodeId, const AsmError &error)
+{
+    if (nodeId < 0)
+        return "Assembler error: " + error.message;
+    std::string where = "Assembler error in node " + std::to_string(nodeId);
+    if (error.line > 0)
+        where += " line " + std::to_string(error.line);
+    return where + ": " + error.message;
+}
+
+static void BeginKernelImage()
+{
+    if (!kernelBuild.headerReady)
+    {
+        std::string scope;
+        AsmError error;
+        AssembleFragment(kAssemblerHeader, scope, kernelBuild.header, error);
+        kernelBuild.headerReady = true;
+    }
+
+    if (kernelBuild.nodeCode.size() < nodeIds.generations.size())
+        kernelBuild.nodeCode.resize(nodeIds.generations.size());
+
+    kernelBuild.stepPosition = 0;
+    kernelBuild.stepScope.clear();
+    kernelBuild.stepMinimumSize = FragmentMinimumSize(kernelBuild.header);
+}
+
+// Encodes the node at stepPosition unless its code key is unchanged. A
+// kernel that reaches kernel_end fails here once the code so far cannot
+// fit the boot sector, before the rest is encoded or anything is linked.
+static bool EncodeNextKernelNode(const KernelProgram &program, std::string &source, int &errorNode, AsmError &error)
+{
+    int id = program.order[kernelBuild.stepPosition];
+    NodeCode &code = kernelBuild.nodeCode[id];
+    const std::string &scope = kernelBuild.stepScope;
+    uint64_t key = HashBytes(HashNode(kHashSeed, id), scope.data(), scope.size());
+
+    if (!code.valid || code.key != key)
+    {
+        source.clear();
+        const NodeKindInfo &info = KindInfo(KindOf(id));
+        if (info.emit != nullptr)
+            info.emit(id, source);
+
+        code.scopeOut = scope;
+        code.valid = AssembleFragment(source, code.scopeOut, code.fragment, error);
+        if (!code.valid)
+        {
+            errorNode = id;
+            return false;
+        }
+        code.key = key;
+        code.minimumSize = FragmentMinimumSize(code.fragment);
+    }
+
+    kernelBuild.stepScope = code.scopeOut;
+    kernelBuild.stepMinimumSize += code.minimumSize;
+    if (program.reachesEnd && kernelBuild.stepMinimumSize > kBootSectorSize)
+    {
+        errorNode = id;
+        error = AsmError();
+        error.message = "code passes the " + std::to_string(kBootSectorSize) + "-byte boot sector";
+        return false;
+    }
+
+    ++kernelBuild.stepPosition;
+    return true;
+}
+
+static bool LinkKernelImage(const KernelProgram &program, int &errorNode, AsmError &error)
+{
+    std::vector<const AsmFragment *> fragments;
+    fragments.reserve(program.order.size() + 1);
+    fragments.push_back(&kernelBuild.header);
+    for (int id : program.order)
+        fragments.push_back(&kernelBuild.nodeCode[id].fragment);
+
+    if (!LinkFragments(fragments, kernelBuild.image, error))
+    {
+        errorNode = error.fragment > 0 ? program.order[error.fragment - 1] : -1;
+        return false;
+    }
+    return true;
+}
+
+// Re-encodes only the nodes whose code key changed, then relinks every
+// fragment into kernelBuild.image. The relink recomputes label addresses
+// and the times padding, which is cheap next to encoding. On failure
+// errorNode is the node at fault, or -1 for the header.
+bool AssembleKernelImage(const KernelProgram &program, int &errorNode, AsmError &error)
+{
+    kernelBuild.stepping = false;
+    BeginKernelImage();
+
+    std::string source;
+    while (kernelBuild.stepPosition < program.order.size())
+    {
+        if (!EncodeNextKernelNode(program, source, errorNode, error))
+            return false;
+    }
+    return LinkKernelImage(program, errorNode, error);
+}
+
+// Brings kernelBuild.image up to date with the validated program.
+bool UpdateKernelImage(const KernelProgram &program, std::string &error)
+{
+    bool ok = false;
+    StepKernelImage(program, JobClock::time_point::max(), ok, error);
+    return ok;
+}
+
+bool StepKernelImage(const KernelProgram &program, JobClock::time_point deadline, bool &ok, std::string &error)
+{
+    if (!StepKernelContentHash(deadline))
+        return false;
+
+    uint64_t hash = KernelContentHash();
+    ok = kernelBuild.imageBuilt && kernelBuild.imageHash == hash;
+    if (ok)
+        return true;
+
+    if (!kernelBuild.stepping)
+    {
+        BeginKernelImage();
+        kernelBuild.stepping = true;
+    }
+
+    int errorNode = -1;
+    AsmError asmError;
+    std::string source;
+    size_t steps = 0;
+    bool encoded = true;
+    while (encoded && kernelBuild.stepPosition < program.order.size())
+    {
+        if (++steps % kJobClockCheckInterval == 0 && JobClock::now() >= deadline)
+            return false;
+        encoded = EncodeNextKernelNode(program, source, errorNode, asmError);
+    }
+
+    // The link walks every fragment in one go, so it starts a slice of
+    // its own unless the encoding above was short.
+    if (encoded && steps >= kJobClockCheckInterval && JobClock::now() >= deadline)
+        return false;
+
+    kernelBuild.stepping = false;
+    kernelBuild.imageBuilt = encoded && LinkKernelImage(program, errorNode, asmError);
+    if (!kernelBuild.imageBuilt)
+    {
+        error = DescribeAssemblerError(errorNode, asmError);
+        return true;
+    }
+    kernelBuild.imageHash = hash;
+    ok = true;
+    return true;
+}
+
+// Links in the order both file formats save them: by the slot of their start
+// node, then in creation order on each pin. Link slots are shuffled by
+// removals, but this order keeps each pin's outgoing list, and with it the
+// validator's visit order, the same after a reload.
+static std::vector<LinkId> SavedLinkOrder()
+{
+    std::vector<LinkId> order;
+    order.reserve(links.size());
+    for (int id : nodes.ids)
+    {
+        PinId pin = OutputPin(id);
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+            order.push_back(link);
+    }
+    return order;
+}
+
+// Text graph format, one record per line:
+//
+//   tkg 1
+//   node <id> <kind> <x> <y> <text>
+//   link <from id> <to id>
+//
+// The text runs to the end of the line with '\\', '\n', '\r' and '\t'
+// escaped. A link joins the output pin of one node to the input of another.
+constexpr int kGraphFileVersion = 1;
+
+static void AppendEscaped(std::string &out, std::string_view text)
+{
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += c;
+            break;
+        }
+    }
+}
+
+static void AppendUnescaped(std::vector<char> &out, std::string_view text)
+{
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] != '\\' || i + 1 == text.size())
+        {
+            out.push_back(text[i]);
+            continue;
+        }
+
+        char c = text[++i];
+        out.push_back(c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c);
+    }
+}
+
+static bool SaveTextGraph(const std::string &path, std::string &error)
+{
+    std::string out = "tkg " + std::to_string(kGraphFileVersion) + "\n";
+
+    char position[64];
+    for (size_t slot = 0; slot < nodes.size(); ++slot)
+    {
+        int id = nodes.ids[slot];
+        snprintf(position, sizeof(position), " %.9g %.9g ", nodes.positions[slot].x, nodes.positions[slot].y);
+        out += "node " + std::to_string(id) + " " + KindInfo(nodes.kinds[slot]).name + position;
+        AppendEscaped(out, NodeText(id));
+        out += "\n";
+    }
+
+    for (LinkId link : SavedLinkOrder())
+    {
+        int slot = linkIds.slots[link];
+        out += "link " + std::to_string(PinNodeId(links.starts[slot])) + " " + std::to_string(PinNodeId(links.ends[slot])) + "\n";
+    }
+
+    if (!WriteFileBytes(path, out.data(), out.size()))
+    {
+        error = "could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Parses a .tkg file already read into memory. Nodes and links are
+// collected in file order and the graph is built from them in one go, the
+// way LoadProject() does.
+static bool LoadTextGraph(const std::string &path, const char *data, size_t size, std::string &error)
+{
+    ClearGraph();
+
+    std::unordered_map<int, int> idMap;
+    idMap.reserve(std::count(data, data + size, '\n') + 1);
+    std::vector<std::pair<uint32_t, uint32_t>> fileLinks;
+    std::string line;
+    int lineNumber = 0;
+    auto fail = [&](const std::string &message)
+    {
+        error = path + ":" + std::to_string(lineNumber) + ": " + message;
+        ClearGraph();
+        return false;
+    };
+
+    const char *end = data + size;
+    for (const char *cursor = data; cursor < end;)
+    {
+        const char *newline = static_cast<const char *>(memchr(cursor, '\n', end - cursor));
+        const char *lineEnd = newline != nullptr ? newline : end;
+        line.assign(cursor, lineEnd);
+        cursor = newline != nullptr ? newline + 1 : end;
+
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        char record[8] = {};
+        int consumed = 0;
+        if (lineNumber == 1)
+        {
+            int version = 0;
+            if (sscanf(line.c_str(), "tkg %d%n", &version, &consumed) != 1 || version != kGraphFileVersion)
+                return fail("not a version " + std::to_string(kGraphFileVersion) + " tkg file");
+            continue;
+        }
+        if (sscanf(line.c_str(), "%7s%n", record, &consumed) != 1)
+            return fail("malformed record");
+
+        if (std::string_view(record) == "node")
+        {
+            int fileId;
+            char kindName[32];
+            NodePosition position;
+            if (sscanf(line.c_str(), "node %d %31s %f %f%n", &fileId, kindName, &position.x, &position.y, &consumed) != 4)
+                return fail("malformed node");
+
+            int kind = 0;
+            while (kind < NodeKindCount && std::string_view(KindInfo(static_cast<NodeKind>(kind)).name) != kindName)
+                ++kind;
+            if (kind == NodeKindCount)
+                return fail(std::string("unknown node kind '") + kindName + "'");
+            if (nodes.kinds.size() >= static_cast<size_t>(kMaxNodeIds))
+                return fail("too many nodes");
+            if (!idMap.emplace(fileId, static_cast<int>(nodes.kinds.size())).second)
+                return fail("duplicate node id " + std::to_string(fileId));
+
+            std::string_view text(line);
+            text.remove_prefix(std::min<size_t>(consumed + 1, text.size()));
+            size_t offset = textArena.bytes.size();
+            AppendUnescaped(textArena.bytes, text);
+
+            nodes.kinds.push_back(static_cast<NodeKind>(kind));
+            nodes.texts.push_back(TextRef{static_cast<uint32_t>(offset), static_cast<uint32_t>(textArena.bytes.size() - offset)});
+            nodes.positions.push_back(position);
+        }
+        else if (std::string_view(record) == "link")
+        {
+            int from;
+            int to;
+            if (sscanf(line.c_str(), "link %d %d", &from, &to) != 2)
+                return fail("malformed link");
+
+            auto fromIt = idMap.find(from);
+            auto toIt = idMap.find(to);
+            if (fromIt == idMap.end() || toIt == idMap.end())
+                return fail("link refers to an unknown node");
+            if (fromIt->second == toIt->second || !KindsCanLink(nodes.kinds[fromIt->second], nodes.kinds[toIt->second]))
+                return fail("link between pins that cannot be linked");
+            fileLinks.emplace_back(fromIt->second, toIt->second);
+        }
+        else
+        {
+            return fail(std::string("unknown record '") + record + "'");
+        }
+    }
+
+    if (lineNumber == 0)
+        return fail("empty file");
+
+    AdoptLoadedNodes();
+    links.starts.resize(fileLinks.size());
+    links.ends.resize(fileLinks.size());
+    for (size_t i = 0; i < fileLinks.size(); ++i)
+    {
+        links.starts[i] = OutputPin(static_cast<int>(fileLinks[i].first));
+        links.ends[i] = InputPin(static_cast<int>(fileLinks[i].second));
+    }
+    if (!AdoptLoadedLinks())
+    {
+        ClearGraph();
+        error = path + ": duplicate link";
+        return false;
+    }
+    return true;
+}
+
+// Binary project format (.tkp). A fixed header is followed by three tables
+// at the offsets it records: one ProjectNode per node, one ProjectLink per
+// link and the node texts back to back. Nodes are stored in slot order and
+// referred to by their index, so loading maps them to ids 0..n-1 without a
+// lookup table. Fields are little-endian in the host layout; the file is
+// mapped and its tables copied straight into the node store.
+constexpr char kProjectMagic[4] = {'T', 'K', 'P', '\0'};
+constexpr uint32_t kProjectVersion = 1;
+
+struct ProjectHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t linkCount;
+    uint32_t textSize;
+    uint32_t nodeTable;
+    uint32_t linkTable;
+    uint32_t textTable;
+};
+
+struct ProjectNode
+{
+    uint8_t kind;
+    uint8_t reserved[3];
+    TextRef text;
+    NodePosition position;
+};
+
+// Output pin of node from to input pin of node to.
+struct ProjectLink
+{
+    uint32_t from;
+    uint32_t to;
+};
+
+static_assert(sizeof(ProjectHeader) == 32, "ProjectHeader layout changed");
+static_assert(sizeof(ProjectNode) == 20, "ProjectNode layout changed");
+static_assert(sizeof(ProjectLink) == 8, "ProjectLink layout changed");
+
+static bool IsProjectFile(const void *data, size_t size)
+{
+    return size >= sizeof(kProjectMagic) && memcmp(data, kProjectMagic, sizeof(kProjectMagic)) == 0;
+}
+
+static bool TableFits(uint64_t offset, uint64_t count, uint64_t recordSize, uint64_t fileSize)
+{
+    return offset % alignof(uint32_t) == 0 && offset <= fileSize && count * recordSize <= fileSize - offset;
+}
+
+void SnapshotGraph(GraphSnapshot &snapshot)
+{
+    GraphClip &graph = snapshot.graph;
+    graph.kinds = nodes.kinds;
+    graph.texts = nodes.texts;
+    graph.positions = nodes.positions;
+    graph.text.assign(textArena.bytes.data(), textArena.bytes.size());
+
+    graph.links.resize(links.size());
+    for (size_t slot = 0; slot < links.size(); ++slot)
+    {
+        graph.links[slot].first = static_cast<uint32_t>(nodeIds.slots[PinNodeId(links.starts[slot])]);
+        graph.links[slot].second = static_cast<uint32_t>(nodeIds.slots[PinNodeId(links.ends[slot])]);
+    }
+    snapshot.linkSerials = links.serials;
+}
+
+// Links go out in SavedLinkOrder(), rebuilt from the snapshot: by start node
+// slot, then by serial, which is each pin's list order.
+bool EncodeProject(const GraphSnapshot &snapshot, std::vector<char> &buffer, std::string &error)
+{
+    const GraphClip &graph = snapshot.graph;
+    uint64_t textSize = 0;
+    for (const TextRef &text : graph.texts)
+        textSize += text.length;
+
+    ProjectHeader header = {};
+    memcpy(header.magic, kProjectMagic, sizeof(kProjectMagic));
+    header.version = kProjectVersion;
+    header.nodeCount = static_cast<uint32_t>(graph.size());
+    header.linkCount = static_cast<uint32_t>(graph.links.size());
+    header.textSize = static_cast<uint32_t>(textSize);
+    header.nodeTable = sizeof(ProjectHeader);
+    header.linkTable = header.nodeTable + header.nodeCount * sizeof(ProjectNode);
+    header.textTable = header.linkTable + header.linkCount * sizeof(ProjectLink);
+
+    uint64_t fileSize = sizeof(ProjectHeader) + uint64_t(graph.size()) * sizeof(ProjectNode) +
+                        uint64_t(graph.links.size()) * sizeof(ProjectLink) + textSize;
+    if (fileSize > UINT32_MAX)
+    {
+        error = "project too large";
+        return false;
+    }
+
+    buffer.assign(fileSize, 0);
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    ProjectNode *nodeTable = reinterpret_cast<ProjectNode *>(buffer.data() + header.nodeTable);
+    char *textTable = buffer.data() + header.textTable;
+    uint32_t textOffset = 0;
+    for (size_t i = 0; i < graph.size(); ++i)
+    {
+        const TextRef &text = graph.texts[i];
+        ProjectNode &record = nodeTable[i];
+        record.kind = graph.kinds[i];
+        record.text = TextRef{textOffset, text.length};
+        record.position = graph.positions[i];
+        memcpy(textTable + textOffset, graph.text.data() + text.offset, text.length);
+        textOffset += text.length;
+    }
+
+    std::vector<uint32_t> order(graph.links.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<uint32_t>(i);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return graph.links[a].first != graph.links[b].first ? graph.links[a].first < graph.links[b].first
+                                                                    : snapshot.linkSerials[a] < snapshot.linkSerials[b]; });
+
+    ProjectLink *linkTable = reinterpret_cast<ProjectLink *>(buffer.data() + header.linkTable);
+    for (size_t i = 0; i < order.size(); ++i)
+        linkTable[i] = ProjectLink{graph.links[order[i]].first, graph.links[order[i]].second};
+    return true;
+}
+
+bool WriteFileAtomic(const std::string &path, const void *data, size_t size, std::string &error)
+{
+    std::string temporaryPath = path + ".tmp";
+    int fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error = "could not create " + temporaryPath + ": " + strerror(errno);
+        return false;
+    }
+
+    const char *bytes = static_cast<const char *>(data);
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t count = write(fd, bytes + written, size - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        written += static_cast<size_t>(count);
+    }
+
+    bool ok = written == size && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        error = "could not write " + path + ": " + strerror(errno);
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool SaveProject(const std::string &path, std::string &error)
+{
+    GraphSnapshot snapshot;
+    SnapshotGraph(snapshot);
+    std::vector<char> buffer;
+    if (!EncodeProject(snapshot, buffer, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    return WriteFileAtomic(path, buffer.data(), buffer.size(), error);
+}
+
+// Fills the graph from a mapped project. The node arrays, id tables, links
+// and text arena are each sized once and filled in a single pass, and the
+// grid and the index are then built in one pass each.
+bool LoadProject(const std::string &path, const char *data, size_t size, std::string &error)
+{
+    if (size < sizeof(ProjectHeader))
+    {
+        error = path + ": truncated project header";
+        return false;
+    }
+
+    ProjectHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (!IsProjectFile(data, size))
+    {
+        error = path + ": not a project file";
+        return false;
+    }
+    if (header.version != kProjectVersion)
+    {
+        error = path + ": unsupported project version " + std::to_string(header.version);
+        return false;
+    }
+    if (header.nodeCount > static_cast<uint32_t>(kMaxNodeIds) ||
+        !TableFits(header.nodeTable, header.nodeCount, sizeof(ProjectNode), size) ||
+        !TableFits(header.linkTable, header.linkCount, sizeof(ProjectLink), size) ||
+        !TableFits(header.textTable, header.textSize, 1, size))
+    {
+        error = path + ": corrupt project tables";
+        return false;
+    }
+
+    const ProjectNode *nodeTable = reinterpret_cast<const ProjectNode *>(data + header.nodeTable);
+    const ProjectLink *linkTable = reinterpret_cast<const ProjectLink *>(data + header.linkTable);
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+        const ProjectNode &record = nodeTable[i];
+        if (record.kind >= NodeKindCount || record.text.offset > header.textSize ||
+            record.text.length > header.textSize - record.text.offset)
+        {
+            error = path + ": corrupt node " + std::to_string(i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.linkCount; ++i)
+    {
+        const ProjectLink &link = linkTable[i];
+        if (link.from >= header.nodeCount || link.to >= header.nodeCount || link.from == link.to ||
+            !KindsCanLink(static_cast<NodeKind>(nodeTable[link.from].kind), static_cast<NodeKind>(nodeTable[link.to].kind)))
+        {
+            error = path + ": corrupt link " + std::to_string(i);
+            return false;
+        }
+    }
+
+    ClearGraph();
+
+    size_t count = header.nodeCount;
+    nodes.kinds.resize(count);
+    nodes.texts.resize(count);
+    nodes.positions.resize(count);
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+        const ProjectNode &record = nodeTable[slot];
+        nodes.kinds[slot] = static_cast<NodeKind>(record.kind);
+        nodes.texts[slot] = record.text;
+        nodes.positions[slot] = record.position;
+    }
+
+    const char *textTable = data + header.textTable;
+    textArena.bytes.assign(textTable, textTable + header.textSize);
+    AdoptLoadedNodes();
+
+    links.starts.resize(header.linkCount);
+    links.ends.resize(header.linkCount);
+    for (uint32_t i = 0; i < header.linkCount; ++i)
+    {
+        links.starts[i] = OutputPin(static_cast<int>(linkTable[i].from));
+        links.ends[i] = InputPin(static_cast<int>(linkTable[i].to));
+    }
+    if (!AdoptLoadedLinks())
+    {
+        ClearGraph();
+        error = path + ": duplicate link";
+        return false;
+    }
+    return true;
+}
+
+static bool HasExtension(const std::string &path, std::string_view extension)
+{
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool SaveGraph(const std::string &path, std::string &error)
+{
+    if (HasExtension(path, ".tkp"))
+        return SaveProject(path, error);
+    return SaveTextGraph(path, error);
+}
+
+bool LoadGraph(const std::string &path, std::string &error)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        error = "could not open " + path;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        error = "could not stat " + path + ": " + strerror(errno);
+        return false;
+    }
+    if (info.st_size == 0)
+    {
+        close(fd);
+        return LoadTextGraph(path, nullptr, 0, error);
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        error = "could not map " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    bool ok = IsProjectFile(data, size) ? LoadProject(path, static_cast<const char *>(data), size, error)
+                                        : LoadTextGraph(path, static_cast<const char *>(data), size, error);
+    munmap(data, size);
+    return ok;
+}
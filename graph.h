@@ -0,0 +1,436 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "assembler.h"
+
+// The node graph and everything derived from it: storage, validation, asm
+// emission and the in-process kernel build. Nothing here depends on ImGui,
+// GLFW or GL, so the editor and the tkit command line share it.
+
+enum NodeKind : uint8_t
+{
+    NodeKernelStart,
+    NodeKernelEnd,
+    NodePrintChar,
+    NodeInstruction,
+    NodeKindCount
+};
+
+struct NodeHandle
+{
+    int id;
+    uint32_t generation;
+};
+
+// Pin ids pack the owning node id, the pin slot on that node and the pin
+// direction into one integer. The low 31 bits are what ImNodes sees as the
+// attribute id; the node generation sits in the high 32 bits so a pin kept
+// across a delete never matches the node that reuses the id.
+typedef uint64_t PinId;
+
+enum PinDirection
+{
+    PinInput = 0,
+    PinOutput = 1
+};
+
+constexpr int kPinDirectionBits = 1;
+constexpr int kPinSlotBits = 2;
+constexpr int kPinNodeShift = kPinDirectionBits + kPinSlotBits;
+constexpr int kMaxNodeIds = 1 << (31 - kPinNodeShift);
+
+inline PinId MakePinId(int nodeId, uint32_t generation, int pinSlot, PinDirection direction)
+{
+    return (static_cast<PinId>(generation) << 32) | (static_cast<PinId>(nodeId) << kPinNodeShift) |
+           (static_cast<PinId>(pinSlot) << kPinDirectionBits) | static_cast<PinId>(direction);
+}
+
+inline int PinAttr(PinId pin) { return static_cast<int>(pin & 0x7FFFFFFF); }
+inline int PinNodeId(PinId pin) { return PinAttr(pin) >> kPinNodeShift; }
+inline int PinSlot(PinId pin) { return (PinAttr(pin) >> kPinDirectionBits) & ((1 << kPinSlotBits) - 1); }
+inline PinDirection PinDirectionOf(PinId pin) { return static_cast<PinDirection>(pin & 1); }
+
+// Node text (the print_char letter, the instruction source) lives in one
+// shared buffer and nodes refer to it by offset and length. Rewrites that do
+// not fit in place append and leave garbage behind, which is reclaimed once
+// it makes up half the buffer.
+struct TextRef
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct TextArena
+{
+    std::vector<char> bytes;
+    size_t garbage = 0;
+};
+
+constexpr size_t kTextArenaMinCompact = 64 * 1024;
+
+// Grid-space position of a node's top-left corner. nodes.positions is the
+// authoritative copy: the editor only hands ImNodes the nodes in view and
+// writes their positions back after every frame.
+struct NodePosition
+{
+    float x;
+    float y;
+};
+
+// Nodes are stored as parallel arrays indexed by slot. Per-frame loops and
+// the validator only read ids and kinds; text is touched when a node is
+// drawn with its widgets or emitted.
+struct NodeStore
+{
+    std::vector<int> ids;
+    std::vector<NodeKind> kinds;
+    std::vector<TextRef> texts;
+    std::vector<NodePosition> positions;
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+};
+
+struct NodeIdAllocator
+{
+    std::vector<uint32_t> generations;
+    std::vector<int> slots;
+    std::vector<int> freeIds;
+};
+
+// Links keep their id, which is also their ImNodes id, for as long as they
+// exist; ids of removed links are reused. Link data is stored by slot like
+// the nodes, and removing a link moves the last one into its slot.
+typedef int LinkId;
+
+struct LinkStore
+{
+    std::vector<LinkId> ids;
+    std::vector<PinId> starts;
+    std::vector<PinId> ends;
+
+    // Creation order, which is also the order of each pin's outgoing list.
+    std::vector<uint64_t> serials;
+    uint64_t nextSerial = 0;
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+};
+
+struct LinkIdAllocator
+{
+    std::vector<int> slots;
+    std::vector<LinkId> freeIds;
+};
+
+// Links by pin, as doubly linked lists threaded through the link ids. A node
+// has one pin of each direction, so the lists are headed by node id: the
+// output pin's holds the links starting there, the input pin's the links
+// ending there. Lists stay in creation order, which is the order the
+// validator visits targets in, and adding or removing a link is O(1).
+struct PinLinkList
+{
+    LinkId first = -1;
+    LinkId last = -1;
+    uint32_t size = 0;
+};
+
+struct LinkListEntry
+{
+    LinkId previous = -1;
+    LinkId next = -1;
+};
+
+struct GraphIndex
+{
+    std::vector<PinLinkList> outgoing;
+    std::vector<PinLinkList> incoming;
+    std::vector<LinkListEntry> outgoingEntries;
+    std::vector<LinkListEntry> incomingEntries;
+};
+
+// Uniform grid over node positions for viewport queries. A node is filed
+// under the cell holding its position. Each cell is a doubly linked list of
+// node ids threaded through next and previous, and cells maps the packed
+// coordinates of every occupied cell to its first node, so empty canvas
+// costs nothing and moving or removing a node is O(1). cellOf, next and
+// previous are by node id.
+constexpr float kNodeGridCellSize = 512.0f;
+
+struct NodeGrid
+{
+    std::unordered_map<uint64_t, int> cells;
+    std::vector<uint64_t> cellOf;
+    std::vector<int> next;
+    std::vector<int> previous;
+};
+
+// Nodes and the links among them, detached from the graph for copy, paste
+// and duplicate. Text is packed into one string, and links name their two
+// nodes by index into the clip.
+struct GraphClip
+{
+    std::vector<NodeKind> kinds;
+    std::vector<TextRef> texts;
+    std::vector<NodePosition> positions;
+    std::vector<std::pair<uint32_t, uint32_t>> links;
+    std::string text;
+
+    size_t size() const { return kinds.size(); }
+    bool empty() const { return kinds.empty(); }
+};
+
+// Linear IR produced by CompileKernel(): node ids in the order their code is
+// emitted, starting at the kernel_start with the lowest id and ending at the
+// first kernel_end reached.
+struct KernelProgram
+{
+    bool hasStart = false;
+    bool reachesEnd = false;
+    int brokenNode = -1;
+    std::vector<int> order;
+};
+
+// One entry of the validation walk's stack. The stack is a linked list in a
+// pool that only grows during a walk, so the stack as it stood at any point
+// stays reachable from that point's top.
+struct KernelStackEntry
+{
+    int id;
+    int below;
+};
+
+// Cached traversal state behind CompileKernel(). Edits only invalidate the
+// part of the order that follows the first node whose outgoing links
+// changed. stackTops and stackSizes record, for every position, the stack
+// top and pool size right after that node was taken off the stack, so the
+// walk resumes there by truncating and pushing the node's successors again,
+// at a cost that follows the edit rather than the node's depth.
+// positions[id] is only meaningful while order[positions[id]] == id, which
+// lets truncation leave it alone.
+struct KernelValidation
+{
+    KernelProgram program;
+    std::vector<int> positions;
+    std::vector<KernelStackEntry> stack;
+    std::vector<int> stackTops;
+    std::vector<uint32_t> stackSizes;
+    int top = -1;
+    int expanding = -1;
+    LinkId expandLink = -1;
+    size_t dirtyFrom = 0;
+    bool dirty = true;
+    bool walking = false;
+};
+
+// kernel.asm text emitted from the validated order. offsets[i] is the text
+// length before order[i], so an edit at position i only discards the text
+// from there on.
+struct AssemblerEmit
+{
+    std::string text;
+    std::vector<size_t> offsets;
+    bool requested = false;
+};
+
+// Machine code of one node. key hashes everything the bytes depend on: the
+// node's kind and text and the label scope it inherits from the node before
+// it. Fragments are position independent, so a node that only moves in the
+// order keeps its code and the relink places it.
+struct NodeCode
+{
+    uint64_t key = 0;
+    bool valid = false;
+    std::string scopeOut;
+    AsmFragment fragment;
+    size_t minimumSize = 0;
+};
+
+// Incremental kernel.bin build. nodeCode is indexed by node id. The content
+// hash covers the emitted order and lets Save and Run skip work when nothing
+// that reaches the output has changed since the last write; contentHashes[i]
+// is the hash up to and including order[i], so an edit only rehashes from
+// where it was made. imageHash is the content behind image in memory,
+// writtenHash the one behind kernel.bin on disk; the preview rebuilds the
+// former without touching the latter. The step fields are the progress of
+// a budgeted build, dropped by any edit that rewinds emission: the next
+// position to encode, the label scope it inherits and the fewest bytes the
+// code before it links to.
+struct KernelBuild
+{
+    std::vector<NodeCode> nodeCode;
+    AsmFragment header;
+    bool headerReady = false;
+    std::vector<uint8_t> image;
+    std::vector<uint64_t> contentHashes;
+    uint64_t imageHash = 0;
+    bool imageBuilt = false;
+    uint64_t writtenHash = 0;
+    bool written = false;
+    uint64_t savedHash = 0;
+    bool saved = false;
+
+    size_t stepPosition = 0;
+    std::string stepScope;
+    size_t stepMinimumSize = 0;
+    bool stepping = false;
+};
+
+// A kernel that reaches kernel_end pads itself to this size, so code that
+// cannot fit is rejected before it is linked.
+constexpr size_t kBootSectorSize = 512;
+
+// Everything the editor, the validator and the emitter need to know about a
+// node kind, minus the widgets, which stay next to the editor's drawing
+// code. Pins with a null label are not present on that kind.
+struct NodeKindInfo
+{
+    const char *name;
+    const char *addLabel;
+    const char *inputLabel;
+    const char *outputLabel;
+    bool endsKernel;
+    void (*init)(int id);
+    void (*emit)(int id, std::string &text);
+};
+
+constexpr const char *kAssemblerHeader = "org 0x7C00\nbits 16\n";
+constexpr uint64_t kHashSeed = 14695981039346656037ull;
+
+typedef std::chrono::steady_clock JobClock;
+
+constexpr double kFrameJobBudgetMs = 2.0;
+constexpr unsigned kJobClockCheckInterval = 256;
+
+extern NodeStore nodes;
+extern TextArena textArena;
+extern LinkStore links;
+extern LinkIdAllocator linkIds;
+extern NodeIdAllocator nodeIds;
+extern GraphIndex graphIndex;
+extern NodeGrid nodeGrid;
+extern KernelValidation kernelValidation;
+extern AssemblerEmit assemblerEmit;
+extern KernelBuild kernelBuild;
+
+void InvalidateKernel();
+
+int NodeSlot(int id);
+NodeKind KindOf(int id);
+std::string_view NodeText(int id);
+void SetNodeText(int id, std::string_view text);
+
+// Moves a node, keeping nodes.positions and nodeGrid in step.
+void SetNodePosition(int id, NodePosition position);
+
+// Appends the nodes whose position lies in the rectangle [min, max].
+void QueryNodeGrid(NodePosition min, NodePosition max, std::vector<int> &ids);
+const NodeKindInfo &KindInfo(NodeKind kind);
+
+bool NodeExists(NodeHandle handle);
+PinId InputPin(int id);
+PinId OutputPin(int id);
+PinId PinFromAttr(int attr);
+int FindPinNode(PinId pin);
+
+int CreateNode(NodeKind kind);
+void DeleteNode(int id);
+
+// Deletes the nodes and every link touching them in one pass over the node
+// and link tables. Surviving nodes keep their relative order. Unknown ids
+// are skipped.
+void DeleteNodes(const std::vector<int> &ids);
+
+// Copies the nodes with their text and nodes.positions, and the links whose
+// two ends are both among them.
+void CopyNodes(const std::vector<int> &ids, GraphClip &clip);
+
+// Adds the clip's nodes, moved by offset, and its links. Returns the new
+// node ids in clip order.
+std::vector<int> PasteNodes(const GraphClip &clip, NodePosition offset);
+int LinkSlot(LinkId id);
+
+// A pin's links in creation order; a stale pin has none.
+//
+//   for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+//
+// LinkedPin() is the pin at the other end of the link.
+LinkId FirstPinLink(PinId pin);
+LinkId LastPinLink(PinId pin);
+LinkId NextPinLink(PinId pin, LinkId link);
+LinkId PreviousPinLink(PinId pin, LinkId link);
+uint32_t PinLinkCount(PinId pin);
+PinId LinkedPin(PinId pin, LinkId link);
+
+// Returns the link from startPin to endPin, or -1 if there is none.
+LinkId FindLink(PinId startPin, PinId endPin);
+
+// True if startPin is an output and endPin an input of two different live
+// nodes whose kinds have those pins. Duplicates are not checked here.
+bool CanLink(PinId startPin, PinId endPin);
+LinkId AddLink(PinId startPin, PinId endPin);
+void RemoveLink(LinkId id);
+
+// Removes every node and link and resets all derived state.
+void ClearGraph();
+
+bool StepKernelValidation(JobClock::time_point deadline);
+const KernelProgram &CompileKernel();
+bool KernelPathIsValid(const KernelProgram &program);
+bool StepAssemblerEmit(JobClock::time_point deadline);
+
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size);
+
+// Hashes the validated order a slice at a time; returns true once
+// KernelContentHash() is ready without further work.
+bool StepKernelContentHash(JobClock::time_point deadline);
+uint64_t KernelContentHash();
+bool KernelSourceSaved();
+
+bool WriteFileBytes(const std::string &path, const void *data, size_t size);
+
+// Writes to <path>.tmp, fsyncs and renames over path, so readers and a
+// crash mid-write only ever see the old or the new contents.
+bool WriteFileAtomic(const std::string &path, const void *data, size_t size, std::string &error);
+void WriteAssembler();
+void SaveNodesToAssembler();
+void WriteKernelImage(const std::vector<uint8_t> &image);
+
+std::string DescribeAssemblerError(int nodeId, const AsmError &error);
+bool AssembleKernelImage(const KernelProgram &program, int &errorNode, AsmError &error);
+bool UpdateKernelImage(const KernelProgram &program, std::string &error);
+
+// UpdateKernelImage() within a time budget, for the preview. Returns true
+// once the image is up to date or the build failed, with ok telling which;
+// otherwise the next call picks up where this one stopped.
+bool StepKernelImage(const KernelProgram &program, JobClock::time_point deadline, bool &ok, std::string &error);
+
+// Graph files: binary projects (.tkp) or the line-based text format (.tkg).
+// Saving picks the format from the extension, loading from the file's
+// magic. Loading replaces the current graph; node ids are reassigned and
+// positions land in nodes.positions.
+bool LoadGraph(const std::string &path, std::string &error);
+bool SaveGraph(const std::string &path, std::string &error);
+
+// The whole graph copied out as flat arrays, so that it can be encoded on
+// another thread: nodes in slot order with texts into a copy of the arena,
+// links in slot order with their serials.
+struct GraphSnapshot
+{
+    GraphClip graph;
+    std::vector<uint64_t> linkSerials;
+};
+
+void SnapshotGraph(GraphSnapshot &snapshot);
+
+// The .tkp encoding on its own, for callers that embed a project in another
+// file. data must stay 4-byte aligned; path only labels errors.
+bool EncodeProject(const GraphSnapshot &snapshot, std::vector<char> &buffer, std::string &error);
+bool LoadProject(const std::string &path, const char *data, size_t size, std::string &error);
@@ -0,0 +1,301 @@
+#include "job_runner.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+void ConsoleAppend(ConsoleBuffer &console, ConsoleLine line)
+{
+    if (console.lines.size() < kConsoleMaxLines)
+    {
+        console.lines.push_back(std::move(line));
+        return;
+    }
+
+    console.lines[console.start] = std::move(line);
+    console.start = (console.start + 1) % console.lines.size();
+}
+
+size_t ConsoleSize(const ConsoleBuffer &console)
+{
+    return console.lines.size();
+}
+
+const ConsoleLine &ConsoleLineAt(const ConsoleBuffer &console, size_t index)
+{
+    return console.lines[(console.start + index) % console.lines.size()];
+}
+
+void ConsoleClear(ConsoleBuffer &console)
+{
+    console.lines.clear();
+    console.start = 0;
+}
+
+namespace
+{
+    typedef std::chrono::steady_clock WorkerClock;
+
+    // One pipe end being read, with the tail of a line not yet terminated.
+    struct OutputStream
+    {
+        int fd = -1;
+        bool error = false;
+        std::string partial;
+    };
+
+    void Queue(JobRunner &runner, std::string text, bool error)
+    {
+        std::lock_guard<std::mutex> lock(runner.mutex);
+        runner.pending.push_back(ConsoleLine{std::move(text), error});
+    }
+
+    void QueueLines(JobRunner &runner, OutputStream &stream, const char *data, size_t size)
+    {
+        stream.partial.append(data, size);
+
+        size_t begin = 0;
+        size_t end;
+        while ((end = stream.partial.find('\n', begin)) != std::string::npos)
+        {
+            size_t length = end - begin;
+            if (length > 0 && stream.partial[end - 1] == '\r')
+                --length;
+            Queue(runner, stream.partial.substr(begin, length), stream.error);
+            begin = end + 1;
+        }
+        stream.partial.erase(0, begin);
+    }
+
+    // Reads whatever is available. Returns false once the write end closed.
+    bool DrainStream(JobRunner &runner, OutputStream &stream)
+    {
+        char buffer[4096];
+        for (;;)
+        {
+            ssize_t count = read(stream.fd, buffer, sizeof(buffer));
+            if (count > 0)
+            {
+                QueueLines(runner, stream, buffer, static_cast<size_t>(count));
+                continue;
+            }
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+
+            if (!stream.partial.empty())
+                Queue(runner, std::move(stream.partial), stream.error);
+            stream.partial.clear();
+            close(stream.fd);
+            stream.fd = -1;
+            return false;
+        }
+    }
+
+    bool OpenPipe(int fds[2])
+    {
+        if (pipe(fds) != 0)
+            return false;
+        for (int i = 0; i < 2; ++i)
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    std::string CommandLine(const JobCommand &command)
+    {
+        std::string text = "$";
+        for (const std::string &arg : command)
+            text += " " + arg;
+        return text;
+    }
+
+    // Spawns one command and pumps its output until it exits. Returns its
+    // exit code, or -1 when it could not be started or was signalled.
+    int RunCommand(JobRunner &runner, const JobCommand &command)
+    {
+        Queue(runner, CommandLine(command), false);
+
+        int outPipe[2];
+        int errPipe[2];
+        if (!OpenPipe(outPipe))
+        {
+            Queue(runner, "could not create pipe", true);
+            return -1;
+        }
+        if (!OpenPipe(errPipe))
+        {
+            close(outPipe[0]);
+            close(outPipe[1]);
+            Queue(runner, "could not create pipe", true);
+            return -1;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDERR_FILENO);
+
+        // Own process group, so cancelling also reaches anything the command
+        // started itself.
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attributes, 0);
+
+        std::vector<char *> argv;
+        for (const std::string &arg : command)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        int spawnError = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        close(outPipe[1]);
+        close(errPipe[1]);
+
+        OutputStream streams[2];
+        streams[0].fd = outPipe[0];
+        streams[1].fd = errPipe[0];
+        streams[1].error = true;
+
+        if (spawnError != 0)
+        {
+            close(outPipe[0]);
+            close(errPipe[0]);
+            Queue(runner, "could not start " + command[0] + ": " + strerror(spawnError), true);
+            return -1;
+        }
+
+        bool terminated = false;
+        WorkerClock::time_point killAt;
+        int status = 0;
+        for (;;)
+        {
+            if (runner.cancel && !terminated)
+            {
+                kill(-pid, SIGTERM);
+                terminated = true;
+                killAt = WorkerClock::now() + std::chrono::milliseconds(kJobKillGraceMs);
+            }
+            if (terminated && WorkerClock::now() >= killAt)
+            {
+                kill(-pid, SIGKILL);
+                killAt = WorkerClock::time_point::max();
+            }
+
+            pollfd fds[2];
+            nfds_t count = 0;
+            for (OutputStream &stream : streams)
+            {
+                if (stream.fd >= 0)
+                    fds[count++] = pollfd{stream.fd, POLLIN, 0};
+            }
+
+            // A command can close its output and keep running, so once the
+            // pipes are gone it is polled for rather than waited on, and a
+            // cancel still reaches it.
+            if (count == 0)
+            {
+                pid_t reaped = waitpid(pid, &status, WNOHANG);
+                if (reaped == pid || (reaped < 0 && errno != EINTR))
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(kJobPollIntervalMs));
+                continue;
+            }
+
+            if (poll(fds, count, kJobPollIntervalMs) < 0 && errno != EINTR)
+            {
+                for (OutputStream &stream : streams)
+                {
+                    if (stream.fd >= 0)
+                        close(stream.fd);
+                    stream.fd = -1;
+                }
+                continue;
+            }
+
+            for (OutputStream &stream : streams)
+            {
+                if (stream.fd >= 0)
+                    DrainStream(runner, stream);
+            }
+        }
+
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    void RunJob(JobRunner &runner, std::vector<JobCommand> commands)
+    {
+        for (const JobCommand &command : commands)
+        {
+            int exitCode = RunCommand(runner, command);
+
+            if (runner.cancel)
+            {
+                Queue(runner, "[" + runner.name + " cancelled]", true);
+                runner.state = JobCancelled;
+                return;
+            }
+            if (exitCode != 0)
+            {
+                Queue(runner, "[" + runner.name + " failed with exit code " + std::to_string(exitCode) + "]", true);
+                runner.state = JobFailed;
+                return;
+            }
+        }
+
+        Queue(runner, "[" + runner.name + " finished]", false);
+        runner.state = JobSucceeded;
+    }
+}
+
+bool StartJob(JobRunner &runner, std::string name, std::vector<JobCommand> commands)
+{
+    if (runner.state == JobRunning)
+        return false;
+    if (runner.worker.joinable())
+        runner.worker.join();
+
+    runner.name = std::move(name);
+    runner.cancel = false;
+    runner.state = JobRunning;
+    runner.worker = std::thread(RunJob, std::ref(runner), std::move(commands));
+    return true;
+}
+
+void CancelJob(JobRunner &runner)
+{
+    if (runner.state == JobRunning)
+        runner.cancel = true;
+}
+
+void PollJob(JobRunner &runner, ConsoleBuffer &console)
+{
+    std::vector<ConsoleLine> lines;
+    {
+        std::lock_guard<std::mutex> lock(runner.mutex);
+        lines.swap(runner.pending);
+    }
+
+    for (ConsoleLine &line : lines)
+        ConsoleAppend(console, std::move(line));
+}
+
+void ShutdownJobRunner(JobRunner &runner)
+{
+    CancelJob(runner);
+    if (runner.worker.joinable())
+        runner.worker.join();
+}
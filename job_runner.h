@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs external commands (nasm, QEMU) on a worker thread so the UI keeps
+// rendering. Commands are started with posix_spawn and run one after the
+// other, stopping at the first failure; their stdout and stderr are read
+// through non-blocking pipes and queued as lines for the console.
+
+constexpr size_t kConsoleMaxLines = 4096;
+constexpr int kJobPollIntervalMs = 50;
+constexpr int kJobKillGraceMs = 2000;
+
+struct ConsoleLine
+{
+    std::string text;
+    bool error = false;
+};
+
+// Fixed-capacity ring of console lines; once full, each new line replaces
+// the oldest one.
+struct ConsoleBuffer
+{
+    std::vector<ConsoleLine> lines;
+    size_t start = 0;
+};
+
+void ConsoleAppend(ConsoleBuffer &console, ConsoleLine line);
+size_t ConsoleSize(const ConsoleBuffer &console);
+const ConsoleLine &ConsoleLineAt(const ConsoleBuffer &console, size_t index);
+void ConsoleClear(ConsoleBuffer &console);
+
+enum JobState : uint8_t
+{
+    JobIdle,
+    JobRunning,
+    JobSucceeded,
+    JobFailed,
+    JobCancelled
+};
+
+typedef std::vector<std::string> JobCommand;
+
+struct JobRunner
+{
+    std::thread worker;
+    std::mutex mutex;
+    std::vector<ConsoleLine> pending;
+    std::atomic<JobState> state{JobIdle};
+    std::atomic<bool> cancel{false};
+    std::string name;
+};
+
+// Returns false when a job is still running.
+bool StartJob(JobRunner &runner, std::string name, std::vector<JobCommand> commands);
+
+// Asks the running command to terminate; it is killed if it has not exited
+// after kJobKillGraceMs.
+void CancelJob(JobRunner &runner);
+
+// Moves output queued by the worker into console. Called once per frame.
+void PollJob(JobRunner &runner, ConsoleBuffer &console);
+
+// Cancels any running job and waits for the worker to exit.
+void ShutdownJobRunner(JobRunner &runner);
@@ -0,0 +1,477 @@
+#include "journal.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <utility>
+
+namespace
+{
+    constexpr char kJournalMagic[4] = {'T', 'K', 'J', '\0'};
+    constexpr uint32_t kJournalVersion = 2;
+
+    enum JournalOp : uint8_t
+    {
+        JournalOpSnapshot,
+        JournalOpCreateNode,
+        JournalOpDeleteNode,
+        JournalOpSetText,
+        JournalOpAddLink,
+        JournalOpRemoveLink,
+        JournalOpDeleteNodes,
+        JournalOpMoveNodes
+    };
+
+    // Create records carry the node's position; move records are a list of
+    // these.
+    struct JournalMove
+    {
+        int32_t id;
+        NodePosition position;
+    };
+
+    static_assert(sizeof(JournalMove) == 12, "JournalMove layout changed");
+
+    struct JournalHeader
+    {
+        char magic[4];
+        uint32_t version;
+    };
+
+    // Every record is this header followed by length bytes of payload.
+    // check covers the op and the payload, so a torn tail is detected.
+    struct JournalRecord
+    {
+        uint8_t op;
+        uint8_t reserved[3];
+        uint32_t length;
+        uint32_t check;
+    };
+
+    static_assert(sizeof(JournalHeader) == 8, "JournalHeader layout changed");
+    static_assert(sizeof(JournalRecord) == 12, "JournalRecord layout changed");
+
+    uint32_t RecordCheck(uint8_t op, const void *first, size_t firstSize, const void *second, size_t secondSize)
+    {
+        uint64_t hash = HashBytes(kHashSeed, &op, sizeof(op));
+        hash = HashBytes(hash, first, firstSize);
+        hash = HashBytes(hash, second, secondSize);
+        return static_cast<uint32_t>(hash);
+    }
+
+    void AppendBytes(std::vector<char> &buffer, const void *data, size_t size)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    // Payloads are at most two pieces, a fixed part and an optional tail,
+    // which lets text edits skip building a temporary.
+    void AppendRecord(std::vector<char> &buffer, JournalOp op, const void *first, size_t firstSize,
+                      const void *second = nullptr, size_t secondSize = 0)
+    {
+        JournalRecord record = {};
+        record.op = op;
+        record.length = static_cast<uint32_t>(firstSize + secondSize);
+        record.check = RecordCheck(op, first, firstSize, second, secondSize);
+        AppendBytes(buffer, &record, sizeof(record));
+        AppendBytes(buffer, first, firstSize);
+        if (secondSize > 0)
+            AppendBytes(buffer, second, secondSize);
+    }
+
+    void Record(Journal &journal, JournalOp op, const void *first, size_t firstSize,
+                const void *second = nullptr, size_t secondSize = 0)
+    {
+        std::lock_guard<std::mutex> lock(journal.mutex);
+        AppendRecord(journal.pending, op, first, firstSize, second, secondSize);
+        journal.appended += sizeof(JournalRecord) + firstSize + secondSize;
+    }
+
+    bool WriteAll(int fd, const std::vector<char> &bytes)
+    {
+        size_t written = 0;
+        while (written < bytes.size())
+        {
+            ssize_t count = write(fd, bytes.data() + written, bytes.size() - written);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // Journal header and snapshot record: slot count, the session id of
+    // each slot, then the project, which loads those slots as ids 0..n-1.
+    bool EncodeSnapshot(const GraphSnapshot &graph, const std::vector<int32_t> &ids, std::vector<char> &snapshot,
+                        std::string &error)
+    {
+        std::vector<char> project;
+        if (!EncodeProject(graph, project, error))
+            return false;
+
+        std::vector<char> payload;
+        uint32_t count = static_cast<uint32_t>(ids.size());
+        AppendBytes(payload, &count, sizeof(count));
+        AppendBytes(payload, ids.data(), ids.size() * sizeof(int32_t));
+
+        JournalHeader header = {};
+        memcpy(header.magic, kJournalMagic, sizeof(kJournalMagic));
+        header.version = kJournalVersion;
+
+        snapshot.reserve(sizeof(header) + sizeof(JournalRecord) + payload.size() + project.size());
+        AppendBytes(snapshot, &header, sizeof(header));
+        AppendRecord(snapshot, JournalOpSnapshot, payload.data(), payload.size(), project.data(), project.size());
+        return true;
+    }
+
+    void RunJournal(Journal &journal)
+    {
+        int fd = -1;
+        std::unique_lock<std::mutex> lock(journal.mutex);
+        for (;;)
+        {
+            journal.wake.wait_for(lock, std::chrono::milliseconds(kJournalFlushMs),
+                                  [&journal]
+                                  { return journal.stop || journal.snapshotQueued; });
+
+            bool stop = journal.stop;
+            bool replace = journal.snapshotQueued;
+            GraphSnapshot graph;
+            std::vector<int32_t> ids;
+            std::vector<char> records;
+            std::swap(graph, journal.snapshot);
+            ids.swap(journal.snapshotIds);
+            records.swap(journal.pending);
+            journal.snapshotQueued = false;
+            lock.unlock();
+
+            // The old file stops taking records even if the new snapshot
+            // fails, since the records it would get assume that snapshot.
+            std::string error;
+            if (replace)
+            {
+                if (fd >= 0)
+                    close(fd);
+                fd = -1;
+                std::vector<char> snapshot;
+                if (EncodeSnapshot(graph, ids, snapshot, error) &&
+                    WriteFileAtomic(journal.path, snapshot.data(), snapshot.size(), error))
+                    fd = open(journal.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+                if (fd < 0 && error.empty())
+                    error = "could not open " + journal.path + ": " + strerror(errno);
+            }
+
+            if (!records.empty() && fd >= 0)
+            {
+                if (!WriteAll(fd, records) || fsync(fd) != 0)
+                    error = "could not append to " + journal.path + ": " + strerror(errno);
+            }
+
+            lock.lock();
+            if (!error.empty())
+                journal.error = "Autosave: " + error;
+            if (stop)
+                break;
+        }
+
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Reads the int32 at offset, which the caller has bounds-checked.
+    int32_t ReadInt(const char *data, size_t offset)
+    {
+        int32_t value;
+        memcpy(&value, data + offset, sizeof(value));
+        return value;
+    }
+
+    // Journal session ids to the ids the replay gave those nodes.
+    int MapId(const std::vector<int> &idMap, int32_t id)
+    {
+        return id >= 0 && id < static_cast<int32_t>(idMap.size()) ? idMap[id] : -1;
+    }
+
+    bool ReplayRecord(uint8_t op, const char *payload, size_t length, std::vector<int> &idMap)
+    {
+        switch (op)
+        {
+        case JournalOpCreateNode:
+        {
+            JournalMove create;
+            if (length != sizeof(create) + 1)
+                return false;
+            memcpy(&create, payload, sizeof(create));
+            uint8_t kind = static_cast<uint8_t>(payload[sizeof(create)]);
+            if (create.id < 0 || create.id >= kMaxNodeIds || kind >= NodeKindCount)
+                return false;
+            if (create.id >= static_cast<int32_t>(idMap.size()))
+                idMap.resize(create.id + 1, -1);
+            idMap[create.id] = CreateNode(static_cast<NodeKind>(kind));
+            SetNodePosition(idMap[create.id], create.position);
+            return true;
+        }
+        case JournalOpMoveNodes:
+        {
+            if (length == 0 || length % sizeof(JournalMove) != 0)
+                return false;
+            for (size_t offset = 0; offset < length; offset += sizeof(JournalMove))
+            {
+                JournalMove move;
+                memcpy(&move, payload + offset, sizeof(move));
+                int id = MapId(idMap, move.id);
+                if (NodeSlot(id) < 0)
+                    return false;
+                SetNodePosition(id, move.position);
+            }
+            return true;
+        }
+        case JournalOpDeleteNode:
+        {
+            int id = length == 4 ? MapId(idMap, ReadInt(payload, 0)) : -1;
+            if (NodeSlot(id) < 0)
+                return false;
+            DeleteNode(id);
+            idMap[ReadInt(payload, 0)] = -1;
+            return true;
+        }
+        case JournalOpDeleteNodes:
+        {
+            if (length == 0 || length % 4 != 0)
+                return false;
+            std::vector<int> ids(length / 4);
+            for (size_t i = 0; i < ids.size(); ++i)
+            {
+                ids[i] = MapId(idMap, ReadInt(payload, i * 4));
+                if (NodeSlot(ids[i]) < 0)
+                    return false;
+            }
+            DeleteNodes(ids);
+            for (size_t i = 0; i < ids.size(); ++i)
+                idMap[ReadInt(payload, i * 4)] = -1;
+            return true;
+        }
+        case JournalOpSetText:
+        {
+            int id = length >= 4 ? MapId(idMap, ReadInt(payload, 0)) : -1;
+            if (NodeSlot(id) < 0)
+                return false;
+            SetNodeText(id, std::string_view(payload + 4, length - 4));
+            return true;
+        }
+        case JournalOpAddLink:
+        case JournalOpRemoveLink:
+        {
+            if (length != 8)
+                return false;
+            int from = MapId(idMap, ReadInt(payload, 0));
+            int to = MapId(idMap, ReadInt(payload, 4));
+            if (NodeSlot(from) < 0 || NodeSlot(to) < 0)
+                return false;
+
+            PinId startPin = OutputPin(from);
+            PinId endPin = InputPin(to);
+            if (op == JournalOpAddLink)
+            {
+                if (!CanLink(startPin, endPin) || FindLink(startPin, endPin) >= 0)
+                    return false;
+                AddLink(startPin, endPin);
+                return true;
+            }
+
+            LinkId link = FindLink(startPin, endPin);
+            if (link < 0)
+                return false;
+            RemoveLink(link);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+void StartJournal(Journal &journal, const std::string &path)
+{
+    journal.path = path;
+    journal.stop = false;
+    journal.worker = std::thread(RunJournal, std::ref(journal));
+}
+
+void JournalCreateNode(Journal &journal, int id, NodeKind kind, NodePosition position)
+{
+    JournalMove create = {id, position};
+    char payload[sizeof(create) + 1];
+    memcpy(payload, &create, sizeof(create));
+    payload[sizeof(create)] = static_cast<char>(kind);
+    Record(journal, JournalOpCreateNode, payload, sizeof(payload));
+}
+
+void JournalDeleteNode(Journal &journal, int id)
+{
+    int32_t value = id;
+    Record(journal, JournalOpDeleteNode, &value, sizeof(value));
+}
+
+void JournalDeleteNodes(Journal &journal, const std::vector<int> &ids)
+{
+    std::vector<int32_t> payload(ids.begin(), ids.end());
+    Record(journal, JournalOpDeleteNodes, payload.data(), payload.size() * sizeof(int32_t));
+}
+
+void JournalMoveNodes(Journal &journal, const std::vector<int> &ids)
+{
+    std::vector<JournalMove> payload;
+    payload.reserve(ids.size());
+    for (int id : ids)
+        payload.push_back(JournalMove{id, nodes.positions[NodeSlot(id)]});
+    Record(journal, JournalOpMoveNodes, payload.data(), payload.size() * sizeof(JournalMove));
+}
+
+void JournalSetText(Journal &journal, int id, std::string_view text)
+{
+    int32_t value = id;
+    Record(journal, JournalOpSetText, &value, sizeof(value), text.data(), text.size());
+}
+
+void JournalAddLink(Journal &journal, PinId startPin, PinId endPin)
+{
+    int32_t payload[2] = {PinNodeId(startPin), PinNodeId(endPin)};
+    Record(journal, JournalOpAddLink, payload, sizeof(payload));
+}
+
+void JournalRemoveLink(Journal &journal, PinId startPin, PinId endPin)
+{
+    int32_t payload[2] = {PinNodeId(startPin), PinNodeId(endPin)};
+    Record(journal, JournalOpRemoveLink, payload, sizeof(payload));
+}
+
+bool JournalWantsCompaction(const Journal &journal)
+{
+    return journal.appended >= kJournalCompactBytes;
+}
+
+// Only flat copies happen here; a snapshot the worker has not taken yet is
+// simply replaced.
+void CompactJournal(Journal &journal)
+{
+    GraphSnapshot graph;
+    SnapshotGraph(graph);
+    std::vector<int32_t> ids(nodes.ids.begin(), nodes.ids.end());
+
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    journal.snapshot = std::move(graph);
+    journal.snapshotIds.swap(ids);
+    journal.snapshotQueued = true;
+    journal.pending.clear();
+    journal.appended = 0;
+    journal.wake.notify_one();
+}
+
+bool TakeJournalError(Journal &journal, std::string &error)
+{
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    if (journal.error.empty())
+        return false;
+    error.swap(journal.error);
+    journal.error.clear();
+    return true;
+}
+
+void ShutdownJournal(Journal &journal)
+{
+    {
+        std::lock_guard<std::mutex> lock(journal.mutex);
+        journal.stop = true;
+    }
+    journal.wake.notify_one();
+    if (journal.worker.joinable())
+        journal.worker.join();
+}
+
+bool RecoverJournal(const std::string &path, std::string &error)
+{
+    std::ifstream inFile(path, std::ios::binary);
+    if (!inFile)
+    {
+        error = "could not open " + path;
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+
+    JournalHeader header;
+    JournalRecord record;
+    size_t offset = sizeof(header) + sizeof(record);
+    if (data.size() < offset)
+    {
+        error = path + ": truncated journal";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    memcpy(&record, data.data() + sizeof(header), sizeof(record));
+    if (memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) != 0 || header.version != kJournalVersion)
+    {
+        error = path + ": not a version " + std::to_string(kJournalVersion) + " journal";
+        return false;
+    }
+
+    const char *payload = data.data() + offset;
+    if (record.op != JournalOpSnapshot || record.length > data.size() - offset || record.length < sizeof(uint32_t) ||
+        record.check != RecordCheck(record.op, payload, record.length, nullptr, 0))
+    {
+        error = path + ": corrupt journal snapshot";
+        return false;
+    }
+
+    uint32_t count;
+    memcpy(&count, payload, sizeof(count));
+    size_t idsSize = sizeof(count) + size_t(count) * sizeof(int32_t);
+    if (idsSize > record.length)
+    {
+        error = path + ": corrupt journal snapshot";
+        return false;
+    }
+    if (!LoadProject(path, payload + idsSize, record.length - idsSize, error))
+        return false;
+    if (nodes.size() != count)
+    {
+        ClearGraph();
+        error = path + ": corrupt journal snapshot";
+        return false;
+    }
+
+    std::vector<int> idMap;
+    for (uint32_t slot = 0; slot < count; ++slot)
+    {
+        int32_t id = ReadInt(payload, sizeof(count) + slot * sizeof(int32_t));
+        if (id < 0 || id >= kMaxNodeIds)
+        {
+            ClearGraph();
+            error = path + ": corrupt journal snapshot";
+            return false;
+        }
+        if (id >= static_cast<int32_t>(idMap.size()))
+            idMap.resize(id + 1, -1);
+        idMap[id] = static_cast<int>(slot);
+    }
+
+    offset += record.length;
+    while (data.size() - offset >= sizeof(record))
+    {
+        memcpy(&record, data.data() + offset, sizeof(record));
+        payload = data.data() + offset + sizeof(record);
+        if (record.length > data.size() - offset - sizeof(record) ||
+            record.check != RecordCheck(record.op, payload, record.length, nullptr, 0) ||
+            !ReplayRecord(record.op, payload, record.length, idMap))
+            break;
+        offset += sizeof(record) + record.length;
+    }
+    return true;
+}
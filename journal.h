@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "graph.h"
+
+// Append-only autosave journal. The file starts with a snapshot of the whole
+// graph (a .tkp project plus the session node ids of its slots) followed by
+// one small record per edit. The main loop only appends records to a memory
+// buffer; a worker thread writes and fsyncs them every kJournalFlushMs.
+// Once the edits since the snapshot outgrow kJournalCompactBytes the editor
+// copies the graph out, and the worker encodes it and swaps it in as a fresh
+// file with an atomic rename, so the journal on disk is always replayable.
+
+constexpr int kJournalFlushMs = 250;
+constexpr size_t kJournalCompactBytes = 4 * 1024 * 1024;
+
+struct Journal
+{
+    std::string path;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<char> pending;
+    GraphSnapshot snapshot;
+    std::vector<int32_t> snapshotIds;
+    bool snapshotQueued = false;
+    bool stop = false;
+    std::string error;
+
+    // Main thread only: record bytes appended since the last snapshot.
+    size_t appended = 0;
+};
+
+// Starts the worker. Nothing is written until the first CompactJournal(),
+// which creates the file.
+void StartJournal(Journal &journal, const std::string &path);
+
+void JournalCreateNode(Journal &journal, int id, NodeKind kind, NodePosition position);
+void JournalDeleteNode(Journal &journal, int id);
+// One record for a DeleteNodes() batch, replayed as one batch.
+void JournalDeleteNodes(Journal &journal, const std::vector<int> &ids);
+// Records where the given live nodes are now, e.g. once a drag ends.
+void JournalMoveNodes(Journal &journal, const std::vector<int> &ids);
+void JournalSetText(Journal &journal, int id, std::string_view text);
+void JournalAddLink(Journal &journal, PinId startPin, PinId endPin);
+void JournalRemoveLink(Journal &journal, PinId startPin, PinId endPin);
+
+bool JournalWantsCompaction(const Journal &journal);
+
+// Copies the current graph, including nodes.positions, and queues it to
+// replace the journal; the worker does the encoding. Records appended before
+// the call are dropped, since the snapshot already contains them.
+void CompactJournal(Journal &journal);
+
+// Returns a write error reported by the worker since the last call.
+bool TakeJournalError(Journal &journal, std::string &error);
+
+// Flushes what is pending and stops the worker.
+void ShutdownJournal(Journal &journal);
+
+// Replaces the current graph with the journal's snapshot and replays the
+// records after it. A torn or corrupt tail, as left by a crash mid-write,
+// ends the replay; everything before it is kept.
+bool RecoverJournal(const std::string &path, std::string &error);
@@ -4,13 +4,27 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <cstdio>
+#include <climits>
 #include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
 #include <iostream>
-#include <set>
-#include <functional>
+#include <iterator>
+#include <thread>
+#include <unistd.h>
+
+#include "assembler.h"
+#include "emulator.h"
+#include "frame_profiler.h"
+#include "graph.h"
+#include "journal.h"
+#include "job_runner.h"
+#include "qmp_client.h"
 #define GL_SILENCE_DEPRECATION
 
 #if defined(IMGUI_IMPL_OPENGL_ES2)
@@ -19,327 +33,1889 @@
 
 #include <GLFW/glfw3.h>
 
-struct Node
+JobRunner jobRunner;
+ConsoleBuffer console;
+bool crossCheckPending = false;
+std::vector<uint8_t> crossCheckImage;
+
+// Run and Cross-check wait for the budgeted validation, and Cross-check for
+// the kernel.asm emission too, before they build.
+enum KernelAction : uint8_t
+{
+    KernelActionNone,
+    KernelActionRun,
+    KernelActionCrossCheck
+};
+
+KernelAction pendingKernelAction = KernelActionNone;
+
+// Result of running the current kernel in the built-in emulator. hash is
+// the content it was produced from; a mismatch triggers a re-run. Runs go
+// to previewEmulator; runHash is the content of the last one submitted, and
+// runPending is set while the image for hash waits for the worker.
+struct KernelPreview
+{
+    uint64_t hash = 0;
+    bool current = false;
+    uint64_t runHash = 0;
+    bool runPending = false;
+    std::string error;
+    EmulatorResult result;
+};
+
+KernelPreview kernelPreview;
+EmulatorSession previewEmulator;
+
+constexpr uint64_t kPreviewMaxSteps = 200000;
+
+// QEMU stays running between runs on its own runner and is driven over QMP;
+// the socket lives in /tmp and is named after our pid.
+JobRunner qemuRunner;
+QmpSession qmp;
+std::string qmpSocketPath;
+
+// Every graph edit is also recorded here; the editor reopens from it.
+Journal journal;
+constexpr const char *kJournalPath = "autosave.tkj";
+
+// Selection commands from the Edit menu and their shortcuts. They run after
+// the node editor has ended, when its selection is final for the frame.
+enum EditCommand : uint8_t
+{
+    EditNone,
+    EditDelete,
+    EditDuplicate,
+    EditCopy,
+    EditPaste
+};
+
+EditCommand pendingEdit = EditNone;
+GraphClip clipboard;
+
+constexpr float kPasteOffset = 40.0f;
+
+// Frame pacing. While nothing happens the loop blocks in glfwWaitEvents*;
+// it renders back to back only for a few frames after a wake-up and while
+// time-sliced work is in progress, and never faster than the frame cap.
+// Running jobs only need their output polled, so they wake the loop on a
+// timer instead of keeping it busy.
+struct FramePacing
+{
+    int frameCap = 60;
+    bool lowPower = false;
+    int settleFrames = 0;
+    double lastFrame = 0.0;
+};
+
+FramePacing framePacing;
+
+constexpr int kSettleFrames = 3;
+constexpr int kLowPowerFrameCap = 20;
+constexpr double kJobWakeSeconds = 0.1;
+constexpr double kLowPowerJobWakeSeconds = 0.5;
+constexpr double kTextCursorWakeSeconds = 0.5;
+constexpr int kFrameCapChoices[] = {30, 60, 120, 0};
+
+FrameProfiler frameProfiler;
+
+// GL_TIME_ELAPSED queries around the draw-data render. Results are read a
+// few frames later, once available, so the CPU never waits on the GPU. The
+// entry points are loaded at runtime since the context only asks for GL 3.0.
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+constexpr int kGpuTimerQueries = 4;
+
+struct GpuTimer
+{
+    bool available = false;
+    void(APIENTRY *genQueries)(GLsizei, GLuint *) = nullptr;
+    void(APIENTRY *deleteQueries)(GLsizei, const GLuint *) = nullptr;
+    void(APIENTRY *beginQuery)(GLenum, GLuint) = nullptr;
+    void(APIENTRY *endQuery)(GLenum) = nullptr;
+    void(APIENTRY *getQueryObjectiv)(GLuint, GLenum, GLint *) = nullptr;
+    void(APIENTRY *getQueryObjectui64v)(GLuint, GLenum, uint64_t *) = nullptr;
+
+    GLuint queries[kGpuTimerQueries] = {};
+    uint64_t frames[kGpuTimerQueries] = {};
+    float startUs[kGpuTimerQueries] = {};
+    bool pending[kGpuTimerQueries] = {};
+    int active = -1;
+};
+
+GpuTimer gpuTimer;
+
+template <typename Proc>
+void LoadGlProc(Proc &proc, const char *name)
+{
+    proc = reinterpret_cast<Proc>(glfwGetProcAddress(name));
+}
+
+void InitGpuTimer()
+{
+    if (!glfwExtensionSupported("GL_ARB_timer_query") && !glfwExtensionSupported("GL_EXT_timer_query"))
+        return;
+
+    LoadGlProc(gpuTimer.genQueries, "glGenQueries");
+    LoadGlProc(gpuTimer.deleteQueries, "glDeleteQueries");
+    LoadGlProc(gpuTimer.beginQuery, "glBeginQuery");
+    LoadGlProc(gpuTimer.endQuery, "glEndQuery");
+    LoadGlProc(gpuTimer.getQueryObjectiv, "glGetQueryObjectiv");
+    LoadGlProc(gpuTimer.getQueryObjectui64v, "glGetQueryObjectui64v");
+    if (gpuTimer.getQueryObjectui64v == nullptr)
+        LoadGlProc(gpuTimer.getQueryObjectui64v, "glGetQueryObjectui64vEXT");
+
+    gpuTimer.available = gpuTimer.genQueries && gpuTimer.deleteQueries && gpuTimer.beginQuery && gpuTimer.endQuery &&
+                         gpuTimer.getQueryObjectiv && gpuTimer.getQueryObjectui64v;
+    if (gpuTimer.available)
+        gpuTimer.genQueries(kGpuTimerQueries, gpuTimer.queries);
+}
+
+void ShutdownGpuTimer()
+{
+    if (gpuTimer.available)
+        gpuTimer.deleteQueries(kGpuTimerQueries, gpuTimer.queries);
+    gpuTimer.available = false;
+}
+
+void CollectGpuTimes()
+{
+    for (int i = 0; i < kGpuTimerQueries && gpuTimer.available; ++i)
+    {
+        if (!gpuTimer.pending[i])
+            continue;
+
+        GLint ready = 0;
+        gpuTimer.getQueryObjectiv(gpuTimer.queries[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (!ready)
+            continue;
+
+        uint64_t nanoseconds = 0;
+        gpuTimer.getQueryObjectui64v(gpuTimer.queries[i], GL_QUERY_RESULT, &nanoseconds);
+        SetProfileGpuTime(frameProfiler, gpuTimer.frames[i], gpuTimer.startUs[i], nanoseconds / 1e6f);
+        gpuTimer.pending[i] = false;
+    }
+}
+
+// Skips the frame when its query slot is still waiting on an older result.
+void BeginGpuTimer()
+{
+    int slot = static_cast<int>(frameProfiler.frame % kGpuTimerQueries);
+    if (!gpuTimer.available || !frameProfiler.recording || gpuTimer.pending[slot])
+        return;
+
+    CollectGpuTimes();
+    gpuTimer.beginQuery(GL_TIME_ELAPSED, gpuTimer.queries[slot]);
+    gpuTimer.frames[slot] = frameProfiler.frame;
+    gpuTimer.startUs[slot] = std::chrono::duration<float, std::micro>(ProfileClock::now() - frameProfiler.frameBegin).count();
+    gpuTimer.active = slot;
+}
+
+void EndGpuTimer()
+{
+    if (gpuTimer.active < 0)
+        return;
+
+    gpuTimer.endQuery(GL_TIME_ELAPSED);
+    gpuTimer.pending[gpuTimer.active] = true;
+    gpuTimer.active = -1;
+}
+
+// Nodes on the canvas show their text read-only, straight from the text
+// arena; it is edited in the Properties panel, which only has widgets for
+// the selected nodes in view.
+constexpr size_t kNodeTextPreview = 32;
+
+void DrawPrintCharBody(int id)
+{
+    std::string_view text = NodeText(id);
+    ImGui::Text("Letter: %.*s", static_cast<int>(text.size()), text.data());
+}
+
+void DrawInstructionBody(int id)
+{
+    std::string_view text = NodeText(id).substr(0, kNodeTextPreview);
+    if (text.empty())
+        ImGui::TextDisabled("(empty)");
+    else
+        ImGui::TextUnformatted(text.data(), text.data() + text.size());
+}
+
+void EditPrintChar(int id)
+{
+    std::string_view text = NodeText(id);
+    char letter[2] = {text.empty() ? '\0' : text[0], '\0'};
+
+    if (ImGui::InputText("Letter", letter, sizeof(letter)))
+    {
+        SetNodeText(id, letter);
+        JournalSetText(journal, id, letter);
+    }
+}
+
+void EditInstruction(int id)
+{
+    std::string_view text = NodeText(id);
+    char instruction[256];
+    size_t length = std::min(text.size(), sizeof(instruction) - 1);
+    std::copy(text.begin(), text.begin() + length, instruction);
+    instruction[length] = '\0';
+
+    if (ImGui::InputText("Instruction", instruction, sizeof(instruction)))
+    {
+        SetNodeText(id, instruction);
+        JournalSetText(journal, id, instruction);
+    }
+}
+
+// Editor widgets per node kind, kept here so the graph module stays GUI-free.
+typedef void (*DrawNodeBody)(int id);
+
+const DrawNodeBody kNodeKindBodies[NodeKindCount] = {
+    nullptr,
+    nullptr,
+    DrawPrintCharBody,
+    DrawInstructionBody,
+};
+
+const DrawNodeBody kNodeKindEditors[NodeKindCount] = {
+    nullptr,
+    nullptr,
+    EditPrintChar,
+    EditInstruction,
+};
+
+constexpr const char *kGraphPath = "graph.tkp";
+
+void SaveGraphFile(const std::string &path)
+{
+    std::string error;
+    if (SaveGraph(path, error))
+        std::cout << "Saved " << path << "\n";
+    else
+        std::cout << error << "\n";
+}
+
+// A load replaces the whole graph, so the journal restarts from a snapshot
+// whether or not it succeeded.
+void LoadGraphFile(const std::string &path)
+{
+    std::string error;
+    if (LoadGraph(path, error))
+    {
+        std::cout << "Loaded " << path << "\n";
+    }
+    else
+    {
+        std::cout << error << "\n";
+    }
+    CompactJournal(journal);
+}
+
+// Reopens the graph from the autosave journal left by the last session,
+// whether it exited cleanly or not.
+void RecoverAutosave()
+{
+    if (access(kJournalPath, F_OK) != 0)
+        return;
+
+    std::string error;
+    if (RecoverJournal(kJournalPath, error))
+    {
+        std::cout << "Recovered " << kJournalPath << "\n";
+    }
+    else
+    {
+        std::cout << error << "\n";
+    }
+}
+
+void UpdateAutosave()
+{
+    if (JournalWantsCompaction(journal))
+        CompactJournal(journal);
+
+    std::string error;
+    if (TakeJournalError(journal, error))
+        ConsoleAppend(console, ConsoleLine{error, true});
+}
+
+std::vector<int> SelectedNodes()
+{
+    std::vector<int> ids(ImNodes::NumSelectedNodes());
+    if (!ids.empty())
+        ImNodes::GetSelectedNodes(ids.data());
+    ids.erase(std::remove_if(ids.begin(), ids.end(), [](int id)
+                             { return NodeSlot(id) < 0; }),
+              ids.end());
+    return ids;
+}
+
+void CopySelection(GraphClip &clip)
+{
+    CopyNodes(SelectedNodes(), clip);
+}
+
+// Pastes the clip next to where it was copied from and selects the copies.
+// ImNodes only selects nodes it knows, hence the positions set up front.
+void PasteClip(const GraphClip &clip)
+{
+    std::vector<int> ids = PasteNodes(clip, NodePosition{kPasteOffset, kPasteOffset});
+    ImNodes::ClearNodeSelection();
+    ImNodes::ClearLinkSelection();
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        const NodePosition &position = nodes.positions[NodeSlot(ids[i])];
+        ImNodes::SetNodeGridSpacePos(ids[i], ImVec2(position.x, position.y));
+        ImNodes::SelectNode(ids[i]);
+        JournalCreateNode(journal, ids[i], clip.kinds[i], position);
+        JournalSetText(journal, ids[i], NodeText(ids[i]));
+    }
+    for (const std::pair<uint32_t, uint32_t> &link : clip.links)
+        JournalAddLink(journal, OutputPin(ids[link.first]), InputPin(ids[link.second]));
+}
+
+// Selected links go first, then the selected nodes in one batch.
+void DeleteSelection()
+{
+    std::vector<int> linkIds(ImNodes::NumSelectedLinks());
+    if (!linkIds.empty())
+        ImNodes::GetSelectedLinks(linkIds.data());
+    for (int link : linkIds)
+    {
+        int slot = LinkSlot(link);
+        if (slot < 0)
+            continue;
+        JournalRemoveLink(journal, links.starts[slot], links.ends[slot]);
+        RemoveLink(link);
+    }
+
+    std::vector<int> ids = SelectedNodes();
+    if (!ids.empty())
+    {
+        JournalDeleteNodes(journal, ids);
+        DeleteNodes(ids);
+    }
+    ImNodes::ClearNodeSelection();
+    ImNodes::ClearLinkSelection();
+}
+
+// Shortcuts apply while no text field has the keyboard.
+EditCommand EditShortcut()
+{
+    const ImGuiIO &io = ImGui::GetIO();
+    if (io.WantTextInput)
+        return EditNone;
+    if (ImGui::IsKeyPressed(ImGuiKey_Delete, false))
+        return EditDelete;
+    if (!io.KeyCtrl)
+        return EditNone;
+    if (ImGui::IsKeyPressed(ImGuiKey_D, false))
+        return EditDuplicate;
+    if (ImGui::IsKeyPressed(ImGuiKey_C, false))
+        return EditCopy;
+    if (ImGui::IsKeyPressed(ImGuiKey_V, false))
+        return EditPaste;
+    return EditNone;
+}
+
+void ApplyEdit(EditCommand command)
+{
+    switch (command)
+    {
+    case EditDelete:
+        DeleteSelection();
+        break;
+    case EditDuplicate:
+    {
+        GraphClip clip;
+        CopySelection(clip);
+        PasteClip(clip);
+        break;
+    }
+    case EditCopy:
+        CopySelection(clipboard);
+        break;
+    case EditPaste:
+        PasteClip(clipboard);
+        break;
+    default:
+        break;
+    }
+}
+
+// Viewport culling. ImNodes is only given the nodes positioned in the
+// visible canvas plus kCullMargin, the selection, so a drag can carry nodes
+// out of view, and a bounded number of nodes at the far end of their links,
+// so links crossing the edge still have both pins. Links to the far ends
+// left out are drawn as plain lines under the nodes. ImNodes forgets the
+// nodes it is not given; nodes.positions keeps their place, is pushed into
+// ImNodes before each node is drawn and read back once the editor has
+// ended.
+//
+// Below full zoom ImNodes, which cannot scale, is replaced by an overview
+// drawn straight into a draw list, in two levels of detail: title-only boxes
+// with straight links, then plain colored rectangles batched into one
+// reservation, with nodes that land on the same few pixels drawn once.
+struct EditorView
+{
+    std::vector<int> nodes;
+    std::vector<int> selection;
+    std::vector<uint64_t> submitted;
+    uint64_t frame = 0;
+
+    // Links from nodes in view to far ends that were not submitted, by the
+    // pin in view, and the pin each angle bucket was last drawn for.
+    std::vector<std::pair<PinId, LinkId>> farLinks;
+    std::vector<uint32_t> farAngles;
+    uint32_t farPin = 0;
+
+    // Nodes moved by the drag in progress, journalled once it ends.
+    std::vector<int> moved;
+    std::vector<uint8_t> movedMark;
+
+    float zoom = 1.0f;
+    ImVec2 canvasOrigin;
+    ImVec2 canvasSize;
+    std::vector<uint8_t> covered;
+};
+
+EditorView editorView;
+
+// Nodes are filed by their top-left corner, so the query reaches this far
+// left of and above the view for nodes that stick into it.
+constexpr float kCullMargin = 256.0f;
+constexpr float kMaxNodeWidth = 320.0f;
+constexpr float kMaxNodeHeight = 200.0f;
+
+// Far ends of links from nodes in view are only submitted within this many
+// canvas sizes of the view, and only this many of them.
+constexpr float kFarEndReach = 1.0f;
+constexpr size_t kMaxFarEndNodes = 256;
+
+// Lines to the other far ends start and end at estimated pins, since only
+// ImNodes knows where the pins really are. Lines from one pin that leave it
+// in the same angle bucket are drawn once, and at most kMaxFarLinkLines are
+// drawn in all, to stay well within 16-bit draw indices.
+constexpr int kFarLinkAngleBuckets = 4096;
+constexpr size_t kMaxFarLinkLines = 4096;
+constexpr float kFarLinkThickness = 3.0f;
+constexpr ImU32 kFarLinkColor = IM_COL32(61, 133, 224, 200);
+
+// Nodes added from the context menu appear this far inside the view.
+constexpr float kNewNodeInset = 40.0f;
+
+constexpr float kZoomStep = 1.25f;
+constexpr float kMinZoom = 0.01f;
+constexpr float kTitleZoom = 0.35f;
+
+// Overview boxes stand in for nodes whose real size only ImNodes knows.
+constexpr float kOverviewNodeWidth = 160.0f;
+constexpr float kOverviewNodeHeight = 70.0f;
+constexpr float kOverviewTitleHeight = 24.0f;
+constexpr float kOverviewCellPixels = 2.0f;
+constexpr float kOverviewMinLinkPixels = 2.0f;
+
+// ImDrawIdx is 16 bits. A renderer that honors vertex offsets lets ImGui
+// start a new one for any reservation that would pass 64k vertices, so each
+// batch only has to stay below that. Without one, the whole window draw list
+// must, and the overview stops short of kSmallMeshVertices, leaving room for
+// the window's own chrome.
+constexpr size_t kOverviewBatchRects = 16383;
+constexpr int kSmallMeshVertices = 60000;
+
+constexpr ImU32 kNodeKindColors[NodeKindCount] = {
+    IM_COL32(80, 170, 90, 255),
+    IM_COL32(170, 80, 90, 255),
+    IM_COL32(90, 130, 190, 255),
+    IM_COL32(120, 120, 140, 255),
+};
+constexpr ImU32 kBrokenNodeColor = IM_COL32(200, 60, 60, 255);
+constexpr ImU32 kOverviewBodyColor = IM_COL32(50, 50, 55, 255);
+constexpr ImU32 kOverviewLinkColor = IM_COL32(200, 200, 100, 255);
+
+void AddViewNode(int id)
+{
+    if (id < 0 || editorView.submitted[id] == editorView.frame)
+        return;
+    editorView.submitted[id] = editorView.frame;
+    editorView.nodes.push_back(id);
+}
+
+void CollectViewNodes(ImVec2 canvasSize)
+{
+    ++editorView.frame;
+    editorView.nodes.clear();
+    editorView.submitted.resize(nodeIds.slots.size(), 0);
+
+    ImVec2 panning = ImNodes::EditorContextGetPanning();
+    NodePosition min = {-panning.x - kCullMargin - kMaxNodeWidth, -panning.y - kCullMargin - kMaxNodeHeight};
+    NodePosition max = {-panning.x + canvasSize.x + kCullMargin, -panning.y + canvasSize.y + kCullMargin};
+    QueryNodeGrid(min, max, editorView.nodes);
+    for (int id : editorView.nodes)
+        editorView.submitted[id] = editorView.frame;
+    for (int id : editorView.selection)
+        AddViewNode(NodeSlot(id) >= 0 ? id : -1);
+
+    size_t inView = editorView.nodes.size();
+    NodePosition reachMin = {min.x - canvasSize.x * kFarEndReach, min.y - canvasSize.y * kFarEndReach};
+    NodePosition reachMax = {max.x + canvasSize.x * kFarEndReach, max.y + canvasSize.y * kFarEndReach};
+    for (size_t i = 0; i < inView && editorView.nodes.size() - inView < kMaxFarEndNodes; ++i)
+    {
+        int id = editorView.nodes[i];
+        for (PinId pin : {InputPin(id), OutputPin(id)})
+        {
+            for (LinkId link = FirstPinLink(pin); link >= 0 && editorView.nodes.size() - inView < kMaxFarEndNodes;
+                 link = NextPinLink(pin, link))
+            {
+                int other = FindPinNode(LinkedPin(pin, link));
+                if (other < 0 || editorView.submitted[other] == editorView.frame)
+                    continue;
+                const NodePosition &position = nodes.positions[NodeSlot(other)];
+                if (position.x >= reachMin.x && position.x <= reachMax.x && position.y >= reachMin.y &&
+                    position.y <= reachMax.y)
+                    AddViewNode(other);
+            }
+        }
+    }
+
+    editorView.farLinks.clear();
+    for (size_t i = 0; i < inView; ++i)
+    {
+        int id = editorView.nodes[i];
+        for (PinId pin : {InputPin(id), OutputPin(id)})
+        {
+            for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+            {
+                int other = FindPinNode(LinkedPin(pin, link));
+                if (other >= 0 && editorView.submitted[other] != editorView.frame)
+                    editorView.farLinks.emplace_back(pin, link);
+            }
+        }
+    }
+}
+
+// Where a pin is drawn, guessed from the overview's stand-in node size.
+ImVec2 EstimatedPinPosition(PinId pin, ImVec2 canvasOrigin, ImVec2 panning)
+{
+    const NodePosition &position = nodes.positions[NodeSlot(PinNodeId(pin))];
+    float x = PinDirectionOf(pin) == PinOutput ? position.x + kOverviewNodeWidth : position.x;
+    return ImVec2(canvasOrigin.x + panning.x + x, canvasOrigin.y + panning.y + position.y + kOverviewNodeHeight * 0.5f);
+}
+
+// Draws editorView.farLinks into the editor's draw list. Called before any
+// node is submitted, so the lines land under the nodes, and clipped to the
+// canvas like everything else in it.
+void DrawFarLinks(ImVec2 canvasOrigin)
+{
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImVec2 panning = ImNodes::EditorContextGetPanning();
+    editorView.farAngles.resize(kFarLinkAngleBuckets, 0);
+
+    PinId lastPin = 0;
+    size_t drawn = 0;
+    for (const std::pair<PinId, LinkId> &farLink : editorView.farLinks)
+    {
+        if (drawn >= kMaxFarLinkLines)
+            return;
+        if (farLink.first != lastPin)
+        {
+            lastPin = farLink.first;
+            ++editorView.farPin;
+        }
+
+        ImVec2 inView = EstimatedPinPosition(farLink.first, canvasOrigin, panning);
+        ImVec2 farEnd = EstimatedPinPosition(LinkedPin(farLink.first, farLink.second), canvasOrigin, panning);
+        float angle = std::atan2(farEnd.y - inView.y, farEnd.x - inView.x);
+        int bucket = static_cast<int>((angle + 3.14159265f) / 6.2831853f * kFarLinkAngleBuckets) % kFarLinkAngleBuckets;
+        if (editorView.farAngles[bucket] == editorView.farPin)
+            continue;
+        editorView.farAngles[bucket] = editorView.farPin;
+
+        drawList->AddLine(inView, farEnd, kFarLinkColor, kFarLinkThickness);
+        ++drawn;
+    }
+}
+
+// Links whose two ends were both submitted, each once from its start pin.
+void SubmitViewLinks()
+{
+    for (int id : editorView.nodes)
+    {
+        if (NodeSlot(id) < 0)
+            continue;
+
+        PinId pin = OutputPin(id);
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+        {
+            int targetId = FindPinNode(LinkedPin(pin, link));
+            if (targetId < 0 || editorView.submitted[targetId] != editorView.frame)
+                continue;
+            int slot = LinkSlot(link);
+            ImNodes::Link(link, PinAttr(links.starts[slot]), PinAttr(links.ends[slot]));
+        }
+    }
+}
+
+void ReadViewPositions()
+{
+    editorView.movedMark.resize(nodeIds.slots.size(), 0);
+    for (int id : editorView.nodes)
+    {
+        int slot = NodeSlot(id);
+        if (slot < 0)
+            continue;
+        ImVec2 position = ImNodes::GetNodeGridSpacePos(id);
+        const NodePosition &stored = nodes.positions[slot];
+        if (position.x == stored.x && position.y == stored.y)
+            continue;
+
+        SetNodePosition(id, NodePosition{position.x, position.y});
+        if (!editorView.movedMark[id])
+        {
+            editorView.movedMark[id] = 1;
+            editorView.moved.push_back(id);
+        }
+    }
+
+    if (editorView.moved.empty() || ImGui::IsMouseDown(ImGuiMouseButton_Left))
+        return;
+
+    for (int id : editorView.moved)
+        editorView.movedMark[id] = 0;
+    editorView.moved.erase(std::remove_if(editorView.moved.begin(), editorView.moved.end(), [](int id)
+                                          { return NodeSlot(id) < 0; }),
+                           editorView.moved.end());
+    if (!editorView.moved.empty())
+        JournalMoveNodes(journal, editorView.moved);
+    editorView.moved.clear();
+}
+
+ImVec2 GridToScreen(NodePosition position, ImVec2 panning)
+{
+    return ImVec2(editorView.canvasOrigin.x + (position.x + panning.x) * editorView.zoom,
+                  editorView.canvasOrigin.y + (position.y + panning.y) * editorView.zoom);
+}
+
+// Changes the zoom while keeping the grid point under anchor in place.
+// Zoom and panning are both the editor's, so the tiers hand over seamlessly.
+void ZoomCanvas(float zoom, ImVec2 anchor)
+{
+    // Snap, so that stepping back in lands on exactly 1 despite rounding.
+    zoom = zoom > 0.99f ? 1.0f : std::max(zoom, kMinZoom);
+
+    ImVec2 panning = ImNodes::EditorContextGetPanning();
+    float localX = anchor.x - editorView.canvasOrigin.x;
+    float localY = anchor.y - editorView.canvasOrigin.y;
+    float gridX = localX / editorView.zoom - panning.x;
+    float gridY = localY / editorView.zoom - panning.y;
+    ImNodes::EditorContextResetPanning(ImVec2(localX / zoom - gridX, localY / zoom - gridY));
+    editorView.zoom = zoom;
+}
+
+ImVec2 CanvasCenter()
+{
+    return ImVec2(editorView.canvasOrigin.x + editorView.canvasSize.x * 0.5f,
+                  editorView.canvasOrigin.y + editorView.canvasSize.y * 0.5f);
+}
+
+// Marks the canvas cell under point as drawn; false if it already was.
+bool CoverCell(ImVec2 point, float cellPixels)
+{
+    int columns = static_cast<int>(editorView.canvasSize.x / cellPixels) + 1;
+    int column = static_cast<int>((point.x - editorView.canvasOrigin.x) / cellPixels);
+    int row = static_cast<int>((point.y - editorView.canvasOrigin.y) / cellPixels);
+    if (column < 0 || row < 0 || column >= columns)
+        return true;
+
+    size_t cell = static_cast<size_t>(row) * columns + column;
+    if (cell >= editorView.covered.size())
+        return true;
+    if (editorView.covered[cell])
+        return false;
+    editorView.covered[cell] = 1;
+    return true;
+}
+
+// Stops once the draw list holds maxVertices.
+void DrawOverviewLinks(ImDrawList *drawList, ImVec2 panning, float thickness, int maxVertices)
+{
+    float zoom = editorView.zoom;
+    for (int id : editorView.nodes)
+    {
+        if (drawList->VtxBuffer.Size >= maxVertices)
+            return;
+
+        PinId pin = OutputPin(id);
+        if (FirstPinLink(pin) < 0)
+            continue;
+
+        ImVec2 start = GridToScreen(nodes.positions[NodeSlot(id)], panning);
+        start.x += kOverviewNodeWidth * zoom;
+        start.y += kOverviewTitleHeight * 0.5f * zoom;
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+        {
+            int targetId = FindPinNode(LinkedPin(pin, link));
+            if (targetId < 0)
+                continue;
+
+            ImVec2 end = GridToScreen(nodes.positions[NodeSlot(targetId)], panning);
+            end.y += kOverviewTitleHeight * 0.5f * zoom;
+            if (std::fabs(end.x - start.x) + std::fabs(end.y - start.y) >= kOverviewMinLinkPixels)
+                drawList->AddLine(start, end, kOverviewLinkColor, thickness);
+        }
+    }
+}
+
+// The canvas below full zoom. Dragging pans, the wheel zooms around the
+// mouse and a double-click returns to the live editor at that spot.
+// Links into the view from nodes outside it are not drawn.
+void DrawOverview(const KernelProgram &kernel)
+{
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings |
+                             ImGuiWindowFlags_NoBringToFrontOnFocus;
+    ImGui::Begin("Overview", NULL, flags);
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    const ImGuiIO &io = ImGui::GetIO();
+
+    if (ImGui::IsWindowHovered())
+    {
+        if (ImGui::IsMouseDragging(ImGuiMouseButton_Left) || ImGui::IsMouseDragging(ImGuiMouseButton_Middle))
+        {
+            ImVec2 panning = ImNodes::EditorContextGetPanning();
+            ImNodes::EditorContextResetPanning(ImVec2(panning.x + io.MouseDelta.x / editorView.zoom,
+                                                      panning.y + io.MouseDelta.y / editorView.zoom));
+        }
+        if (io.MouseWheel != 0.0f)
+            ZoomCanvas(io.MouseWheel > 0.0f ? editorView.zoom * kZoomStep : editorView.zoom / kZoomStep, io.MousePos);
+        else if (ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left))
+            ZoomCanvas(1.0f, io.MousePos);
+    }
+
+    bool largeMesh = (io.BackendFlags & ImGuiBackendFlags_RendererHasVtxOffset) != 0;
+    int maxVertices = largeMesh ? INT_MAX : kSmallMeshVertices;
+
+    float zoom = editorView.zoom;
+    ImVec2 panning = ImNodes::EditorContextGetPanning();
+    NodePosition min = {-panning.x - kOverviewNodeWidth, -panning.y - kOverviewNodeHeight};
+    NodePosition max = {-panning.x + editorView.canvasSize.x / zoom, -panning.y + editorView.canvasSize.y / zoom};
+    editorView.nodes.clear();
+    QueryNodeGrid(min, max, editorView.nodes);
+
+    if (zoom >= kTitleZoom)
+    {
+        DrawOverviewLinks(drawList, panning, 1.5f, maxVertices);
+        for (int id : editorView.nodes)
+        {
+            if (drawList->VtxBuffer.Size >= maxVertices)
+                break;
+
+            int slot = NodeSlot(id);
+            ImVec2 topLeft = GridToScreen(nodes.positions[slot], panning);
+            ImVec2 titleEnd(topLeft.x + kOverviewNodeWidth * zoom, topLeft.y + kOverviewTitleHeight * zoom);
+            ImVec2 bottomRight(titleEnd.x, topLeft.y + kOverviewNodeHeight * zoom);
+            ImU32 titleColor = id == kernel.brokenNode ? kBrokenNodeColor : kNodeKindColors[nodes.kinds[slot]];
+            drawList->AddRectFilled(topLeft, bottomRight, kOverviewBodyColor);
+            drawList->AddRectFilled(topLeft, titleEnd, titleColor);
+
+            const char *name = KindInfo(nodes.kinds[slot]).name;
+            if (ImGui::CalcTextSize(name).x + 8.0f <= titleEnd.x - topLeft.x)
+                drawList->AddText(ImVec2(topLeft.x + 4.0f, topLeft.y + 2.0f), IM_COL32_WHITE, name);
+        }
+    }
+    else
+    {
+        // Boxes only a few pixels wide are drawn once per canvas cell, and
+        // only their links are drawn. The survivors are counted first so
+        // they can be reserved in large batches. A small mesh gets half its
+        // vertices for boxes, merging them into coarser cells until they
+        // fit; boxes sticking out of the canvas are never merged, so what is
+        // left over at canvas-sized cells is cut.
+        size_t maxRects = SIZE_MAX;
+        if (!largeMesh)
+            maxRects = static_cast<size_t>(std::max(kSmallMeshVertices - drawList->VtxBuffer.Size, 0)) / 8;
+        float cellPixels = kOverviewCellPixels;
+        float maxCellPixels = std::max(editorView.canvasSize.x, editorView.canvasSize.y);
+        bool merge = kOverviewNodeWidth * zoom < kOverviewCellPixels * 2.0f;
+        size_t drawn = editorView.nodes.size();
+        for (;;)
+        {
+            editorView.covered.assign((static_cast<size_t>(editorView.canvasSize.x / cellPixels) + 1) *
+                                          (static_cast<size_t>(editorView.canvasSize.y / cellPixels) + 1),
+                                      0);
+            drawn = 0;
+            for (int id : editorView.nodes)
+            {
+                ImVec2 topLeft = GridToScreen(nodes.positions[NodeSlot(id)], panning);
+                if (!merge || CoverCell(topLeft, cellPixels))
+                    editorView.nodes[drawn++] = id;
+            }
+            editorView.nodes.resize(drawn);
+            if (drawn <= maxRects || cellPixels >= maxCellPixels)
+                break;
+            merge = true;
+            cellPixels *= 2.0f;
+        }
+        drawn = std::min(drawn, maxRects);
+        editorView.nodes.resize(drawn);
+
+        for (size_t i = 0; i < drawn; ++i)
+        {
+            if (i % kOverviewBatchRects == 0)
+            {
+                int count = static_cast<int>(std::min(drawn - i, kOverviewBatchRects));
+                drawList->PrimReserve(count * 6, count * 4);
+            }
+
+            int id = editorView.nodes[i];
+            int slot = NodeSlot(id);
+            ImVec2 topLeft = GridToScreen(nodes.positions[slot], panning);
+            ImVec2 bottomRight(topLeft.x + std::max(kOverviewNodeWidth * zoom, 1.0f),
+                               topLeft.y + std::max(kOverviewNodeHeight * zoom, 1.0f));
+            drawList->PrimRect(topLeft, bottomRight, id == kernel.brokenNode ? kBrokenNodeColor : kNodeKindColors[nodes.kinds[slot]]);
+        }
+        DrawOverviewLinks(drawList, panning, 1.0f, maxVertices);
+    }
+
+    ImGui::End();
+}
+
+// Compares the nasm output of the cross-check job with the in-process image
+// and reports the first byte where they disagree.
+void CompareWithNasm(const std::vector<uint8_t> &image)
+{
+    std::ifstream inFile("kernel.nasm.bin", std::ios::binary);
+    std::vector<uint8_t> reference((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+
+    auto mismatch = std::mismatch(image.begin(), image.end(), reference.begin(), reference.end());
+    if (mismatch.first == image.end() && mismatch.second == reference.end())
+        ConsoleAppend(console, ConsoleLine{"NASM cross-check: identical (" + std::to_string(image.size()) + " bytes)", false});
+    else
+        ConsoleAppend(console, ConsoleLine{"NASM cross-check: differs at offset " + std::to_string(mismatch.first - image.begin()), true});
+}
+
+// Assembles the validated graph in-process into kernel.bin. When the
+// content hash matches the last build, the existing kernel.bin is reused
+// without touching the disk. writeSource also brings kernel.asm up to date.
+// Called once UpdateBackgroundJobs() has finished validation and emission.
+bool BuildKernelImage(bool writeSource)
+{
+    const KernelProgram &program = kernelValidation.program;
+
+    if (!KernelPathIsValid(program))
+    {
+        std::cout << "Code is not valid!\n";
+        return false;
+    }
+
+    std::string error;
+    if (!UpdateKernelImage(program, error))
+    {
+        std::cout << error << "\n";
+        return false;
+    }
+
+    if (kernelBuild.written && kernelBuild.writtenHash == kernelBuild.imageHash)
+    {
+        std::cout << "Kernel unchanged, reusing kernel.bin\n";
+    }
+    else
+    {
+        WriteKernelImage(kernelBuild.image);
+        kernelBuild.writtenHash = kernelBuild.imageHash;
+        kernelBuild.written = true;
+    }
+
+    if (writeSource && !KernelSourceSaved())
+    {
+        StepAssemblerEmit(JobClock::time_point::max());
+        WriteAssembler();
+    }
+    return true;
+}
+
+void StartQemu()
+{
+    qmpSocketPath = "/tmp/tkit-qmp-" + std::to_string(getpid()) + ".sock";
+    unlink(qmpSocketPath.c_str());
+    StartJob(qemuRunner, "QEMU", {{"qemu-system-x86_64", "-m", "256M", "-fda", "kernel.bin", "-qmp", "unix:" + qmpSocketPath + ",server=on,wait=off"}});
+}
+
+// Points the running QEMU's floppy at the new kernel.bin and resets the
+// machine, skipping the seconds a cold QEMU start takes. The image is raw,
+// which cannot hold the internal snapshot loadvm needs, so a reset through
+// the BIOS is the fastest reboot available. The commands run on the QMP
+// session's worker and UpdateJobs() reports how they went.
+void ReloadQemu()
+{
+    std::vector<std::string> commands = {
+        "{\"execute\": \"blockdev-change-medium\", \"arguments\": {\"device\": \"floppy0\", \"filename\": " + QmpQuote("kernel.bin") + ", \"format\": \"raw\"}}",
+        "{\"execute\": \"system_reset\"}"};
+    if (!QmpSubmit(qmp, qmpSocketPath, std::move(commands)))
+        ConsoleAppend(console, ConsoleLine{"QMP: the previous reload is still running", true});
+}
+
+void StopQemu()
+{
+    QmpShutdown(qmp);
+    CancelJob(qemuRunner);
+}
+
+void RunKernel()
+{
+    if (!BuildKernelImage(false))
+        return;
+
+    if (qemuRunner.state == JobRunning)
+        ReloadQemu();
+    else
+        StartQemu();
+}
+
+void StartNasmCrossCheck()
+{
+    if (!BuildKernelImage(true))
+        return;
+
+    crossCheckImage = kernelBuild.image;
+    crossCheckPending = StartJob(jobRunner, "NASM cross-check", {{"nasm", "-f", "bin", "kernel.asm", "-o", "kernel.nasm.bin"}});
+}
+
+// Collects job output for the console and finishes a cross-check once nasm
+// has exited.
+void UpdateJobs()
+{
+    PollJob(jobRunner, console);
+    PollJob(qemuRunner, console);
+
+    bool qmpOk = false;
+    std::string qmpError;
+    if (QmpTakeResult(qmp, qmpOk, qmpError))
+        ConsoleAppend(console, qmpOk ? ConsoleLine{"QEMU reset with the new kernel.bin", false} : ConsoleLine{"QMP: " + qmpError, true});
+
+    if (qemuRunner.state != JobRunning && !qmpSocketPath.empty())
+    {
+        QmpShutdown(qmp);
+        unlink(qmpSocketPath.c_str());
+        qmpSocketPath.clear();
+    }
+
+    if (crossCheckPending && jobRunner.state != JobRunning)
+    {
+        crossCheckPending = false;
+        if (jobRunner.state == JobSucceeded)
+            CompareWithNasm(crossCheckImage);
+    }
+}
+
+// Re-runs the kernel in the emulator once validation has settled and the
+// content differs from the last run. Hashing and encoding share the frame's
+// job budget and unchanged nodes come from the code cache; the run itself
+// is on the emulator's worker, and a result for content that has changed
+// since is dropped. The previous result stays up until the new one lands.
+void UpdatePreview(JobClock::time_point deadline)
+{
+    EmulatorResult result;
+    if (EmulatorTakeResult(previewEmulator, result) && kernelPreview.runHash == kernelPreview.hash)
+        kernelPreview.result = std::move(result);
+
+    if (kernelValidation.walking || kernelValidation.dirty)
+        return;
+
+    const KernelProgram &program = kernelValidation.program;
+    if (!program.hasStart || !program.reachesEnd)
+    {
+        if (kernelPreview.current || kernelPreview.error.empty())
+        {
+            kernelPreview.current = false;
+            kernelPreview.runPending = false;
+            kernelPreview.error = "Kernel is not valid";
+            kernelPreview.result = EmulatorResult();
+        }
+        return;
+    }
+
+    if (!StepKernelContentHash(deadline))
+        return;
+
+    uint64_t hash = KernelContentHash();
+    if (!kernelPreview.current || kernelPreview.hash != hash)
+    {
+        bool ok = false;
+        std::string error;
+        if (!StepKernelImage(program, deadline, ok, error))
+            return;
+
+        kernelPreview.hash = hash;
+        kernelPreview.current = true;
+        kernelPreview.runPending = ok;
+        kernelPreview.error = error;
+        if (!ok)
+            kernelPreview.result = EmulatorResult();
+    }
+
+    if (kernelPreview.runPending && EmulatorSubmit(previewEmulator, kernelBuild.image, kPreviewMaxSteps))
+    {
+        kernelPreview.runPending = false;
+        kernelPreview.runHash = hash;
+    }
+}
+
+void DrawPreview()
+{
+    ImGui::Begin("Preview");
+
+    const EmulatorResult &result = kernelPreview.result;
+    if (!kernelPreview.error.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", kernelPreview.error.c_str());
+    else if (result.stop == EmulatorUnsupported || result.stop == EmulatorStepLimit)
+        ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.4f, 1.0f), "Stopped: %s (%llu steps)", result.message.c_str(), static_cast<unsigned long long>(result.steps));
+    else
+        ImGui::TextDisabled("Stopped: %s (%llu steps)", result.message.c_str(), static_cast<unsigned long long>(result.steps));
+    ImGui::Separator();
+
+    for (const std::string &row : result.screen)
+        ImGui::TextUnformatted(row.data(), row.data() + row.size());
+
+    ImGui::End();
+}
+
+// Text fields for the selected nodes, one row each. The list is clipped to
+// the rows in view, so a large selection costs no more widgets than fit in
+// the window.
+void DrawProperties()
+{
+    ImGui::Begin("Properties");
+
+    const std::vector<int> &selection = editorView.selection;
+    if (selection.empty())
+        ImGui::TextDisabled("Select nodes to edit them");
+    else
+        ImGui::Text("%d selected", static_cast<int>(selection.size()));
+    ImGui::Separator();
+
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(selection.size()), ImGui::GetFrameHeightWithSpacing());
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+        {
+            int id = selection[row];
+            if (NodeSlot(id) < 0)
+            {
+                ImGui::TextDisabled("deleted");
+                continue;
+            }
+
+            NodeKind kind = KindOf(id);
+            ImGui::PushID(id);
+            ImGui::AlignTextToFramePadding();
+            ImGui::Text("%-12s", KindInfo(kind).name);
+            if (kNodeKindEditors[kind] != nullptr)
+            {
+                ImGui::SameLine();
+                kNodeKindEditors[kind](id);
+            }
+            ImGui::PopID();
+        }
+    }
+    clipper.End();
+
+    ImGui::End();
+}
+
+// Rolling per-stage histograms of the last kProfileHistory frames. Frames
+// are only drawn when something changes, so idle time shows up in Events.
+void DrawProfiler()
+{
+    if (!frameProfiler.enabled)
+        return;
+
+    ImGui::SetNextWindowBgAlpha(0.85f);
+    if (ImGui::Begin("Profiler", &frameProfiler.enabled, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        int offset = static_cast<int>(frameProfiler.frame % kProfileHistory);
+        char overlay[64];
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            if (stage == StageGpu && !gpuTimer.available)
+            {
+                ImGui::TextDisabled("GPU: timer queries not supported");
+                continue;
+            }
+
+            float average;
+            float maximum;
+            ProfileStageStats(frameProfiler, static_cast<ProfileStage>(stage), average, maximum);
+            snprintf(overlay, sizeof(overlay), "avg %.3f ms  max %.3f ms", average, maximum);
+            ImGui::PlotHistogram(kProfileStageNames[stage], frameProfiler.stageMs[stage], kProfileHistory, offset, overlay,
+                                 0.0f, maximum > 0.0f ? maximum : 1.0f, ImVec2(320.0f, 40.0f));
+        }
+
+        std::string error;
+        if (ImGui::Button("Export CSV"))
+        {
+            if (ExportProfileCsv(frameProfiler, "profile.csv", error))
+                ConsoleAppend(console, ConsoleLine{"Wrote profile.csv", false});
+            else
+                ConsoleAppend(console, ConsoleLine{error, true});
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Export Chrome trace"))
+        {
+            if (ExportChromeTrace(frameProfiler, "profile.json", error))
+                ConsoleAppend(console, ConsoleLine{"Wrote profile.json", false});
+            else
+                ConsoleAppend(console, ConsoleLine{error, true});
+        }
+    }
+    ImGui::End();
+}
+
+// Output of build and run jobs. Keeps following new output while scrolled
+// to the bottom.
+void DrawConsole()
 {
-    int id;
-    std::string type;
-    char letter[2];
-    char instruction[256];
-};
+    ImGui::Begin("Console");
+
+    bool running = jobRunner.state == JobRunning;
+    ImGui::BeginDisabled(!running);
+    if (ImGui::Button("Cancel"))
+        CancelJob(jobRunner);
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    if (ImGui::Button("Clear"))
+        ConsoleClear(console);
+    if (running)
+    {
+        ImGui::SameLine();
+        ImGui::Text("Running %s...", jobRunner.name.c_str());
+    }
+    ImGui::Separator();
+
+    ImGui::BeginChild("ConsoleOutput", ImVec2(0.0f, 0.0f), false, ImGuiWindowFlags_HorizontalScrollbar);
+    bool follow = ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
+
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(ConsoleSize(console)));
+    while (clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+        {
+            const ConsoleLine &line = ConsoleLineAt(console, i);
+            if (line.error)
+                ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f));
+            ImGui::TextUnformatted(line.text.data(), line.text.data() + line.text.size());
+            if (line.error)
+                ImGui::PopStyleColor();
+        }
+    }
+    clipper.End();
 
-std::vector<Node> nodes;
-std::vector<int> links;
+    if (follow)
+        ImGui::SetScrollHereY(1.0f);
+    ImGui::EndChild();
+    ImGui::End();
+}
 
-bool KernelPathIsValid()
+// Runs pending validation and save work until the frame's job deadline so
+// large graphs never stall a frame; whatever is left continues next frame.
+void UpdateBackgroundJobs(JobClock::time_point deadline)
 {
-    auto startNodeIt = std::find_if(nodes.begin(), nodes.end(), [](const Node &node)
-                                    { return node.type == "kernel_start"; });
+    if (!StepKernelValidation(deadline))
+        return;
 
-    if (startNodeIt == nodes.end())
+    if (pendingKernelAction != KernelActionNone)
     {
-        std::cout << "kernel_start not found!\n";
-        return false;
+        if (pendingKernelAction == KernelActionCrossCheck && KernelPathIsValid(kernelValidation.program) &&
+            !KernelSourceSaved() && !StepAssemblerEmit(deadline))
+            return;
+
+        KernelAction action = pendingKernelAction;
+        pendingKernelAction = KernelActionNone;
+        if (action == KernelActionRun)
+            RunKernel();
+        else
+            StartNasmCrossCheck();
     }
 
-    std::set<int> visitedNodes;
+    if (!assemblerEmit.requested)
+        return;
 
-    std::function<bool(int)> checkPath = [&](int currentNodeId)
+    if (!KernelPathIsValid(kernelValidation.program))
     {
-        visitedNodes.insert(currentNodeId);
+        std::cout << "Code is not valid!\n";
+        assemblerEmit.requested = false;
+        return;
+    }
 
-        for (int i = 0; i < links.size(); i += 2)
-        {
-            if (links[i] == currentNodeId && visitedNodes.find(links[i + 1]) == visitedNodes.end())
-            {
-                auto nodeIt = std::find_if(nodes.begin(), nodes.end(), [&](const Node &node)
-                                           { return node.id == links[i + 1]; });
+    if (KernelSourceSaved())
+    {
+        std::cout << "No changes to save.\n";
+        assemblerEmit.requested = false;
+        return;
+    }
 
-                if (nodeIt != nodes.end())
-                {
-                    if (nodeIt->type == "kernel_end")
-                    {
-                        return true;
-                    }
-                    else if (nodeIt->type == "print_char" || nodeIt->type == "instruction")
-                    {
-                        if (checkPath(nodeIt->id + 10000))
-                        {
-                            return true;
-                        }
-                    }
-                    else if (checkPath(nodeIt->id))
-                    {
-                        return true;
-                    }
-                }
-            }
-        }
+    if (StepAssemblerEmit(deadline))
+    {
+        WriteAssembler();
+        assemblerEmit.requested = false;
+    }
+}
 
-        return false;
-    };
+// Work that needs the next frame right away rather than on a timer.
+bool FrameWorkPending()
+{
+    return kernelValidation.walking || kernelValidation.dirty || assemblerEmit.requested ||
+           pendingKernelAction != KernelActionNone;
+}
 
-    return checkPath(startNodeIt->id);
+int EffectiveFrameCap()
+{
+    if (!framePacing.lowPower)
+        return framePacing.frameCap;
+    return framePacing.frameCap > 0 ? std::min(framePacing.frameCap, kLowPowerFrameCap) : kLowPowerFrameCap;
 }
 
-void SaveNodesToAssembler()
+// Blocks until the next frame is due and processes the events that arrived.
+void WaitForFrame()
 {
-    if (!KernelPathIsValid())
+    if (FrameWorkPending())
+        framePacing.settleFrames = kSettleFrames;
+
+    if (framePacing.settleFrames > 0)
     {
-        std::cout << "Code is not valid!\n";
-        return;
+        --framePacing.settleFrames;
+        glfwPollEvents();
     }
+    else
+    {
+        double timeout = 0.0;
+        if (jobRunner.state == JobRunning || qemuRunner.state == JobRunning)
+            timeout = framePacing.lowPower ? kLowPowerJobWakeSeconds : kJobWakeSeconds;
+        if (ImGui::GetIO().WantTextInput && (timeout == 0.0 || timeout > kTextCursorWakeSeconds))
+            timeout = kTextCursorWakeSeconds;
 
-    std::ofstream outFile("kernel.asm");
+        if (timeout > 0.0)
+            glfwWaitEventsTimeout(timeout);
+        else
+            glfwWaitEvents();
+        framePacing.settleFrames = kSettleFrames;
+    }
 
-    outFile << "org 0x7C00\n";
-    outFile << "bits 16\n";
+    int frameCap = EffectiveFrameCap();
+    if (frameCap > 0)
+    {
+        double remaining = framePacing.lastFrame + 1.0 / frameCap - glfwGetTime();
+        if (remaining > 0.0)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+            glfwPollEvents();
+        }
+    }
+    framePacing.lastFrame = glfwGetTime();
+}
 
-    std::set<int> visitedNodes;
+// The live ImNodes editor, used at full zoom.
+void DrawNodeEditor(const KernelProgram &kernel)
+{
+    ImNodes::BeginNodeEditor();
+    ImVec2 canvasOrigin = ImGui::GetCursorScreenPos();
 
-    std::function<void(int)> writeInstructions = [&](int currentNodeId)
+    if (ImGui::BeginPopupContextWindow())
     {
-        visitedNodes.insert(currentNodeId);
-
-        for (int i = 0; i < links.size(); i += 2)
+        for (int kind = 0; kind < NodeKindCount; ++kind)
         {
-            if (links[i] == currentNodeId && visitedNodes.find(links[i + 1]) == visitedNodes.end())
+            if (ImGui::MenuItem(KindInfo(static_cast<NodeKind>(kind)).addLabel))
             {
-                auto nodeIt = std::find_if(nodes.begin(), nodes.end(), [&](const Node &node)
-                                           { return node.id == links[i + 1]; });
-
-                if (nodeIt != nodes.end())
-                {
-                    if (nodeIt->type == "print_char")
-                    {
-                        outFile << "mov ah, 0x0e\n";
-                        outFile << "mov al, '" << nodeIt->letter[0] << "'\n";
-                        outFile << "int 0x10\n";
-
-                        writeInstructions(nodeIt->id + 10000);
-                    }
-                    if (nodeIt->type == "instruction")
-                    {
-                        outFile << nodeIt->instruction << "\n";
-                        writeInstructions(nodeIt->id + 10000);
-                    }
-                    else if (nodeIt->type == "kernel_end")
-                    {
-                        outFile << "times 510-($-$$) db 0\n";
-                        outFile << "dw 0AA55h\n";
-                    }
-                }
+                int id = CreateNode(static_cast<NodeKind>(kind));
+                ImVec2 panning = ImNodes::EditorContextGetPanning();
+                NodePosition position = {kNewNodeInset - panning.x, kNewNodeInset - panning.y};
+                SetNodePosition(id, position);
+                JournalCreateNode(journal, id, static_cast<NodeKind>(kind), position);
             }
         }
-    };
 
-    auto startNodeIt = std::find_if(nodes.begin(), nodes.end(), [](const Node &node)
-                                    { return node.type == "kernel_start"; });
+        ImGui::EndPopup();
+    }
 
-    if (startNodeIt == nodes.end())
+    BeginProfileStage(frameProfiler, StageNodes);
+    CollectViewNodes(editorView.canvasSize);
+    DrawFarLinks(canvasOrigin);
+    for (int node_id : editorView.nodes)
     {
-        std::cout << "kernel_start not found\n";
-        return;
-    }
+        int slot = NodeSlot(node_id);
+        if (slot < 0)
+            continue;
+        bool delete_node = false;
 
-    writeInstructions(startNodeIt->id);
+        bool broken = node_id == kernel.brokenNode;
+        if (broken)
+            ImNodes::PushColorStyle(ImNodesCol_TitleBar, IM_COL32(200, 60, 60, 255));
 
-    outFile.close();
-    std::cout << "Code saved!\n";
-}
+        const NodePosition &position = nodes.positions[slot];
+        ImNodes::SetNodeGridSpacePos(node_id, ImVec2(position.x, position.y));
+        ImNodes::BeginNode(node_id);
 
-int main()
-{
-    glfwSetErrorCallback([](int error, const char *description)
-                         { fprintf(stderr, "Glfw Error %d: %s\n", error, description); });
-    if (!glfwInit())
-        return 1;
+        ImNodes::BeginNodeTitleBar();
+        const NodeKindInfo &info = KindInfo(nodes.kinds[slot]);
+        ImGui::TextUnformatted(info.name);
+        ImNodes::EndNodeTitleBar();
 
-    const char *glsl_version = "#version 130";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+        if (info.inputLabel != nullptr)
+        {
+            ImNodes::BeginInputAttribute(PinAttr(InputPin(node_id)));
+            ImGui::TextUnformatted(info.inputLabel);
+            ImNodes::EndInputAttribute();
+        }
 
-    GLFWwindow *window = glfwCreateWindow(1280, 720, "TKit", NULL, NULL);
-    if (window == NULL)
-        return 1;
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+        if (info.outputLabel != nullptr)
+        {
+            ImNodes::BeginOutputAttribute(PinAttr(OutputPin(node_id)));
+            ImGui::TextUnformatted(info.outputLabel);
+            ImNodes::EndOutputAttribute();
+        }
 
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO &io = ImGui::GetIO();
-    (void)io;
+        DrawNodeBody drawBody = kNodeKindBodies[nodes.kinds[slot]];
+        if (drawBody != nullptr)
+            drawBody(node_id);
 
-    ImGui::StyleColorsDark();
+        if (ImGui::BeginPopupContextItem("NodeContext"))
+        {
+            if (ImGui::MenuItem("Delete"))
+            {
+                delete_node = true;
+            }
+            ImGui::EndPopup();
+        }
 
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init(glsl_version);
+        ImNodes::EndNode();
 
-    ImNodes::CreateContext();
+        if (broken)
+            ImNodes::PopColorStyle();
 
-    while (!glfwWindowShouldClose(window))
-    {
-        glfwPollEvents();
+        if (delete_node)
+        {
+            JournalDeleteNode(journal, node_id);
+            DeleteNode(node_id);
+        }
+    }
+
+    SubmitViewLinks();
+    EndProfileStage(frameProfiler, StageNodes);
+
+    BeginProfileStage(frameProfiler, StageEndNodeEditor);
+    ImNodes::EndNodeEditor();
+    ReadViewPositions();
+    EndProfileStage(frameProfiler, StageEndNodeEditor);
 
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+    const ImGuiIO &io = ImGui::GetIO();
+    if (ImNodes::IsEditorHovered() && io.KeyCtrl && io.MouseWheel < 0.0f)
+        ZoomCanvas(editorView.zoom / kZoomStep, io.MousePos);
 
-        if (ImGui::BeginMainMenuBar())
+    int start_attr, end_attr;
+    if (ImNodes::IsLinkCreated(&start_attr, &end_attr) && CanLink(PinFromAttr(start_attr), PinFromAttr(end_attr)) &&
+        FindLink(PinFromAttr(start_attr), PinFromAttr(end_attr)) < 0)
+    {
+        AddLink(PinFromAttr(start_attr), PinFromAttr(end_attr));
+        JournalAddLink(journal, PinFromAttr(start_attr), PinFromAttr(end_attr));
+    }
+
+    int link_id;
+    while (ImNodes::IsLinkDestroyed(&link_id))
+    {
+        int link_slot = LinkSlot(link_id);
+        if (link_slot >= 0)
         {
-            if (ImGui::BeginMenu("File"))
-            {
-                if (ImGui::MenuItem("Save"))
-                {
-                    SaveNodesToAssembler();
-                }
-                ImGui::EndMenu();
-            }
-            if (ImGui::BeginMenu("Run"))
-            {
-                if (ImGui::MenuItem("Run"))
-                {
-                    system("nasm -f bin kernel.asm -o kernel.bin && qemu-system-x86_64 -m 256M -fda kernel.bin");
-                }
-                ImGui::EndMenu();
-            }
-            ImGui::EndMainMenuBar();
+            JournalRemoveLink(journal, links.starts[link_slot], links.ends[link_slot]);
+            RemoveLink(link_id);
         }
+    }
+
+    EditCommand edit = pendingEdit != EditNone ? pendingEdit : EditShortcut();
+    pendingEdit = EditNone;
+    ApplyEdit(edit);
+    editorView.selection = SelectedNodes();
+}
 
-        ImVec2 winSize = ImGui::GetIO().DisplaySize;
-        float menuHeight = ImGui::GetFrameHeightWithSpacing();
-        ImGui::SetNextWindowPos(ImVec2(0, menuHeight));
-        ImGui::SetNextWindowSize(ImVec2(winSize.x, winSize.y - menuHeight));
+// One editor frame, from ImGui's NewFrame to the rendered draw data. The
+// main loop wraps it in event handling and the swap; --render-bench drives
+// it with scripted input.
+void DrawFrame(GLFWwindow *window)
+{
+    BeginProfileStage(frameProfiler, StageNewFrame);
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+    EndProfileStage(frameProfiler, StageNewFrame);
 
-        ImNodes::BeginNodeEditor();
+    BeginProfileStage(frameProfiler, StageUpdate);
+    auto deadline = JobClock::now() + std::chrono::duration_cast<JobClock::duration>(
+                                          std::chrono::duration<double, std::milli>(kFrameJobBudgetMs));
+    UpdateBackgroundJobs(deadline);
+    UpdateJobs();
+    UpdatePreview(deadline);
+    EndProfileStage(frameProfiler, StageUpdate);
+    const KernelProgram &kernel = kernelValidation.program;
 
-        if (ImGui::BeginPopupContextWindow())
+    if (ImGui::BeginMainMenuBar())
+    {
+        if (ImGui::BeginMenu("File"))
         {
-            if (ImGui::MenuItem("Add kernel_start"))
-            {
-                nodes.push_back({static_cast<int>(nodes.size()), "kernel_start"});
-            }
-            if (ImGui::MenuItem("Add kernel_end"))
+            if (ImGui::MenuItem("Save"))
             {
-                nodes.push_back({static_cast<int>(nodes.size()), "kernel_end"});
+                assemblerEmit.requested = true;
             }
-            if (ImGui::MenuItem("Add print_char"))
+            if (ImGui::MenuItem("Open Project"))
             {
-                Node new_node;
-                new_node.id = static_cast<int>(nodes.size());
-                new_node.type = "print_char";
-                new_node.letter[0] = 'A';
-                new_node.letter[1] = '\0';
-                nodes.push_back(new_node);
+                LoadGraphFile(kGraphPath);
             }
-            if (ImGui::MenuItem("Add instruction"))
+            if (ImGui::MenuItem("Save Project"))
             {
-                Node new_node;
-                new_node.id = static_cast<int>(nodes.size());
-                new_node.type = "instruction";
-                std::fill(std::begin(new_node.instruction), std::end(new_node.instruction), 0);
-                nodes.push_back(new_node);
+                SaveGraphFile(kGraphPath);
             }
-
-            ImGui::EndPopup();
+            ImGui::EndMenu();
         }
-
-        for (auto node_it = nodes.begin(); node_it != nodes.end();)
+        if (ImGui::BeginMenu("Edit"))
         {
-            ImNodes::BeginNode(node_it->id);
-
-            ImNodes::BeginNodeTitleBar();
-            ImGui::TextUnformatted(node_it->type.c_str());
-            ImNodes::EndNodeTitleBar();
-
-            if (node_it->type == "kernel_start")
+            if (ImGui::MenuItem("Delete", "Del"))
+                pendingEdit = EditDelete;
+            if (ImGui::MenuItem("Duplicate", "Ctrl+D"))
+                pendingEdit = EditDuplicate;
+            if (ImGui::MenuItem("Copy", "Ctrl+C"))
+                pendingEdit = EditCopy;
+            if (ImGui::MenuItem("Paste", "Ctrl+V", false, !clipboard.empty()))
+                pendingEdit = EditPaste;
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Run"))
+        {
+            bool running = jobRunner.state == JobRunning;
+            if (ImGui::MenuItem("Run"))
             {
-                ImNodes::BeginOutputAttribute(node_it->id);
-                ImGui::Text("Start");
-                ImNodes::EndOutputAttribute();
+                pendingKernelAction = KernelActionRun;
             }
-            else if (node_it->type == "kernel_end")
+            if (ImGui::MenuItem("Cross-check with NASM", NULL, false, !running))
             {
-                ImNodes::BeginInputAttribute(node_it->id);
-                ImGui::Text("End");
-                ImNodes::EndInputAttribute();
+                pendingKernelAction = KernelActionCrossCheck;
             }
-            else if (node_it->type == "print_char")
+            if (ImGui::MenuItem("Cancel", NULL, false, running))
             {
-                ImNodes::BeginInputAttribute(node_it->id);
-                ImGui::Text("Input");
-                ImNodes::EndInputAttribute();
-
-                ImNodes::BeginOutputAttribute(node_it->id + 10000);
-                ImGui::Text("Output");
-                ImNodes::EndOutputAttribute();
-
-                ImGui::InputText("Letter", node_it->letter, 2);
+                CancelJob(jobRunner);
             }
-            else if (node_it->type == "instruction")
+            if (ImGui::MenuItem("Stop QEMU", NULL, false, qemuRunner.state == JobRunning))
             {
-                ImNodes::BeginInputAttribute(node_it->id);
-                ImGui::Text("Input");
-                ImNodes::EndInputAttribute();
-
-                ImNodes::BeginOutputAttribute(node_it->id + 10000);
-                ImGui::Text("Output");
-                ImNodes::EndOutputAttribute();
-
-                ImGui::InputText("Instruction", node_it->instruction, sizeof(node_it->instruction));
+                StopQemu();
             }
-
-            if (ImGui::BeginPopupContextItem("NodeContext"))
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("View"))
+        {
+            ImGui::MenuItem("Low power", NULL, &framePacing.lowPower);
+            ImGui::MenuItem("Profiler", NULL, &frameProfiler.enabled);
+            if (ImGui::MenuItem("Zoom in", NULL, false, editorView.zoom < 1.0f))
+                ZoomCanvas(editorView.zoom * kZoomStep, CanvasCenter());
+            if (ImGui::MenuItem("Zoom out", "Ctrl+Wheel", false, editorView.zoom > kMinZoom))
+                ZoomCanvas(editorView.zoom / kZoomStep, CanvasCenter());
+            if (ImGui::MenuItem("Actual size", NULL, false, editorView.zoom < 1.0f))
+                ZoomCanvas(1.0f, CanvasCenter());
+            if (ImGui::BeginMenu("Frame cap"))
             {
-                if (ImGui::MenuItem("Delete"))
+                for (int cap : kFrameCapChoices)
                 {
-                    node_it = nodes.erase(node_it);
-                    continue;
+                    std::string label = cap > 0 ? std::to_string(cap) + " fps" : "Unlimited";
+                    if (ImGui::MenuItem(label.c_str(), NULL, framePacing.frameCap == cap))
+                        framePacing.frameCap = cap;
                 }
-                ImGui::EndPopup();
+                ImGui::EndMenu();
             }
+            ImGui::EndMenu();
+        }
 
-            ImNodes::EndNode();
-
-            ++node_it;
+        ImGui::Separator();
+        if (kernelValidation.walking || kernelValidation.dirty)
+        {
+            float progress = nodes.empty() ? 0.0f : static_cast<float>(kernel.order.size()) / nodes.size();
+            ImGui::ProgressBar(progress, ImVec2(160.0f, 0.0f), "Validating");
+        }
+        else if (assemblerEmit.requested || pendingKernelAction == KernelActionCrossCheck)
+        {
+            float progress = kernel.order.empty() ? 0.0f : static_cast<float>(assemblerEmit.offsets.size()) / kernel.order.size();
+            ImGui::ProgressBar(progress, ImVec2(160.0f, 0.0f), "Saving");
+        }
+        else if (!kernel.hasStart)
+        {
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "kernel_start not found");
         }
+        else if (kernel.reachesEnd)
+        {
+            ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f), "Kernel valid, path length %d", static_cast<int>(kernel.order.size()));
+        }
+        else if (kernel.brokenNode >= 0)
+        {
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Kernel broken at node %d (%s), path length %d",
+                               kernel.brokenNode, KindInfo(KindOf(kernel.brokenNode)).name, static_cast<int>(kernel.order.size()));
+        }
+        else
+        {
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "kernel_end not reachable, path length %d", static_cast<int>(kernel.order.size()));
+        }
+        ImGui::EndMainMenuBar();
+    }
+
+    ImVec2 winSize = ImGui::GetIO().DisplaySize;
+    float menuHeight = ImGui::GetFrameHeightWithSpacing();
+    editorView.canvasOrigin = ImVec2(0, menuHeight);
+    editorView.canvasSize = ImVec2(winSize.x, winSize.y - menuHeight);
+    ImGui::SetNextWindowPos(editorView.canvasOrigin);
+    ImGui::SetNextWindowSize(editorView.canvasSize);
+
+    if (editorView.zoom < 1.0f)
+    {
+        // Selection commands need the live editor.
+        pendingEdit = EditNone;
+        BeginProfileStage(frameProfiler, StageNodes);
+        DrawOverview(kernel);
+        EndProfileStage(frameProfiler, StageNodes);
+    }
+    else
+    {
+        DrawNodeEditor(kernel);
+    }
+
+    BeginProfileStage(frameProfiler, StageUpdate);
+    UpdateAutosave();
+    EndProfileStage(frameProfiler, StageUpdate);
+
+    DrawConsole();
+    DrawPreview();
+    DrawProperties();
+    DrawProfiler();
+
+    BeginProfileStage(frameProfiler, StageRender);
+    ImGui::Render();
+    EndProfileStage(frameProfiler, StageRender);
+
+    BeginProfileStage(frameProfiler, StageRenderDrawData);
+    BeginGpuTimer();
+    int display_w, display_h;
+    glfwGetFramebufferSize(window, &display_w, &display_h);
+    glViewport(0, 0, display_w, display_h);
+    glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    EndGpuTimer();
+    EndProfileStage(frameProfiler, StageRenderDrawData);
+}
+
+// --render-bench [frames] [nodes] [zoom] renders scripted frames over a
+// generated graph without a display, at full zoom or in the overview. It
+// runs on GLFW's null platform with a Mesa llvmpipe context (EGL, else
+// OSMesa) and draws into an offscreen framebuffer. The editor pans across
+// the graph every frame and one JSON line with frame time and draw-data
+// totals is printed.
+struct RenderBenchOptions
+{
+    bool enabled = false;
+    int frames = 600;
+    int nodes = 2000;
+    float zoom = 1.0f;
+};
+
+constexpr int kRenderBenchWarmupFrames = 10;
+constexpr int kRenderBenchColumns = 40;
+constexpr float kRenderBenchSpacingX = 220.0f;
+constexpr float kRenderBenchSpacingY = 140.0f;
+constexpr float kRenderBenchPanStep = 23.0f;
+
+bool ParseRenderBench(int argc, char **argv, RenderBenchOptions &options)
+{
+    if (argc < 2 || strcmp(argv[1], "--render-bench") != 0)
+        return false;
+
+    options.enabled = true;
+    if (argc > 2)
+        options.frames = std::max(atoi(argv[2]), 1);
+    if (argc > 3)
+        options.nodes = std::max(atoi(argv[3]), 2);
+    if (argc > 4)
+        options.zoom = std::min(std::max(static_cast<float>(atof(argv[4])), kMinZoom), 1.0f);
+    return true;
+}
+
+// kernel_start, a chain of instructions and kernel_end laid out in rows.
+void BuildRenderBenchGraph(int nodeCount)
+{
+    ClearGraph();
+    int previous = CreateNode(NodeKernelStart);
+    for (int i = 1; i < nodeCount; ++i)
+    {
+        int id = CreateNode(i + 1 == nodeCount ? NodeKernelEnd : NodeInstruction);
+        if (i + 1 < nodeCount)
+            SetNodeText(id, "add ax, " + std::to_string(i));
+        AddLink(OutputPin(previous), InputPin(id));
+        previous = id;
+    }
+
+    for (size_t slot = 0; slot < nodes.size(); ++slot)
+    {
+        int column = static_cast<int>(slot) % kRenderBenchColumns;
+        int row = static_cast<int>(slot) / kRenderBenchColumns;
+        SetNodePosition(nodes.ids[slot], NodePosition{column * kRenderBenchSpacingX, row * kRenderBenchSpacingY});
+    }
+}
+
+// Color buffer the bench renders into. A surfaceless EGL context, which is
+// what the null platform can end up with, has no default framebuffer: draws
+// to it fail with GL_INVALID_FRAMEBUFFER_OPERATION and rasterize nothing.
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_RENDERBUFFER
+#define GL_RENDERBUFFER 0x8D41
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8 0x8058
+#endif
+
+struct BenchTarget
+{
+    void(APIENTRY *genFramebuffers)(GLsizei, GLuint *) = nullptr;
+    void(APIENTRY *deleteFramebuffers)(GLsizei, const GLuint *) = nullptr;
+    void(APIENTRY *bindFramebuffer)(GLenum, GLuint) = nullptr;
+    GLenum(APIENTRY *checkFramebufferStatus)(GLenum) = nullptr;
+    void(APIENTRY *genRenderbuffers)(GLsizei, GLuint *) = nullptr;
+    void(APIENTRY *deleteRenderbuffers)(GLsizei, const GLuint *) = nullptr;
+    void(APIENTRY *bindRenderbuffer)(GLenum, GLuint) = nullptr;
+    void(APIENTRY *renderbufferStorage)(GLenum, GLenum, GLsizei, GLsizei) = nullptr;
+    void(APIENTRY *framebufferRenderbuffer)(GLenum, GLenum, GLenum, GLuint) = nullptr;
+
+    GLuint framebuffer = 0;
+    GLuint renderbuffer = 0;
+};
+
+// Creates the target and leaves it bound.
+bool CreateBenchTarget(BenchTarget &target, int width, int height)
+{
+    LoadGlProc(target.genFramebuffers, "glGenFramebuffers");
+    LoadGlProc(target.deleteFramebuffers, "glDeleteFramebuffers");
+    LoadGlProc(target.bindFramebuffer, "glBindFramebuffer");
+    LoadGlProc(target.checkFramebufferStatus, "glCheckFramebufferStatus");
+    LoadGlProc(target.genRenderbuffers, "glGenRenderbuffers");
+    LoadGlProc(target.deleteRenderbuffers, "glDeleteRenderbuffers");
+    LoadGlProc(target.bindRenderbuffer, "glBindRenderbuffer");
+    LoadGlProc(target.renderbufferStorage, "glRenderbufferStorage");
+    LoadGlProc(target.framebufferRenderbuffer, "glFramebufferRenderbuffer");
+    if (!target.genFramebuffers || !target.deleteFramebuffers || !target.bindFramebuffer || !target.checkFramebufferStatus ||
+        !target.genRenderbuffers || !target.deleteRenderbuffers || !target.bindRenderbuffer || !target.renderbufferStorage ||
+        !target.framebufferRenderbuffer)
+        return false;
+
+    target.genRenderbuffers(1, &target.renderbuffer);
+    target.bindRenderbuffer(GL_RENDERBUFFER, target.renderbuffer);
+    target.renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    target.genFramebuffers(1, &target.framebuffer);
+    target.bindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    target.framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.renderbuffer);
+    return target.checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void DestroyBenchTarget(BenchTarget &target)
+{
+    if (target.bindFramebuffer == nullptr)
+        return;
+    target.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (target.framebuffer != 0)
+        target.deleteFramebuffers(1, &target.framebuffer);
+    if (target.renderbuffer != 0)
+        target.deleteRenderbuffers(1, &target.renderbuffer);
+    target = BenchTarget();
+}
+
+int RunRenderBench(GLFWwindow *window, const RenderBenchOptions &options)
+{
+    int targetWidth;
+    int targetHeight;
+    glfwGetFramebufferSize(window, &targetWidth, &targetHeight);
+    BenchTarget target;
+    if (!CreateBenchTarget(target, targetWidth, targetHeight))
+    {
+        DestroyBenchTarget(target);
+        fprintf(stderr, "--render-bench could not create an offscreen framebuffer\n");
+        return 1;
+    }
+
+    BuildRenderBenchGraph(options.nodes);
+    editorView.zoom = options.zoom;
+
+    float width = kRenderBenchColumns * kRenderBenchSpacingX;
+    float height = (options.nodes / kRenderBenchColumns + 1) * kRenderBenchSpacingY;
+    std::vector<double> frameMs;
+    uint64_t drawCalls = 0;
+    uint64_t vertices = 0;
+    uint64_t indices = 0;
+
+    for (int frame = 0; frame < kRenderBenchWarmupFrames + options.frames; ++frame)
+    {
+        glfwPollEvents();
+        float pan = frame * kRenderBenchPanStep;
+        ImNodes::EditorContextResetPanning(ImVec2(-fmodf(pan, width), -fmodf(pan * 0.25f, height)));
+
+        JobClock::time_point start = JobClock::now();
+        DrawFrame(window);
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(JobClock::now() - start).count();
+
+        if (frame < kRenderBenchWarmupFrames)
+            continue;
+
+        frameMs.push_back(ms);
+        const ImDrawData *drawData = ImGui::GetDrawData();
+        for (int i = 0; i < drawData->CmdListsCount; ++i)
+            drawCalls += drawData->CmdLists[i]->CmdBuffer.Size;
+        vertices += drawData->TotalVtxCount;
+        indices += drawData->TotalIdxCount;
+    }
+
+    double total = 0.0;
+    for (double ms : frameMs)
+        total += ms;
+    std::sort(frameMs.begin(), frameMs.end());
+    size_t p99 = std::min(frameMs.size() - 1, static_cast<size_t>(frameMs.size() * 0.99));
+    double frames = static_cast<double>(frameMs.size());
+
+    DestroyBenchTarget(target);
+
+    const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    printf("{\"bench\":\"render\",\"renderer\":%s,\"nodes\":%d,\"zoom\":%g,\"frames\":%d,\"avg_ms\":%.3f,\"p99_ms\":%.3f,"
+           "\"draw_calls\":%.1f,\"vertices\":%.1f,\"indices\":%.1f,\"upload_bytes\":%.1f}\n",
+           QmpQuote(renderer != nullptr ? renderer : "unknown").c_str(), options.nodes, options.zoom, options.frames, total / frames,
+           frameMs[p99], drawCalls / frames, vertices / frames, indices / frames,
+           (vertices * sizeof(ImDrawVert) + indices * sizeof(ImDrawIdx)) / frames);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    RenderBenchOptions renderBench;
+    ParseRenderBench(argc, argv, renderBench);
+
+    glfwSetErrorCallback([](int error, const char *description)
+                         { fprintf(stderr, "Glfw Error %d: %s\n", error, description); });
+    if (renderBench.enabled)
+    {
+#if defined(GLFW_PLATFORM_NULL)
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+        setenv("GALLIUM_DRIVER", "llvmpipe", 0);
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+        fprintf(stderr, "--render-bench needs GLFW 3.4 or newer for its null platform\n");
+        return 1;
+#endif
+    }
+    if (!glfwInit())
+        return 1;
+
+    const char *glsl_version = "#version 130";
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
 
-        for (int i = 0; i < links.size(); i += 2)
+    GLFWwindow *window = NULL;
+    if (renderBench.enabled)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        window = glfwCreateWindow(1280, 720, "TKit", NULL, NULL);
+        if (window == NULL)
         {
-            ImNodes::Link(i, links[i], links[i + 1]);
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+            window = glfwCreateWindow(1280, 720, "TKit", NULL, NULL);
         }
+    }
+    else
+    {
+        window = glfwCreateWindow(1280, 720, "TKit", NULL, NULL);
+    }
+    if (window == NULL)
+        return 1;
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(renderBench.enabled ? 0 : 1);
 
-        ImNodes::EndNodeEditor();
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO &io = ImGui::GetIO();
+    (void)io;
+
+    ImGui::StyleColorsDark();
+
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init(glsl_version);
+
+    ImNodes::CreateContext();
+    InitGpuTimer();
 
-        int start_attr, end_attr;
-        if (ImNodes::IsLinkCreated(&start_attr, &end_attr))
+    int exitCode = 0;
+    if (renderBench.enabled)
+    {
+        // Leaves imgui.ini and the autosave journal alone.
+        io.IniFilename = NULL;
+        exitCode = RunRenderBench(window, renderBench);
+    }
+    else
+    {
+        StartJournal(journal, kJournalPath);
+        if (argc > 1)
+        {
+            LoadGraphFile(argv[1]);
+        }
+        else
         {
-            links.push_back(start_attr);
-            links.push_back(end_attr);
+            RecoverAutosave();
+            CompactJournal(journal);
         }
 
-        int link_id;
-        while (ImNodes::IsLinkDestroyed(&link_id))
+        while (!glfwWindowShouldClose(window))
         {
-            auto it = std::find(links.begin(), links.end(), link_id);
-            if (it != links.end())
-            {
-                links.erase(it, it + 2);
-            }
+            BeginProfileFrame(frameProfiler);
+            BeginProfileStage(frameProfiler, StageEvents);
+            WaitForFrame();
+            EndProfileStage(frameProfiler, StageEvents);
+
+            DrawFrame(window);
+
+            BeginProfileStage(frameProfiler, StageSwapBuffers);
+            glfwSwapBuffers(window);
+            EndProfileStage(frameProfiler, StageSwapBuffers);
+            EndProfileFrame(frameProfiler);
         }
 
-        ImGui::Render();
-        int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
-        glViewport(0, 0, display_w, display_h);
-        glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        ImNodes::EndNodeEditor();
 
-        glfwSwapBuffers(window);
+        // A final snapshot keeps the node positions for the next session.
+        CompactJournal(journal);
+        ShutdownJournal(journal);
     }
 
-    ImNodes::EndNodeEditor();
+    ShutdownJobRunner(jobRunner);
+    EmulatorShutdown(previewEmulator);
+    StopQemu();
+    ShutdownJobRunner(qemuRunner);
+    if (!qmpSocketPath.empty())
+        unlink(qmpSocketPath.c_str());
 
+    ShutdownGpuTimer();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -348,5 +1924,5 @@ int main()
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
-}
\ No newline at end of file
+    return exitCode;
+}
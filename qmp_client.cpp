@@ -0,0 +1,234 @@
+#include "qmp_client.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock QmpClock;
+
+    bool Fail(QmpClient &client, std::string &error, std::string message)
+    {
+        error = std::move(message);
+        QmpClose(client);
+        return false;
+    }
+
+    // Reads one line-delimited JSON message.
+    bool ReadMessage(QmpClient &client, QmpClock::time_point deadline, std::string &message, std::string &error)
+    {
+        for (;;)
+        {
+            size_t end = client.buffer.find('\n');
+            if (end != std::string::npos)
+            {
+                message = client.buffer.substr(0, end > 0 && client.buffer[end - 1] == '\r' ? end - 1 : end);
+                client.buffer.erase(0, end + 1);
+                return true;
+            }
+
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - QmpClock::now()).count();
+            if (remaining <= 0)
+                return Fail(client, error, "QMP timed out");
+
+            pollfd fd = {client.fd, POLLIN, 0};
+            int ready = poll(&fd, 1, static_cast<int>(remaining));
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                continue;
+
+            char chunk[4096];
+            ssize_t count = recv(client.fd, chunk, sizeof(chunk), 0);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return Fail(client, error, "QMP connection closed");
+            client.buffer.append(chunk, static_cast<size_t>(count));
+        }
+    }
+
+    bool SendAll(QmpClient &client, const std::string &text, std::string &error)
+    {
+        size_t sent = 0;
+        while (sent < text.size())
+        {
+            ssize_t count = send(client.fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return Fail(client, error, std::string("QMP send failed: ") + strerror(errno));
+            sent += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // Pulls "desc" out of an error reply without a full JSON parser.
+    std::string ErrorDescription(const std::string &reply)
+    {
+        size_t key = reply.find("\"desc\"");
+        size_t start = key == std::string::npos ? key : reply.find('"', reply.find(':', key));
+        if (start == std::string::npos)
+            return reply;
+
+        std::string description;
+        for (size_t i = start + 1; i < reply.size() && reply[i] != '"'; ++i)
+        {
+            if (reply[i] == '\\' && i + 1 < reply.size())
+                ++i;
+            description += reply[i];
+        }
+        return description;
+    }
+
+    void RunBatch(QmpSession &session, std::string path, std::vector<std::string> commands)
+    {
+        std::string error;
+        bool ok = session.client.fd >= 0;
+        QmpClock::time_point giveUp = QmpClock::now() + std::chrono::milliseconds(kQmpConnectWaitMs);
+        while (!ok && !session.stop)
+        {
+            ok = QmpConnect(session.client, path, error);
+            if (ok || QmpClock::now() >= giveUp)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(kQmpConnectRetryMs));
+        }
+        if (!ok && error.empty())
+            error = "QMP connect abandoned";
+
+        std::string reply;
+        for (size_t i = 0; ok && i < commands.size(); ++i)
+            ok = QmpExecute(session.client, commands[i], reply, error);
+
+        std::lock_guard<std::mutex> lock(session.mutex);
+        session.finished = true;
+        session.ok = ok;
+        session.error = ok ? std::string() : error;
+        session.busy = false;
+    }
+}
+
+bool QmpConnect(QmpClient &client, const std::string &path, std::string &error)
+{
+    QmpClose(client);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        return Fail(client, error, "QMP socket path too long");
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    client.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client.fd < 0)
+        return Fail(client, error, std::string("QMP socket failed: ") + strerror(errno));
+    if (connect(client.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        return Fail(client, error, "could not connect to " + path + ": " + strerror(errno));
+
+    std::string greeting;
+    if (!ReadMessage(client, QmpClock::now() + std::chrono::milliseconds(kQmpTimeoutMs), greeting, error))
+        return false;
+    if (greeting.find("\"QMP\"") == std::string::npos)
+        return Fail(client, error, "unexpected QMP greeting");
+
+    std::string reply;
+    return QmpExecute(client, "{\"execute\": \"qmp_capabilities\"}", reply, error);
+}
+
+bool QmpExecute(QmpClient &client, const std::string &command, std::string &reply, std::string &error)
+{
+    if (client.fd < 0)
+    {
+        error = "QMP not connected";
+        return false;
+    }
+    if (!SendAll(client, command + "\n", error))
+        return false;
+
+    QmpClock::time_point deadline = QmpClock::now() + std::chrono::milliseconds(kQmpTimeoutMs);
+    for (;;)
+    {
+        if (!ReadMessage(client, deadline, reply, error))
+            return false;
+        if (reply.find("\"event\"") != std::string::npos)
+            continue;
+
+        if (reply.find("\"return\"") != std::string::npos)
+            return true;
+        error = ErrorDescription(reply);
+        return false;
+    }
+}
+
+void QmpClose(QmpClient &client)
+{
+    if (client.fd >= 0)
+        close(client.fd);
+    client.fd = -1;
+    client.buffer.clear();
+}
+
+bool QmpSubmit(QmpSession &session, const std::string &path, std::vector<std::string> commands)
+{
+    if (session.busy)
+        return false;
+    if (session.worker.joinable())
+        session.worker.join();
+
+    session.stop = false;
+    session.busy = true;
+    session.worker = std::thread(RunBatch, std::ref(session), path, std::move(commands));
+    return true;
+}
+
+bool QmpTakeResult(QmpSession &session, bool &ok, std::string &error)
+{
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (!session.finished)
+        return false;
+    session.finished = false;
+    ok = session.ok;
+    error = session.error;
+    return true;
+}
+
+void QmpShutdown(QmpSession &session)
+{
+    session.stop = true;
+    if (session.worker.joinable())
+        session.worker.join();
+    QmpClose(session.client);
+
+    std::lock_guard<std::mutex> lock(session.mutex);
+    session.finished = false;
+}
+
+std::string QmpQuote(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Minimal client for the QEMU Machine Protocol over a unix socket. Calls
+// block for at most kQmpTimeoutMs; a healthy local QEMU answers well within
+// a millisecond. The editor only talks to QEMU through a QmpSession, whose
+// worker thread makes those calls.
+
+constexpr int kQmpTimeoutMs = 500;
+
+// QEMU creates its socket a moment after it starts, so a session retries a
+// failed connect every kQmpConnectRetryMs for up to kQmpConnectWaitMs.
+constexpr int kQmpConnectRetryMs = 50;
+constexpr int kQmpConnectWaitMs = 5000;
+
+struct QmpClient
+{
+    int fd = -1;
+    std::string buffer;
+};
+
+// Connects, reads the greeting and negotiates capabilities.
+bool QmpConnect(QmpClient &client, const std::string &path, std::string &error);
+
+// Sends one command object and waits for its reply, skipping any events
+// that arrive first. A QMP error reply is returned as false with its
+// description in error.
+bool QmpExecute(QmpClient &client, const std::string &command, std::string &reply, std::string &error);
+
+void QmpClose(QmpClient &client);
+
+// Runs batches of commands on a worker thread, one batch at a time, and
+// keeps the connection for the next batch. The client belongs to the worker
+// while a batch runs.
+struct QmpSession
+{
+    QmpClient client;
+    std::thread worker;
+    std::atomic<bool> busy{false};
+    std::atomic<bool> stop{false};
+
+    std::mutex mutex;
+    bool finished = false;
+    bool ok = false;
+    std::string error;
+};
+
+// Connects if needed and runs the commands in order, stopping at the first
+// failure. Returns false while the previous batch is still running.
+bool QmpSubmit(QmpSession &session, const std::string &path, std::vector<std::string> commands);
+
+// Returns true once for every finished batch, with its outcome.
+bool QmpTakeResult(QmpSession &session, bool &ok, std::string &error);
+
+// Abandons connect retries, waits for the batch in flight and disconnects.
+void QmpShutdown(QmpSession &session);
+
+// Quotes text as a JSON string.
+std::string QmpQuote(const std::string &text);
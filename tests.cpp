@@ -0,0 +1,1284 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "assembler.h"
+#include "emulator.h"
+#include "graph.h"
+#include "job_runner.h"
+#include "journal.h"
+#include "qmp_client.h"
+
+// Regression tests for the modules that do not need a GUI, run by
+// `make test`:
+//
+//   tkit_tests [name,...]
+//
+// Each test prints "ok <name>" or "FAIL <name>: <what>" for every check
+// that failed, and the exit status is the number of failed tests.
+
+namespace
+{
+    typedef std::chrono::steady_clock TestClock;
+
+    constexpr int kTestPollMs = 5;
+    constexpr int kTestWaitMs = 3000;
+
+    const char *currentTest = "";
+    int currentFailures = 0;
+
+    void Expect(bool condition, const std::string &what)
+    {
+        if (condition)
+            return;
+        printf("FAIL %s: %s\n", currentTest, what.c_str());
+        ++currentFailures;
+    }
+
+    double ElapsedMs(TestClock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(TestClock::now() - start).count();
+    }
+
+    std::string TempPath(const char *name)
+    {
+        return "/tmp/tkit-test-" + std::to_string(getpid()) + "-" + name;
+    }
+
+    // One-connection QMP server on a unix socket, started listenDelayMs
+    // after construction to stand in for a QEMU that is still starting up.
+    // It greets, answers every command with an event and then a return, and
+    // answers commands mentioning "fail" with an error.
+    struct FakeQmp
+    {
+        std::string path;
+        int listenDelayMs = 0;
+        std::thread server;
+        std::vector<std::string> commands;
+        int accepted = 0;
+    };
+
+    bool SendText(int fd, const std::string &text)
+    {
+        return send(fd, text.data(), text.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+    }
+
+    void ServeFakeQmp(FakeQmp &fake)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(fake.listenDelayMs));
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, fake.path.c_str(), sizeof(address.sun_path) - 1);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0)
+        {
+            if (listener >= 0)
+                close(listener);
+            return;
+        }
+
+        int fd = accept(listener, nullptr, nullptr);
+        close(listener);
+        unlink(fake.path.c_str());
+        if (fd < 0)
+            return;
+        ++fake.accepted;
+
+        SendText(fd, "{\"QMP\": {\"version\": {}, \"capabilities\": []}}\r\n");
+        std::string buffer;
+        char chunk[1024];
+        ssize_t count;
+        while ((count = recv(fd, chunk, sizeof(chunk), 0)) > 0)
+        {
+            buffer.append(chunk, static_cast<size_t>(count));
+            size_t end;
+            while ((end = buffer.find('\n')) != std::string::npos)
+            {
+                std::string command = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                fake.commands.push_back(command);
+
+                if (command.find("fail") != std::string::npos)
+                {
+                    SendText(fd, "{\"error\": {\"class\": \"GenericError\", \"desc\": \"Device 'floppy9' not found\"}}\r\n");
+                    continue;
+                }
+                SendText(fd, "{\"event\": \"RESET\", \"data\": {}}\r\n{\"return\": {}}\r\n");
+            }
+        }
+        close(fd);
+    }
+
+    void StartFakeQmp(FakeQmp &fake, const char *name, int listenDelayMs)
+    {
+        fake.path = TempPath(name);
+        fake.listenDelayMs = listenDelayMs;
+        unlink(fake.path.c_str());
+        fake.server = std::thread(ServeFakeQmp, std::ref(fake));
+    }
+
+    // Waits for the session's batch to finish.
+    bool WaitForQmp(QmpSession &session, bool &ok, std::string &error)
+    {
+        TestClock::time_point start = TestClock::now();
+        while (ElapsedMs(start) < kTestWaitMs)
+        {
+            if (QmpTakeResult(session, ok, error))
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(kTestPollMs));
+        }
+        return false;
+    }
+
+    // A reload issued right after QEMU was spawned finds no socket yet; the
+    // session keeps retrying on its worker while the caller carries on, and
+    // the next batch reuses the connection.
+    void TestQmpConnectRetry()
+    {
+        FakeQmp fake;
+        StartFakeQmp(fake, "retry.sock", 300);
+
+        QmpSession session;
+        TestClock::time_point start = TestClock::now();
+        Expect(QmpSubmit(session, fake.path, {"{\"execute\": \"blockdev-change-medium\"}", "{\"execute\": \"system_reset\"}"}), "submit refused");
+        Expect(ElapsedMs(start) < 50.0, "submit blocked the caller");
+        Expect(!QmpSubmit(session, fake.path, {"{\"execute\": \"stop\"}"}), "second submit accepted while busy");
+
+        bool ok = false;
+        std::string error;
+        Expect(WaitForQmp(session, ok, error), "first batch never finished");
+        Expect(ok, "first batch failed: " + error);
+        Expect(ElapsedMs(start) >= 250.0, "connected before the server listened");
+
+        Expect(QmpSubmit(session, fake.path, {"{\"execute\": \"system_reset\"}"}), "submit after a finished batch refused");
+        Expect(WaitForQmp(session, ok, error), "second batch never finished");
+        Expect(ok, "second batch failed: " + error);
+        Expect(!QmpTakeResult(session, ok, error), "one batch reported twice");
+
+        QmpShutdown(session);
+        fake.server.join();
+        Expect(fake.accepted == 1, "connection not reused");
+        std::vector<std::string> expected = {"{\"execute\": \"qmp_capabilities\"}", "{\"execute\": \"blockdev-change-medium\"}",
+                                             "{\"execute\": \"system_reset\"}", "{\"execute\": \"system_reset\"}"};
+        Expect(fake.commands == expected, "commands arrived out of order");
+    }
+
+    // An error reply stops the batch and carries QEMU's description.
+    void TestQmpErrorReply()
+    {
+        FakeQmp fake;
+        StartFakeQmp(fake, "error.sock", 0);
+
+        QmpSession session;
+        Expect(QmpSubmit(session, fake.path, {"{\"execute\": \"fail\"}", "{\"execute\": \"system_reset\"}"}), "submit refused");
+        bool ok = true;
+        std::string error;
+        Expect(WaitForQmp(session, ok, error), "batch never finished");
+        Expect(!ok, "error reply reported as success");
+        Expect(error == "Device 'floppy9' not found", "wrong error: " + error);
+
+        QmpShutdown(session);
+        fake.server.join();
+        Expect(fake.commands.size() == 2, "batch went on after an error");
+    }
+
+    // QEMU exiting while the session still waits for its socket must not
+    // leave the caller waiting out kQmpConnectWaitMs.
+    void TestQmpShutdownDuringConnect()
+    {
+        QmpSession session;
+        Expect(QmpSubmit(session, TempPath("missing.sock"), {"{\"execute\": \"system_reset\"}"}), "submit refused");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        TestClock::time_point start = TestClock::now();
+        QmpShutdown(session);
+        Expect(ElapsedMs(start) < 4.0 * kQmpConnectRetryMs, "shutdown waited for the connect retries");
+
+        bool ok = false;
+        std::string error;
+        Expect(!QmpTakeResult(session, ok, error), "abandoned batch reported");
+    }
+
+    // Waits for the runner's job to leave JobRunning.
+    bool WaitForJob(JobRunner &runner, int waitMs)
+    {
+        TestClock::time_point start = TestClock::now();
+        while (runner.state == JobRunning && ElapsedMs(start) < waitMs)
+            std::this_thread::sleep_for(std::chrono::milliseconds(kTestPollMs));
+        return runner.state != JobRunning;
+    }
+
+    void TestJobOutput()
+    {
+        JobRunner runner;
+        Expect(StartJob(runner, "echo", {{"sh", "-c", "echo out; echo err >&2; printf tail"}}), "job not started");
+        Expect(WaitForJob(runner, kTestWaitMs), "job never finished");
+        Expect(runner.state == JobSucceeded, "job did not succeed");
+
+        ConsoleBuffer console;
+        PollJob(runner, console);
+        bool out = false;
+        bool err = false;
+        bool tail = false;
+        for (size_t i = 0; i < ConsoleSize(console); ++i)
+        {
+            const ConsoleLine &line = ConsoleLineAt(console, i);
+            out = out || (line.text == "out" && !line.error);
+            err = err || (line.text == "err" && line.error);
+            tail = tail || (line.text == "tail" && !line.error);
+        }
+        Expect(out && err && tail, "output lines missing");
+        ShutdownJobRunner(runner);
+    }
+
+    // A command that closes stdout and stderr but keeps running must still
+    // be cancellable: terminated at once, or killed after kJobKillGraceMs
+    // when it ignores SIGTERM.
+    void TestJobCancelAfterOutputClosed()
+    {
+        JobRunner runner;
+        Expect(StartJob(runner, "detached", {{"sh", "-c", "exec >&- 2>&-; sleep 30"}}), "job not started");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        TestClock::time_point start = TestClock::now();
+        CancelJob(runner);
+        Expect(WaitForJob(runner, kTestWaitMs), "cancel ignored once the output closed");
+        Expect(runner.state == JobCancelled, "job not reported as cancelled");
+        Expect(ElapsedMs(start) < kJobKillGraceMs, "terminated job waited for the kill");
+        ShutdownJobRunner(runner);
+
+        Expect(StartJob(runner, "stubborn", {{"sh", "-c", "trap '' TERM; exec >&- 2>&-; sleep 30"}}), "job not started");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        start = TestClock::now();
+        CancelJob(runner);
+        Expect(WaitForJob(runner, kJobKillGraceMs + kTestWaitMs), "job ignoring SIGTERM never killed");
+        Expect(ElapsedMs(start) >= kJobKillGraceMs - kJobPollIntervalMs, "killed before the grace period");
+        ShutdownJobRunner(runner);
+    }
+
+    std::string HexBytes(const std::vector<uint8_t> &bytes)
+    {
+        std::string text;
+        char byte[4];
+        for (uint8_t value : bytes)
+        {
+            snprintf(byte, sizeof(byte), text.empty() ? "%02X" : " %02X", value);
+            text += byte;
+        }
+        return text;
+    }
+
+    // Source and the bytes nasm -f bin produces for it.
+    struct AsmCase
+    {
+        const char *source;
+        const char *bytes;
+    };
+
+    const AsmCase kAsmCases[] = {
+        {"mov ah, 0x0e\nmov al, 'A'\nint 0x10", "B4 0E B0 41 CD 10"},
+        {"mov ax, 0x1234\ninc ax\ndec cx\npush ax\npop bx\nxor ax, ax", "B8 34 12 40 49 50 5B 31 C0"},
+        {"add ax, 5\nadd al, 5\nsub bx, 300", "83 C0 05 04 05 81 EB 2C 01"},
+        {"dw 0x1234, 0x5678\ndb 'hi', 0", "34 12 78 56 68 69 00"},
+        {"jmp $", "EB FE"},
+        {"org 0x7C00\ncall f\nhlt\nf: ret", "E8 01 00 F4 C3"},
+        {"start:\n.l: dec cx\njnz .l\nother:\n.l: jmp .l", "49 75 FD EB FE"},
+    };
+
+    void TestAssemblerEncodings()
+    {
+        for (const AsmCase &test : kAsmCases)
+        {
+            std::vector<uint8_t> image;
+            AsmError error;
+            bool ok = Assemble(test.source, image, error);
+            Expect(ok, std::string("'") + test.source + "': " + error.message);
+            Expect(!ok || HexBytes(image) == test.bytes, std::string("'") + test.source + "' gave " + HexBytes(image));
+        }
+    }
+
+    // Jumps take the short form while the target is in reach, and padding
+    // fills the boot sector up to its signature.
+    void TestAssemblerLayout()
+    {
+        std::vector<uint8_t> image;
+        AsmError error;
+        Expect(Assemble("jmp a\ntimes 100 db 0\na: hlt", image, error), error.message);
+        Expect(image.size() == 103 && HexBytes({image.begin(), image.begin() + 2}) == "EB 64", "short jump not used");
+
+        Expect(Assemble("jmp a\ntimes 200 db 0\na: hlt", image, error), error.message);
+        Expect(image.size() == 204 && HexBytes({image.begin(), image.begin() + 3}) == "E9 C8 00", "near jump not used");
+
+        Expect(Assemble("org 0x7C00\nbits 16\njmp $\ntimes 510-($-$$) db 0\ndw 0AA55h", image, error), error.message);
+        Expect(image.size() == 512 && image[510] == 0x55 && image[511] == 0xAA, "boot signature misplaced");
+    }
+
+    void TestAssemblerErrors()
+    {
+        std::vector<uint8_t> image;
+        AsmError error;
+        Expect(!Assemble("nop\nfrobnicate ax", image, error), "unknown instruction accepted");
+        Expect(error.line == 2 && error.message == "unknown instruction 'frobnicate'", "wrong error: " + error.message);
+
+        error = AsmError();
+        Expect(!Assemble("mov ax, bogus", image, error), "undefined symbol accepted");
+        Expect(error.line == 1 && error.message == "symbol 'bogus' undefined", "wrong error: " + error.message);
+    }
+
+    void TestEmulatorTeletype()
+    {
+        std::vector<uint8_t> image;
+        AsmError error;
+        EmulatorResult result;
+        Assemble("org 0x7C00\nmov ah, 0x0e\nmov al, 'H'\nint 0x10\nmov al, 'i'\nint 0x10\njmp $", image, error);
+        RunRealMode(image, 1000, result);
+        Expect(result.stop == EmulatorIdle, "not idle: " + result.message);
+        Expect(result.screen.size() == 1 && result.screen[0] == "Hi", "wrong screen");
+
+        Assemble("org 0x7C00\nmov ah, 0x0e\nmov al, 'x'\nmov cx, 3\n.l: int 0x10\ndec cx\njnz .l\n"
+                 "mov al, 13\nint 0x10\nmov al, 10\nint 0x10\nmov al, 'y'\nint 0x10\nhlt",
+                 image, error);
+        RunRealMode(image, 1000, result);
+        Expect(result.stop == EmulatorHalted, "not halted: " + result.message);
+        Expect(result.screen.size() == 2 && result.screen[0] == "xxx" && result.screen[1] == "y", "wrong screen");
+    }
+
+    void TestEmulatorStops()
+    {
+        std::vector<uint8_t> image;
+        AsmError error;
+        EmulatorResult result;
+        Assemble("org 0x7C00\na: inc ax\njmp a", image, error);
+        RunRealMode(image, 100, result);
+        Expect(result.stop == EmulatorStepLimit && result.steps == 100, "step budget ignored");
+
+        Assemble("org 0x7C00\ndb 0x0F, 0x0B", image, error);
+        RunRealMode(image, 100, result);
+        Expect(result.stop == EmulatorUnsupported && result.message == "opcode 0F is not emulated at 0000:7C00",
+               "wrong stop: " + result.message);
+    }
+
+    // The editor's build caches each node's code and relinks. After every
+    // kind of edit its image must equal kernel.asm assembled in one go.
+    void TestKernelImageMatchesSource()
+    {
+        ClearGraph();
+        int start = CreateNode(NodeKernelStart);
+        int letter = CreateNode(NodePrintChar);
+        int tail = CreateNode(NodeInstruction);
+        int end = CreateNode(NodeKernelEnd);
+        SetNodeText(letter, "H");
+        SetNodeText(tail, "mov al, 'i'\nint 0x10\n.idle: jmp .idle");
+        AddLink(OutputPin(start), InputPin(letter));
+        AddLink(OutputPin(letter), InputPin(tail));
+        AddLink(OutputPin(tail), InputPin(end));
+
+        auto check = [](const std::string &stage, const char *screen)
+        {
+            const KernelProgram &program = CompileKernel();
+            std::string error;
+            Expect(UpdateKernelImage(program, error), stage + ": " + error);
+            StepAssemblerEmit(JobClock::time_point::max());
+
+            std::vector<uint8_t> image;
+            AsmError asmError;
+            Expect(Assemble(assemblerEmit.text, image, asmError), stage + ": " + asmError.message);
+            Expect(image == kernelBuild.image, stage + ": image differs from kernel.asm");
+
+            EmulatorResult result;
+            RunRealMode(kernelBuild.image, 1000, result);
+            Expect(result.screen.size() == 1 && result.screen[0] == screen, stage + ": wrong screen");
+        };
+
+        check("first build", "Hi");
+        SetNodeText(letter, "J");
+        check("text edit", "Ji");
+
+        int inserted = CreateNode(NodePrintChar);
+        SetNodeText(inserted, "o");
+        RemoveLink(FindLink(OutputPin(letter), InputPin(tail)));
+        AddLink(OutputPin(letter), InputPin(inserted));
+        AddLink(OutputPin(inserted), InputPin(tail));
+        check("insert", "Joi");
+
+        SetNodeText(tail, "mov al, 'i'\nint 0x10\nmov al, '!'\nint 0x10\n.idle: jmp .idle");
+        check("longer node", "Joi!");
+
+        DeleteNode(letter);
+        AddLink(OutputPin(start), InputPin(inserted));
+        check("delete", "oi!");
+        ClearGraph();
+    }
+
+    // kernel_start, count nodes with the given text and kernel_end. Returns
+    // the instruction ids in order.
+    std::vector<int> BuildInstructionChain(int count, const char *text)
+    {
+        ClearGraph();
+        int previous = CreateNode(NodeKernelStart);
+        std::vector<int> ids;
+        for (int i = 0; i < count; ++i)
+        {
+            int id = CreateNode(NodeInstruction);
+            SetNodeText(id, text);
+            AddLink(OutputPin(previous), InputPin(id));
+            ids.push_back(id);
+            previous = id;
+        }
+        AddLink(OutputPin(previous), InputPin(CreateNode(NodeKernelEnd)));
+        return ids;
+    }
+
+    // A kernel whose code passes the boot sector fails at the node that
+    // takes it over, without encoding the rest; one that fits still links.
+    void TestKernelImageBootSector()
+    {
+        std::vector<int> ids = BuildInstructionChain(600, "inc ax");
+        const KernelProgram &program = CompileKernel();
+        int errorNode = -1;
+        AsmError error;
+        Expect(!AssembleKernelImage(program, errorNode, error), "oversized kernel built");
+        Expect(errorNode == ids[kBootSectorSize], "failed at node " + std::to_string(errorNode));
+        Expect(kernelBuild.nodeCode[ids[kBootSectorSize - 1]].valid, "node before the limit not encoded");
+        Expect(!kernelBuild.nodeCode[ids[kBootSectorSize + 1]].valid, "node past the limit encoded");
+
+        BuildInstructionChain(kBootSectorSize - 2, "inc ax");
+        std::string message;
+        Expect(UpdateKernelImage(CompileKernel(), message), "full kernel: " + message);
+        Expect(kernelBuild.image.size() == kBootSectorSize && kernelBuild.image[510] == 0x55 && kernelBuild.image[511] == 0xAA,
+               "full kernel is not a boot sector");
+        ClearGraph();
+    }
+
+    // Builds the image a slice at a time with a deadline that has always
+    // passed, which stops every kJobClockCheckInterval nodes.
+    bool StepImageToEnd(std::string &error)
+    {
+        bool ok = false;
+        for (int slices = 0; slices < 100; ++slices)
+        {
+            if (StepKernelImage(kernelValidation.program, JobClock::now(), ok, error))
+                return ok;
+        }
+        error = "did not finish";
+        return false;
+    }
+
+    // A budgeted build, with or without an edit in the middle, must give
+    // the same image as a build in one go.
+    void TestKernelImageSteps()
+    {
+        std::vector<int> ids = BuildInstructionChain(400, "inc ax");
+        SetNodeText(ids[100], "a: dec ax\njnz a");
+        SetNodeText(ids[300], ".b: jmp .b");
+        CompileKernel();
+
+        std::string error;
+        Expect(StepImageToEnd(error), "stepped build: " + error);
+        std::vector<uint8_t> stepped = kernelBuild.image;
+        kernelBuild = KernelBuild();
+        Expect(UpdateKernelImage(kernelValidation.program, error), "full build: " + error);
+        Expect(stepped == kernelBuild.image, "stepped image differs");
+
+        SetNodeText(ids[10], "inc bx");
+        bool ok = false;
+        for (int slices = 0; slices < 100 && !kernelBuild.stepping; ++slices)
+            Expect(!StepKernelImage(kernelValidation.program, JobClock::now(), ok, error), "edit built in one slice");
+        Expect(kernelBuild.stepping && kernelBuild.stepPosition > 5, "edit not part built");
+        SetNodeText(ids[5], "b: inc cx");
+        Expect(StepImageToEnd(error), "edited build: " + error);
+        stepped = kernelBuild.image;
+        kernelBuild = KernelBuild();
+        Expect(UpdateKernelImage(kernelValidation.program, error), "edited full build: " + error);
+        Expect(stepped == kernelBuild.image, "image after a mid-build edit differs");
+        ClearGraph();
+    }
+
+    void TestEmulatorSession()
+    {
+        std::vector<uint8_t> image;
+        AsmError error;
+        Assemble("org 0x7C00\nmov ah, 0x0e\nmov al, 'H'\nint 0x10\nmov al, 'i'\nint 0x10\njmp $", image, error);
+        EmulatorResult direct;
+        RunRealMode(image, 1000, direct);
+
+        EmulatorSession session;
+        EmulatorResult result;
+        Expect(!EmulatorTakeResult(session, result), "result before any run");
+        Expect(EmulatorSubmit(session, image, 1000), "submit refused");
+
+        TestClock::time_point start = TestClock::now();
+        bool taken = false;
+        while (!(taken = EmulatorTakeResult(session, result)) && ElapsedMs(start) < kTestWaitMs)
+            std::this_thread::sleep_for(std::chrono::milliseconds(kTestPollMs));
+        Expect(taken, "run never finished");
+        Expect(result.stop == direct.stop && result.steps == direct.steps && result.screen == direct.screen,
+               "worker run differs from a direct run");
+        Expect(!EmulatorTakeResult(session, result), "result taken twice");
+        EmulatorShutdown(session);
+    }
+
+    std::vector<int> PinTargets(PinId pin)
+    {
+        std::vector<int> ids;
+        for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+            ids.push_back(PinNodeId(LinkedPin(pin, link)));
+        return ids;
+    }
+
+    // Removing a link from the middle of a hub's list keeps the others in
+    // creation order, and the re-added link goes last; walking the list
+    // backwards sees the same links.
+    void TestPinLinkLists()
+    {
+        ClearGraph();
+        int hub = CreateNode(NodeInstruction);
+        std::vector<int> targets;
+        for (int i = 0; i < 5; ++i)
+        {
+            targets.push_back(CreateNode(NodeInstruction));
+            AddLink(OutputPin(hub), InputPin(targets.back()));
+        }
+        Expect(PinTargets(OutputPin(hub)) == targets, "links out of creation order");
+
+        RemoveLink(FindLink(OutputPin(hub), InputPin(targets[2])));
+        AddLink(OutputPin(hub), InputPin(targets[2]));
+        std::vector<int> expected = {targets[0], targets[1], targets[3], targets[4], targets[2]};
+        Expect(PinTargets(OutputPin(hub)) == expected, "removal reordered the list");
+        Expect(PinLinkCount(OutputPin(hub)) == 5 && PinLinkCount(InputPin(targets[2])) == 1, "wrong link counts");
+        Expect(PinTargets(InputPin(targets[3])) == std::vector<int>{hub}, "incoming list wrong");
+
+        std::vector<int> backwards;
+        PinId pin = OutputPin(hub);
+        for (LinkId link = LastPinLink(pin); link >= 0; link = PreviousPinLink(pin, link))
+            backwards.insert(backwards.begin(), PinNodeId(LinkedPin(pin, link)));
+        Expect(backwards == expected, "backward walk differs");
+
+        PinId stale = InputPin(targets[4]);
+        DeleteNode(targets[4]);
+        Expect(PinLinkCount(OutputPin(hub)) == 4 && FirstPinLink(stale) < 0, "deleted node still linked");
+        ClearGraph();
+    }
+
+    std::string DescribeKernel(const KernelProgram &program)
+    {
+        std::string text = program.hasStart ? "start" : "no start";
+        text += program.reachesEnd ? " end" : " no end";
+        text += " broken " + std::to_string(program.brokenNode) + ":";
+        for (int id : program.order)
+            text += " " + std::to_string(id);
+        return text;
+    }
+
+    // What a walk from scratch makes of the current graph. The cached state
+    // is put back afterwards, so the next edit still resumes from it.
+    std::string FullKernelWalk()
+    {
+        KernelValidation saved = kernelValidation;
+        InvalidateKernel();
+        std::string text = DescribeKernel(CompileKernel());
+        kernelValidation = saved;
+        return text;
+    }
+
+    // Random edits to a graph of the given shape, with the walk sometimes
+    // left part-way between them. After every edit the resumed walk must
+    // agree with a walk from scratch.
+    void CheckKernelResume(const char *shape, std::mt19937 &rng)
+    {
+        ClearGraph();
+        std::vector<int> ids = {CreateNode(NodeKernelStart)};
+        for (int i = 0; i < 400; ++i)
+            ids.push_back(CreateNode(i % 50 == 49 ? NodeKernelEnd : NodeInstruction));
+        for (size_t i = 1; i < ids.size(); ++i)
+        {
+            int parent = std::string(shape) == "branch" ? ids[(i - 1) / 3] : ids[i - 1];
+            if (CanLink(OutputPin(parent), InputPin(ids[i])))
+                AddLink(OutputPin(parent), InputPin(ids[i]));
+            if (std::string(shape) == "cycle" && i % 7 == 0 && CanLink(OutputPin(ids[i]), InputPin(ids[i / 2])))
+                AddLink(OutputPin(ids[i]), InputPin(ids[i / 2]));
+        }
+        CompileKernel();
+
+        for (int edit = 0; edit < 3000; ++edit)
+        {
+            std::string stage = std::string(shape) + " edit " + std::to_string(edit);
+            int a = nodes.ids[rng() % nodes.size()];
+            int b = nodes.ids[rng() % nodes.size()];
+            switch (rng() % 8)
+            {
+            case 0:
+            case 1:
+            case 2:
+                if (CanLink(OutputPin(a), InputPin(b)) && FindLink(OutputPin(a), InputPin(b)) < 0)
+                    AddLink(OutputPin(a), InputPin(b));
+                break;
+            case 3:
+            case 4:
+                if (!links.empty())
+                    RemoveLink(links.ids[rng() % links.size()]);
+                break;
+            case 5:
+                if (KindOf(a) != NodeKernelStart || rng() % 20 == 0)
+                    DeleteNode(a);
+                break;
+            case 6:
+                if (KindOf(a) != NodeKernelStart && KindOf(b) != NodeKernelStart)
+                    DeleteNodes({a, b});
+                break;
+            default:
+                CreateNode(rng() % 10 == 0 ? NodeKernelStart : NodeInstruction);
+                break;
+            }
+
+            if (rng() % 3 == 0)
+                StepKernelValidation(JobClock::now());
+            if (nodes.empty())
+                CreateNode(NodeKernelStart);
+            if (rng() % 4 != 0)
+                continue;
+
+            std::string expected = FullKernelWalk();
+            std::string resumed = DescribeKernel(CompileKernel());
+            Expect(resumed == expected, stage + ": resumed walk differs");
+            if (resumed != expected)
+                break;
+        }
+        ClearGraph();
+    }
+
+    void TestKernelResume()
+    {
+        std::mt19937 rng(2024);
+        for (const char *shape : {"chain", "branch", "cycle"})
+            CheckKernelResume(shape, rng);
+    }
+
+    // The graph by slot, without node ids, which recovery reassigns: kind,
+    // position and text of every node, then every pin's outgoing list in
+    // order.
+    std::string DescribeGraph()
+    {
+        std::string text;
+        char position[64];
+        for (size_t slot = 0; slot < nodes.size(); ++slot)
+        {
+            snprintf(position, sizeof(position), " %.9g %.9g ", nodes.positions[slot].x, nodes.positions[slot].y);
+            text += KindInfo(nodes.kinds[slot]).name;
+            text += position;
+            text += NodeText(nodes.ids[slot]);
+            text += "\n";
+        }
+        for (size_t slot = 0; slot < nodes.size(); ++slot)
+        {
+            PinId pin = OutputPin(nodes.ids[slot]);
+            for (LinkId link = FirstPinLink(pin); link >= 0; link = NextPinLink(pin, link))
+                text += std::to_string(slot) + " > " + std::to_string(NodeSlot(PinNodeId(LinkedPin(pin, link)))) + "\n";
+        }
+        return text;
+    }
+
+    // Every node and link slot maps back to its id, and every link joins
+    // two live nodes and can be found from its pins.
+    void CheckGraphTables(const std::string &stage)
+    {
+        for (size_t slot = 0; slot < nodes.size(); ++slot)
+            Expect(NodeSlot(nodes.ids[slot]) == static_cast<int>(slot), stage + ": node slot " + std::to_string(slot) + " lost");
+        for (size_t slot = 0; slot < links.size(); ++slot)
+        {
+            LinkId id = links.ids[slot];
+            Expect(LinkSlot(id) == static_cast<int>(slot), stage + ": link slot " + std::to_string(slot) + " lost");
+            Expect(FindPinNode(links.starts[slot]) >= 0 && FindPinNode(links.ends[slot]) >= 0,
+                   stage + ": link " + std::to_string(id) + " has a dead end");
+            Expect(FindLink(links.starts[slot], links.ends[slot]) == id, stage + ": link " + std::to_string(id) + " not indexed");
+        }
+    }
+
+    // A deleted node's id is reused with a new generation, and pins and
+    // handles kept from before the delete no longer resolve.
+    void TestStalePins()
+    {
+        ClearGraph();
+        int source = CreateNode(NodeInstruction);
+        int target = CreateNode(NodeInstruction);
+        AddLink(OutputPin(source), InputPin(target));
+        PinId stale = InputPin(target);
+        NodeHandle handle = {target, nodeIds.generations[target]};
+
+        DeleteNode(target);
+        Expect(FindPinNode(stale) < 0 && !NodeExists(handle), "deleted node still resolves");
+        int reused = CreateNode(NodeInstruction);
+        Expect(reused == target, "id not reused");
+        Expect(FindPinNode(stale) < 0 && !NodeExists(handle), "stale pin resolves to the new node");
+        Expect(FindPinNode(InputPin(reused)) == reused && InputPin(reused) != stale, "new pin does not resolve");
+        Expect(PinFromAttr(PinAttr(stale)) == InputPin(reused), "attribute not mapped to the live generation");
+        Expect(!CanLink(OutputPin(source), stale), "stale pin accepted for a link");
+        Expect(FirstPinLink(stale) < 0 && PinLinkCount(stale) == 0, "stale pin has links");
+        Expect(PinLinkCount(InputPin(reused)) == 0 && PinLinkCount(OutputPin(source)) == 0, "old link survived the delete");
+        ClearGraph();
+    }
+
+    // Deleting a node or link moves the last one into its slot; every id
+    // must keep its text, position and links.
+    void TestSwapRemove()
+    {
+        ClearGraph();
+        std::vector<int> ids;
+        for (int i = 0; i < 5; ++i)
+        {
+            ids.push_back(CreateNode(NodeInstruction));
+            SetNodeText(ids[i], "n" + std::to_string(i));
+            SetNodePosition(ids[i], NodePosition{static_cast<float>(i), 2.0f * i});
+        }
+        for (int i = 0; i + 1 < 5; ++i)
+            AddLink(OutputPin(ids[i]), InputPin(ids[i + 1]));
+        LinkId skip = AddLink(OutputPin(ids[0]), InputPin(ids[4]));
+
+        DeleteNode(ids[1]);
+        RemoveLink(FindLink(OutputPin(ids[2]), InputPin(ids[3])));
+        CheckGraphTables("after removal");
+        Expect(LinkSlot(skip) >= 0 && links.ends[LinkSlot(skip)] == InputPin(ids[4]), "moved link lost its pins");
+        for (int i : {0, 2, 3, 4})
+        {
+            int slot = NodeSlot(ids[i]);
+            Expect(slot >= 0 && NodeText(ids[i]) == "n" + std::to_string(i), "node " + std::to_string(i) + " lost its text");
+            Expect(slot >= 0 && nodes.positions[slot].x == i && nodes.positions[slot].y == 2.0f * i,
+                   "node " + std::to_string(i) + " lost its position");
+        }
+        Expect(PinTargets(OutputPin(ids[0])) == std::vector<int>{ids[4]}, "node 0 links wrong");
+        Expect(PinTargets(OutputPin(ids[2])).empty(), "removed link still listed");
+        Expect(PinTargets(OutputPin(ids[3])) == std::vector<int>{ids[4]}, "node 3 links wrong");
+        Expect(NodeSlot(ids[1]) < 0, "deleted node has a slot");
+        ClearGraph();
+    }
+
+    // DeleteNodes drops the nodes and their links in one pass, keeps the
+    // survivors in order and skips duplicate, unknown and deleted ids.
+    void TestDeleteNodes()
+    {
+        ClearGraph();
+        std::vector<int> ids;
+        for (int i = 0; i < 6; ++i)
+        {
+            ids.push_back(CreateNode(NodeInstruction));
+            SetNodeText(ids[i], "n" + std::to_string(i));
+            SetNodePosition(ids[i], NodePosition{static_cast<float>(i), 0.0f});
+        }
+        for (int i = 0; i + 1 < 6; ++i)
+            AddLink(OutputPin(ids[i]), InputPin(ids[i + 1]));
+        AddLink(OutputPin(ids[0]), InputPin(ids[2]));
+        AddLink(OutputPin(ids[2]), InputPin(ids[4]));
+        AddLink(OutputPin(ids[0]), InputPin(ids[5]));
+        int gone = CreateNode(NodeInstruction);
+        DeleteNode(gone);
+        PinId stale = InputPin(ids[3]);
+
+        DeleteNodes({ids[1], ids[3], ids[3], gone, 1000});
+        CheckGraphTables("after DeleteNodes");
+        Expect(nodes.ids == std::vector<int>{ids[0], ids[2], ids[4], ids[5]}, "survivors out of order");
+        Expect(links.size() == 4, std::to_string(links.size()) + " links left");
+        Expect(FindPinNode(stale) < 0, "deleted node still resolves");
+
+        std::string expected;
+        const char *name = KindInfo(NodeInstruction).name;
+        for (int i : {0, 2, 4, 5})
+            expected += std::string(name) + " " + std::to_string(i) + " 0 n" + std::to_string(i) + "\n";
+        expected += "0 > 1\n0 > 3\n1 > 2\n2 > 3\n";
+        Expect(DescribeGraph() == expected, "graph after DeleteNodes:\n" + DescribeGraph());
+        ClearGraph();
+    }
+
+    // A clip holds the nodes and the links among them, not the links that
+    // leave the selection, and pastes the same however often and after
+    // the originals are gone.
+    void TestCopyPaste()
+    {
+        ClearGraph();
+        int start = CreateNode(NodeKernelStart);
+        int letter = CreateNode(NodePrintChar);
+        int code = CreateNode(NodeInstruction);
+        int outside = CreateNode(NodeInstruction);
+        SetNodeText(letter, "H");
+        SetNodeText(code, "inc ax");
+        SetNodePosition(start, NodePosition{0.0f, 0.0f});
+        SetNodePosition(letter, NodePosition{100.0f, 0.0f});
+        SetNodePosition(code, NodePosition{200.0f, 50.0f});
+        AddLink(OutputPin(start), InputPin(letter));
+        AddLink(OutputPin(letter), InputPin(code));
+        AddLink(OutputPin(code), InputPin(outside));
+
+        int gone = CreateNode(NodeInstruction);
+        DeleteNode(gone);
+        GraphClip clip;
+        CopyNodes({start, letter, code, letter, gone}, clip);
+        Expect(clip.size() == 3, std::to_string(clip.size()) + " nodes copied");
+        std::vector<std::pair<uint32_t, uint32_t>> clipLinks = {{0, 1}, {1, 2}};
+        Expect(clip.links == clipLinks, "wrong links copied");
+
+        auto checkPaste = [&](const std::string &stage, NodePosition offset)
+        {
+            std::vector<int> pasted = PasteNodes(clip, offset);
+            CheckGraphTables(stage);
+            Expect(pasted.size() == 3, stage + ": wrong node count");
+            if (pasted.size() != 3)
+                return;
+            Expect(KindOf(pasted[0]) == NodeKernelStart && KindOf(pasted[1]) == NodePrintChar && KindOf(pasted[2]) == NodeInstruction,
+                   stage + ": wrong kinds");
+            Expect(NodeText(pasted[1]) == "H" && NodeText(pasted[2]) == "inc ax", stage + ": wrong texts");
+            const NodePosition &position = nodes.positions[NodeSlot(pasted[2])];
+            Expect(position.x == 200.0f + offset.x && position.y == 50.0f + offset.y, stage + ": wrong position");
+            Expect(PinTargets(OutputPin(pasted[0])) == std::vector<int>{pasted[1]} &&
+                       PinTargets(OutputPin(pasted[1])) == std::vector<int>{pasted[2]} && PinTargets(OutputPin(pasted[2])).empty(),
+                   stage + ": wrong links");
+        };
+
+        checkPaste("first paste", NodePosition{10.0f, 20.0f});
+        checkPaste("second paste", NodePosition{-30.0f, 0.0f});
+        Expect(PinTargets(OutputPin(code)) == std::vector<int>{outside}, "original links changed");
+        DeleteNodes({start, letter, code});
+        checkPaste("paste after delete", NodePosition{0.0f, 0.0f});
+        ClearGraph();
+    }
+
+    int JournaledNode(Journal &journal, NodeKind kind, NodePosition position, const char *text)
+    {
+        int id = CreateNode(kind);
+        SetNodePosition(id, position);
+        JournalCreateNode(journal, id, kind, position);
+        if (text != nullptr)
+        {
+            SetNodeText(id, text);
+            JournalSetText(journal, id, text);
+        }
+        return id;
+    }
+
+    void JournaledLink(Journal &journal, int from, int to)
+    {
+        AddLink(OutputPin(from), InputPin(to));
+        JournalAddLink(journal, OutputPin(from), InputPin(to));
+    }
+
+    void JournaledUnlink(Journal &journal, int from, int to)
+    {
+        RemoveLink(FindLink(OutputPin(from), InputPin(to)));
+        JournalRemoveLink(journal, OutputPin(from), InputPin(to));
+    }
+
+    // Starts a journal on an empty graph and makes one edit of every kind,
+    // compacting halfway when asked to. Returns the graph after each edit;
+    // the journal is shut down.
+    std::vector<std::string> WriteJournal(const std::string &path, bool compact)
+    {
+        ClearGraph();
+        unlink(path.c_str());
+        Journal journal;
+        StartJournal(journal, path);
+        CompactJournal(journal);
+
+        std::vector<std::string> states;
+        int start = JournaledNode(journal, NodeKernelStart, NodePosition{-10.5f, 20.25f}, nullptr);
+        int a = JournaledNode(journal, NodePrintChar, NodePosition{100.0f, 0.0f}, "A");
+        int b = JournaledNode(journal, NodeInstruction, NodePosition{200.0f, 0.0f}, "mov al, 'b'\nint 0x10");
+        int c = JournaledNode(journal, NodeInstruction, NodePosition{300.0f, 1e6f}, "nop");
+        int end = JournaledNode(journal, NodeKernelEnd, NodePosition{400.0f, 0.0f}, nullptr);
+        JournaledLink(journal, start, a);
+        JournaledLink(journal, a, b);
+        JournaledLink(journal, a, c);
+        JournaledLink(journal, b, end);
+        states.push_back(DescribeGraph());
+
+        if (compact)
+            CompactJournal(journal);
+
+        SetNodePosition(b, NodePosition{250.0f, -75.125f});
+        SetNodePosition(c, NodePosition{123456.789f, 0.1f});
+        JournalMoveNodes(journal, {b, c});
+        states.push_back(DescribeGraph());
+
+        JournaledUnlink(journal, a, b);
+        JournaledLink(journal, a, b);
+        states.push_back(DescribeGraph());
+
+        JournalDeleteNode(journal, c);
+        DeleteNode(c);
+        int d = JournaledNode(journal, NodePrintChar, NodePosition{500.0f, 500.0f}, "D");
+        JournaledLink(journal, b, d);
+        states.push_back(DescribeGraph());
+
+        JournalDeleteNodes(journal, {a, d});
+        DeleteNodes({a, d});
+        states.push_back(DescribeGraph());
+
+        SetNodeText(b, "inc ax");
+        JournalSetText(journal, b, "inc ax");
+        states.push_back(DescribeGraph());
+
+        ShutdownJournal(journal);
+        std::string error;
+        Expect(!TakeJournalError(journal, error), "journal write failed: " + error);
+        return states;
+    }
+
+    long FileSize(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return -1;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fclose(file);
+        return size;
+    }
+
+    void TestJournalReplay()
+    {
+        for (bool compact : {false, true})
+        {
+            std::string path = TempPath("replay.tkj");
+            std::vector<std::string> states = WriteJournal(path, compact);
+
+            ClearGraph();
+            std::string error;
+            Expect(RecoverJournal(path, error), error);
+            Expect(DescribeGraph() == states.back(), compact ? "replay after compaction differs" : "replay differs");
+            unlink(path.c_str());
+        }
+        ClearGraph();
+    }
+
+    // A crash mid-write leaves part of the last record behind. Recovery
+    // keeps everything before it.
+    void TestJournalTornTail()
+    {
+        std::string path = TempPath("torn.tkj");
+        std::vector<std::string> states = WriteJournal(path, false);
+
+        long size = FileSize(path);
+        Expect(size > 0 && truncate(path.c_str(), size - 1) == 0, "could not truncate the journal");
+        ClearGraph();
+        std::string error;
+        Expect(RecoverJournal(path, error), error);
+        Expect(DescribeGraph() == states[states.size() - 2], "torn record not dropped cleanly");
+
+        FILE *file = fopen(path.c_str(), "ab");
+        fputs("garbage after the last record", file);
+        fclose(file);
+        ClearGraph();
+        Expect(RecoverJournal(path, error), error);
+        Expect(DescribeGraph() == states[states.size() - 2], "garbage tail replayed");
+
+        unlink(path.c_str());
+        ClearGraph();
+    }
+
+    void TestJournalCorruptSnapshot()
+    {
+        std::string path = TempPath("corrupt.tkj");
+        WriteJournal(path, false);
+
+        // Flip a byte inside the snapshot, just past the file and record
+        // headers.
+        FILE *file = fopen(path.c_str(), "r+b");
+        fseek(file, 24, SEEK_SET);
+        int byte = fgetc(file);
+        fseek(file, 24, SEEK_SET);
+        fputc(byte ^ 0xFF, file);
+        fclose(file);
+
+        ClearGraph();
+        std::string error;
+        Expect(!RecoverJournal(path, error), "corrupt snapshot accepted");
+        Expect(error == path + ": corrupt journal snapshot", "wrong error: " + error);
+        Expect(!RecoverJournal(TempPath("missing.tkj"), error), "missing journal accepted");
+
+        unlink(path.c_str());
+        ClearGraph();
+    }
+
+    std::string ReadTestFile(const std::string &path)
+    {
+        std::string bytes;
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return bytes;
+        char buffer[4096];
+        for (size_t count; (count = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+            bytes.append(buffer, count);
+        fclose(file);
+        return bytes;
+    }
+
+    // A graph that exercises what the file formats must keep: every kind,
+    // texts that need escaping, positions that need all their digits, a
+    // hole in the node ids and a pin whose list is out of slot order.
+    void BuildSampleGraph()
+    {
+        ClearGraph();
+        int start = CreateNode(NodeKernelStart);
+        int hole = CreateNode(NodeInstruction);
+        int letter = CreateNode(NodePrintChar);
+        int hub = CreateNode(NodeInstruction);
+        int end = CreateNode(NodeKernelEnd);
+        std::vector<int> leaves;
+        for (int i = 0; i < 3; ++i)
+        {
+            leaves.push_back(CreateNode(NodeInstruction));
+            SetNodeText(leaves[i], "inc " + std::string(i == 0 ? "ax" : i == 1 ? "bx" : "cx"));
+            SetNodePosition(leaves[i], NodePosition{300.0f, 40.0f * i});
+        }
+        DeleteNode(hole);
+
+        SetNodeText(letter, "H");
+        SetNodeText(hub, "mov al, 'a'\n\tint 0x10 ; back\\slash\r");
+        SetNodePosition(start, NodePosition{0.1f, -2.5e6f});
+        SetNodePosition(letter, NodePosition{1234.5678f, 3.3333333f});
+        SetNodePosition(hub, NodePosition{-0.0001f, 1e-7f});
+        SetNodePosition(end, NodePosition{16777217.0f, 0.0f});
+
+        AddLink(OutputPin(start), InputPin(letter));
+        AddLink(OutputPin(letter), InputPin(hub));
+        for (int leaf : leaves)
+            AddLink(OutputPin(hub), InputPin(leaf));
+        AddLink(OutputPin(hub), InputPin(end));
+        RemoveLink(FindLink(OutputPin(hub), InputPin(leaves[1])));
+        AddLink(OutputPin(hub), InputPin(leaves[1]));
+    }
+
+    // Saving and loading a .tkg keeps every node and each pin's link order.
+    // Files cut mid-record, or without the tkg header, are rejected.
+    void TestTextGraphRoundTrip()
+    {
+        std::string path = TempPath("round.tkg");
+        BuildSampleGraph();
+        std::string expected = DescribeGraph();
+        std::string error;
+        Expect(SaveGraph(path, error), "save: " + error);
+
+        ClearGraph();
+        Expect(LoadGraph(path, error), "load: " + error);
+        Expect(DescribeGraph() == expected, "loaded graph differs:\n" + DescribeGraph());
+        CheckGraphTables("loaded .tkg");
+
+        std::string saved = ReadTestFile(path);
+        Expect(SaveGraph(path, error) && LoadGraph(path, error) && DescribeGraph() == expected, "second round trip differs");
+
+        size_t lastLink = saved.rfind("\nlink ");
+        std::vector<std::pair<const char *, std::string>> broken = {
+            {"empty", ""},
+            {"cut header", saved.substr(0, 2)},
+            {"cut node", saved.substr(0, saved.find("\nnode ") + 8)},
+            {"cut link", saved.substr(0, lastLink + 7)},
+            {"bad magic", "tkx" + saved.substr(3)},
+            {"bad version", "tkg 99" + saved.substr(saved.find('\n'))},
+        };
+        for (const std::pair<const char *, std::string> &file : broken)
+        {
+            WriteFileBytes(path, file.second.data(), file.second.size());
+            error.clear();
+            Expect(!LoadGraph(path, error) && !error.empty(), std::string(file.first) + " file loaded");
+        }
+        unlink(path.c_str());
+        ClearGraph();
+    }
+
+    // Saving and loading a .tkp keeps every node and each pin's link order,
+    // and encoding the loaded graph gives the same bytes. Every truncation
+    // and a wrong magic or version are rejected.
+    void TestProjectRoundTrip()
+    {
+        std::string path = TempPath("round.tkp");
+        BuildSampleGraph();
+        std::string expected = DescribeGraph();
+        std::string error;
+        Expect(SaveGraph(path, error), "save: " + error);
+
+        ClearGraph();
+        Expect(LoadGraph(path, error), "load: " + error);
+        Expect(DescribeGraph() == expected, "loaded graph differs:\n" + DescribeGraph());
+        CheckGraphTables("loaded .tkp");
+
+        std::string saved = ReadTestFile(path);
+        GraphSnapshot snapshot;
+        SnapshotGraph(snapshot);
+        std::vector<char> buffer;
+        Expect(EncodeProject(snapshot, buffer, error), "encode: " + error);
+        Expect(std::string(buffer.begin(), buffer.end()) == saved, "encoding the loaded graph differs from the file");
+
+        ClearGraph();
+        Expect(LoadProject(path, buffer.data(), buffer.size(), error), "load from memory: " + error);
+        Expect(DescribeGraph() == expected, "graph loaded from memory differs");
+
+        for (size_t size = 0; size < buffer.size(); ++size)
+        {
+            error.clear();
+            if (LoadProject(path, buffer.data(), size, error) || error.empty())
+            {
+                Expect(false, "project cut to " + std::to_string(size) + " bytes loaded");
+                break;
+            }
+        }
+
+        std::vector<char> badMagic = buffer;
+        badMagic[0] = 'X';
+        Expect(!LoadProject(path, badMagic.data(), badMagic.size(), error), "project with a bad magic loaded");
+        WriteFileBytes(path, badMagic.data(), badMagic.size());
+        Expect(!LoadGraph(path, error), "file with a bad magic loaded");
+
+        std::vector<char> badVersion = buffer;
+        badVersion[4] = 99;
+        Expect(!LoadProject(path, badVersion.data(), badVersion.size(), error), "project with a bad version loaded");
+        unlink(path.c_str());
+        ClearGraph();
+    }
+
+    // Built next to the tests by `make test`.
+    constexpr const char *kCliPath = "./tkit";
+
+    // Runs the tkit CLI with the arguments and returns its exit status, or
+    // -1 if it did not exit normally. stderr goes to errorPath.
+    int RunCli(const std::string &arguments, const std::string &errorPath)
+    {
+        std::string command = std::string(kCliPath) + " " + arguments + " 2>" + errorPath;
+        int status = system(command.c_str());
+        return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    // tkit build exits 2 on bad usage and 1 on a failed build, and writes
+    // the image, and with -S the source that assembles to it, on success.
+    void TestCliBuild()
+    {
+        if (access(kCliPath, X_OK) != 0)
+        {
+            Expect(false, std::string(kCliPath) + " not built; run make test");
+            return;
+        }
+
+        std::string good = TempPath("cli-good.tkg");
+        std::string oversized = TempPath("cli-oversized.tkg");
+        std::string endless = TempPath("cli-endless.tkg");
+        std::string image = TempPath("cli-kernel.bin");
+        std::string source = TempPath("cli-kernel.asm");
+        std::string errors = TempPath("cli-errors.txt");
+        std::string error;
+
+        BuildInstructionChain(kBootSectorSize, "inc ax");
+        Expect(SaveGraph(oversized, error), "save oversized: " + error);
+        BuildInstructionChain(3, "inc ax");
+        RemoveLink(links.ids[links.size() - 1]);
+        Expect(SaveGraph(endless, error), "save endless: " + error);
+        std::vector<int> ids = BuildInstructionChain(2, "mov ah, 0x0e");
+        SetNodeText(ids[1], "mov al, 'K'\nint 0x10\n.idle: jmp .idle");
+        Expect(SaveGraph(good, error), "save good: " + error);
+        Expect(UpdateKernelImage(CompileKernel(), error), "in-process build: " + error);
+        std::vector<uint8_t> expected = kernelBuild.image;
+
+        Expect(RunCli("", errors) == 2, "no command accepted");
+        Expect(RunCli("build", errors) == 2, "no input accepted");
+        Expect(RunCli("build " + good + " -x", errors) == 2, "unknown option accepted");
+        Expect(RunCli("build " + good + " " + endless + " -o " + image, errors) == 2, "-o with several inputs accepted");
+
+        Expect(RunCli("build " + good + " -o " + image + " -S", errors) == 0, "good build failed: " + ReadTestFile(errors));
+        std::string bytes = ReadTestFile(image);
+        Expect(bytes.size() == kBootSectorSize && static_cast<uint8_t>(bytes[510]) == 0x55 && static_cast<uint8_t>(bytes[511]) == 0xAA,
+               "image is not a boot sector");
+        Expect(std::vector<uint8_t>(bytes.begin(), bytes.end()) == expected, "image differs from the in-process build");
+        std::vector<uint8_t> assembled;
+        AsmError asmError;
+        Expect(Assemble(ReadTestFile(source), assembled, asmError) && assembled == expected, "-S source does not assemble to the image");
+
+        Expect(RunCli("build " + TempPath("cli-missing.tkg") + " -o " + image, errors) == 1, "missing input built");
+        Expect(RunCli("build " + endless + " -o " + image, errors) == 1, "graph without kernel_end built");
+        Expect(ReadTestFile(errors).find("kernel_end not reachable") != std::string::npos, "wrong error: " + ReadTestFile(errors));
+        Expect(RunCli("build " + oversized + " -o " + image, errors) == 1, "oversized graph built");
+        Expect(ReadTestFile(errors).find("boot sector") != std::string::npos, "wrong error: " + ReadTestFile(errors));
+
+        std::string goodImage = TempPath("cli-good.bin");
+        unlink(goodImage.c_str());
+        Expect(RunCli("build " + good + " " + endless + " -j 2", errors) == 1, "batch with a failing graph succeeded");
+        Expect(ReadTestFile(goodImage).size() == kBootSectorSize, "batch did not build the good graph");
+
+        for (const std::string &path : {good, oversized, endless, image, source, errors, goodImage})
+            unlink(path.c_str());
+        ClearGraph();
+    }
+
+    typedef void (*TestFunction)();
+
+    struct Test
+    {
+        const char *name;
+        TestFunction run;
+    };
+
+    const Test kTests[] = {
+        {"qmp_connect_retry", TestQmpConnectRetry},
+        {"qmp_error_reply", TestQmpErrorReply},
+        {"qmp_shutdown_during_connect", TestQmpShutdownDuringConnect},
+        {"job_output", TestJobOutput},
+        {"job_cancel_after_output_closed", TestJobCancelAfterOutputClosed},
+        {"assembler_encodings", TestAssemblerEncodings},
+        {"assembler_layout", TestAssemblerLayout},
+        {"assembler_errors", TestAssemblerErrors},
+        {"emulator_teletype", TestEmulatorTeletype},
+        {"emulator_stops", TestEmulatorStops},
+        {"kernel_image_matches_source", TestKernelImageMatchesSource},
+        {"kernel_image_boot_sector", TestKernelImageBootSector},
+        {"kernel_image_steps", TestKernelImageSteps},
+        {"emulator_session", TestEmulatorSession},
+        {"pin_link_lists", TestPinLinkLists},
+        {"stale_pins", TestStalePins},
+        {"swap_remove", TestSwapRemove},
+        {"delete_nodes", TestDeleteNodes},
+        {"copy_paste", TestCopyPaste},
+        {"kernel_resume", TestKernelResume},
+        {"journal_replay", TestJournalReplay},
+        {"journal_torn_tail", TestJournalTornTail},
+        {"journal_corrupt_snapshot", TestJournalCorruptSnapshot},
+        {"text_graph_round_trip", TestTextGraphRoundTrip},
+        {"project_round_trip", TestProjectRoundTrip},
+        {"cli_build", TestCliBuild},
+    };
+
+    bool Selected(const char *list, const char *name)
+    {
+        if (list == nullptr)
+            return true;
+        std::string names = std::string(",") + list + ",";
+        return names.find(std::string(",") + name + ",") != std::string::npos;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: tkit_tests [name,...]\n");
+        return 2;
+    }
+
+    int failed = 0;
+    for (const Test &test : kTests)
+    {
+        if (!Selected(argc > 1 ? argv[1] : nullptr, test.name))
+            continue;
+
+        currentTest = test.name;
+        currentFailures = 0;
+        test.run();
+        if (currentFailures == 0)
+            printf("ok %s\n", test.name);
+        else
+            ++failed;
+    }
+    return failed;
+}
@@ -0,0 +1,193 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "graph.h"
+
+// Headless compiler for batch builds. It links only the graph module and the
+// assembler, so it starts without a display or GL context:
+//
+//   tkit build graph.tkg -o kernel.bin [-S]
+//   tkit build a.tkg b.tkg c.tkg -j 8
+//
+// -S also writes the generated source next to the image, as kernel.asm for
+// kernel.bin. With several inputs each graph writes <input>.bin next to
+// itself and is built in its own child process, at most -j at a time
+// (default: one per CPU).
+
+namespace
+{
+    struct BuildJob
+    {
+        std::string input;
+        std::string output;
+        std::string source;
+    };
+
+    void PrintUsage()
+    {
+        fprintf(stderr, "usage: tkit build <graph.tkg>... [-o kernel.bin] [-S] [-j jobs]\n");
+    }
+
+    std::string ReplaceExtension(const std::string &path, const char *extension)
+    {
+        size_t slash = path.find_last_of('/');
+        size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return path + extension;
+        return path.substr(0, dot) + extension;
+    }
+
+    bool BuildGraph(const BuildJob &job)
+    {
+        std::string error;
+        if (!LoadGraph(job.input, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return false;
+        }
+
+        const KernelProgram &program = CompileKernel();
+        if (!program.hasStart)
+        {
+            fprintf(stderr, "%s: kernel_start not found\n", job.input.c_str());
+            return false;
+        }
+        if (!program.reachesEnd)
+        {
+            fprintf(stderr, "%s: kernel_end not reachable\n", job.input.c_str());
+            return false;
+        }
+
+        if (!UpdateKernelImage(program, error))
+        {
+            fprintf(stderr, "%s: %s\n", job.input.c_str(), error.c_str());
+            return false;
+        }
+        if (!WriteFileBytes(job.output, kernelBuild.image.data(), kernelBuild.image.size()))
+        {
+            fprintf(stderr, "%s: could not write %s\n", job.input.c_str(), job.output.c_str());
+            return false;
+        }
+
+        if (!job.source.empty())
+        {
+            StepAssemblerEmit(JobClock::time_point::max());
+            if (!WriteFileBytes(job.source, assemblerEmit.text.data(), assemblerEmit.text.size()))
+            {
+                fprintf(stderr, "%s: could not write %s\n", job.input.c_str(), job.source.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Forks one child per graph, keeping at most maxJobs running. Graph state
+    // is global, so a process per build is what keeps builds independent.
+    int BuildInParallel(const std::vector<BuildJob> &jobs, int maxJobs)
+    {
+        int failed = 0;
+        int running = 0;
+        size_t next = 0;
+
+        while (next < jobs.size() || running > 0)
+        {
+            if (next < jobs.size() && running < maxJobs)
+            {
+                fflush(stderr);
+                pid_t pid = fork();
+                if (pid == 0)
+                    _exit(BuildGraph(jobs[next]) ? 0 : 1);
+                if (pid < 0)
+                {
+                    fprintf(stderr, "%s: could not fork: %s\n", jobs[next].input.c_str(), strerror(errno));
+                    ++failed;
+                }
+                else
+                {
+                    ++running;
+                }
+                ++next;
+                continue;
+            }
+
+            int status = 0;
+            if (wait(&status) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            --running;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ++failed;
+        }
+        return failed;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || strcmp(argv[1], "build") != 0)
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<std::string> inputs;
+    std::string output;
+    bool writeSource = false;
+    long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (arg == "-S")
+        {
+            writeSource = true;
+        }
+        else if (arg == "-j" && i + 1 < argc)
+        {
+            maxJobs = strtol(argv[++i], nullptr, 10);
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            PrintUsage();
+            return 2;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (inputs.empty() || (inputs.size() > 1 && !output.empty()))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<BuildJob> jobs;
+    for (const std::string &input : inputs)
+    {
+        BuildJob job;
+        job.input = input;
+        job.output = output.empty() ? ReplaceExtension(input, ".bin") : output;
+        if (writeSource)
+            job.source = ReplaceExtension(job.output, ".asm");
+        jobs.push_back(job);
+    }
+
+    if (jobs.size() == 1)
+        return BuildGraph(jobs[0]) ? 0 : 1;
+    return BuildInParallel(jobs, maxJobs < 1 ? 1 : static_cast<int>(maxJobs)) == 0 ? 0 : 1;
+}